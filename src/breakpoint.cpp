@@ -0,0 +1,82 @@
+/*
+ * breakpoint.cpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include "include/breakpoint.hpp"
+
+Breakpoints::Breakpoints() { clear(); }
+
+void Breakpoints::clear() {
+  execBits.assign(1, std::vector<uint64_t>(BREAKPOINT_BITMAP_WORDS, 0));
+  memset(opcodeBits, 0, sizeof(opcodeBits));
+  watchpoints.clear();
+  hits.clear();
+  updateWatchedPages();
+}
+void Breakpoints::addExec(uint16_t addr, int bank) {
+  size_t index = (addr >= 0x4000 && addr < 0x8000) ? bank : 0;
+  if (index >= execBits.size()) {
+    execBits.resize(index + 1, std::vector<uint64_t>(BREAKPOINT_BITMAP_WORDS, 0));
+  }
+  execBits[index][addr >> 6] |= 1ULL << (addr & 63);
+}
+void Breakpoints::removeExec(uint16_t addr, int bank) {
+  size_t index = (addr >= 0x4000 && addr < 0x8000) ? bank : 0;
+  if (index < execBits.size()) {
+    execBits[index][addr >> 6] &= ~(1ULL << (addr & 63));
+  }
+}
+void Breakpoints::addOpcode(uint8_t opcode) { opcodeBits[opcode >> 6] |= 1ULL << (opcode & 63); }
+void Breakpoints::addWatch(const Watchpoint &watchpoint) {
+  watchpoints.push_back(watchpoint);
+  updateWatchedPages();
+}
+void Breakpoints::addIo(uint16_t addr) {
+  Watchpoint watchpoint = {addr, addr, WATCH_READ | WATCH_WRITE | WATCH_IO, false, 0};
+  addWatch(watchpoint);
+}
+void Breakpoints::updateWatchedPages() {
+  memset(watchedPages, 0, sizeof(watchedPages));
+  for (auto &watchpoint : watchpoints) {
+    for (int page = watchpoint.start >> WATCH_PAGE_SHIFT; page <= watchpoint.end >> WATCH_PAGE_SHIFT; page++) {
+      watchedPages[page] |= watchpoint.type & (WATCH_READ | WATCH_WRITE);
+    }
+  }
+}
+const uint8_t *Breakpoints::getWatchedPages() { return watchedPages; }
+
+void Breakpoints::check(uint8_t type, uint16_t addr, uint8_t value) {
+  for (auto &watchpoint : watchpoints) {
+    if ((watchpoint.type & type) && addr >= watchpoint.start && addr <= watchpoint.end &&
+        (!watchpoint.hasValue || watchpoint.value == value)) {
+      BreakHit hit = {static_cast<uint8_t>(type | (watchpoint.type & WATCH_IO)), addr, value};
+      hits.push_back(hit);
+      return;
+    }
+  }
+}
+void Breakpoints::onRead(uint16_t addr, uint8_t value) { check(WATCH_READ, addr, value); }
+void Breakpoints::onWrite(uint16_t addr, uint8_t value) { check(WATCH_WRITE, addr, value); }
+
+bool Breakpoints::takeHits(std::vector<BreakHit> &out) {
+  out.clear();
+  if (hits.empty()) return false;
+  out.swap(hits);
+  return true;
+}
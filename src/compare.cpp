@@ -0,0 +1,129 @@
+/*
+ * compare.cpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include "include/compare.hpp"
+
+TraceComparator::TraceComparator(Cpu *cpu, Mmu *mmu) {
+  this->cpu = cpu;
+  this->mmu = mmu;
+  reference = nullptr;
+  matched = 0;
+  remaining = 0;
+  diverged = done = false;
+}
+TraceComparator::~TraceComparator() { delete reference; }
+
+bool TraceComparator::open(const std::string &filePath) {
+  delete reference;
+  if (TraceSource::isBinary(filePath)) {
+    reference = new TraceReader();
+  } else {
+    reference = new DoctorReader();
+  }
+  if (!reference->open(filePath)) {
+    delete reference;
+    reference = nullptr;
+    return false;
+  }
+  memset(&live, 0, sizeof(live));
+  matched = 0;
+  diverged = done = false;
+  return true;
+}
+bool TraceComparator::isOpen() { return reference != nullptr; }
+bool TraceComparator::isDone() { return done; }
+bool TraceComparator::isDiverged() { return diverged; }
+
+void TraceComparator::capture() {
+  CpuRegister &reg = cpu->cpuRegister;
+  live.regs[TRACE_A] = reg.reg_a;
+  live.regs[TRACE_F] = reg.reg_f;
+  live.regs[TRACE_B] = reg.reg_b;
+  live.regs[TRACE_C] = reg.reg_c;
+  live.regs[TRACE_D] = reg.reg_d;
+  live.regs[TRACE_E] = reg.reg_e;
+  live.regs[TRACE_H] = reg.reg_h;
+  live.regs[TRACE_L] = reg.reg_l;
+  live.sp = reg.sp;
+  live.pc = reg.pc;
+  for (int i = 0; i < 4; i++) {
+    live.code[i] = mmu->peekByte(live.pc + i);
+  }
+  live.hasCode = true;
+}
+std::string TraceComparator::describe(const TraceEntry &entry) {
+  char line[128];
+  formatDoctor(entry, line, sizeof(line));
+  return line;
+}
+
+void TraceComparator::before() {
+  capture();
+  if (diverged) {
+    printf("  live %s\n", describe(live).c_str());
+    done = --remaining <= 0;
+    return;
+  }
+  const TraceEntry *expected = reference->next();
+  if (!expected) {
+    printf("Reference ended after %lu instructions without a divergence\n", matched);
+    done = true;
+    return;
+  }
+  bool same = memcmp(live.regs, expected->regs, sizeof(live.regs)) == 0 && live.sp == expected->sp &&
+      live.pc == expected->pc && (!expected->hasCode || memcmp(live.code, expected->code, sizeof(live.code)) == 0);
+  if (same) {
+    history[matched % COMPARE_CONTEXT] = live;
+    matched++;
+    return;
+  }
+  report(*expected);
+}
+void TraceComparator::report(const TraceEntry &expected) {
+  static const char *REGISTER_NAMES[TRACE_REGISTER_COUNT] = {"A", "F", "B", "C", "D", "E", "H", "L"};
+  printf("Divergence at instruction %lu\n", matched);
+  uint64_t first = matched > COMPARE_CONTEXT ? matched - COMPARE_CONTEXT : 0;
+  for (uint64_t i = first; i < matched; i++) {
+    printf("       %s\n", describe(history[i % COMPARE_CONTEXT]).c_str());
+  }
+  printf("  want %s\n", describe(expected).c_str());
+  printf("  got  %s\n", describe(live).c_str());
+  printf("  differs:");
+  for (int i = 0; i < TRACE_REGISTER_COUNT; i++) {
+    if (live.regs[i] != expected.regs[i]) printf(" %s", REGISTER_NAMES[i]);
+  }
+  if (live.sp != expected.sp) printf(" SP");
+  if (live.pc != expected.pc) printf(" PC");
+  if (expected.hasCode && memcmp(live.code, expected.code, sizeof(live.code)) != 0) printf(" PCMEM");
+  printf("\nReference continues:\n");
+  const TraceEntry *next;
+  for (int i = 0; i < COMPARE_CONTEXT && (next = reference->next()); i++) {
+    printf("  want %s\n", describe(*next).c_str());
+  }
+  printf("Live continues:\n");
+  diverged = true;
+  remaining = COMPARE_CONTEXT;
+}
+void TraceComparator::finish() {
+  if (!diverged && !done) {
+    printf("Run ended after %lu matching instructions\n", matched);
+  }
+}
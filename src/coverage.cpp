@@ -0,0 +1,179 @@
+/*
+ * coverage.cpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include "include/coverage.hpp"
+#include "include/gameboy.hpp"
+#include "include/timeline.hpp"
+
+#define COVERAGE_HEADER_SIZE 20
+
+static void writeLe(std::vector<uint8_t> &out, uint64_t value, int size) {
+  for (int i = 0; i < size; i++) {
+    out.push_back(uint8_t(value >> (8 * i)));
+  }
+}
+static uint64_t readLe(const uint8_t *in, int size) {
+  uint64_t value = 0;
+  for (int i = 0; i < size; i++) {
+    value |= uint64_t(in[i]) << (8 * i);
+  }
+  return value;
+}
+
+Coverage::Coverage(Mmu *mmu) {
+  this->mmu = mmu;
+  flags.assign((mmu ? mmu->getRomBankCount() : 2) * size_t(COVERAGE_BANK_SIZE), 0);
+  romHash = 0;
+  active = false;
+  fetchStart = fetchEnd = 0;
+  // only ROM reads are classified
+  memset(watchedPages, 0, sizeof(watchedPages));
+  memset(watchedPages, WATCH_READ, (2 * COVERAGE_BANK_SIZE) >> WATCH_PAGE_SHIFT);
+}
+Coverage::~Coverage() { stop(); }
+
+void Coverage::start() {
+  uint8_t bank0[COVERAGE_BANK_SIZE];
+  for (int addr = 0; addr < COVERAGE_BANK_SIZE; addr++) {
+    bank0[addr] = mmu->peekByte(addr);
+  }
+  romHash = fnv1a(bank0, sizeof(bank0));
+  mmu->setWatcher(this);
+  active = true;
+}
+void Coverage::stop() {
+  if (!active) return;
+  mmu->setWatcher(nullptr);
+  active = false;
+}
+bool Coverage::isActive() { return active; }
+
+const uint8_t *Coverage::getWatchedPages() { return watchedPages; }
+void Coverage::onRead(uint16_t addr, uint8_t value) {
+  // fetchEnd may have wrapped past 0xFFFF, compare relative to the start
+  if (uint16_t(addr - fetchStart) < uint16_t(fetchEnd - fetchStart)) return;
+  flags[romOffset(addr)] |= COVER_READ;
+}
+void Coverage::onWrite(uint16_t addr, uint8_t value) {}
+
+void Coverage::merge(const Coverage &other) {
+  if (other.flags.size() > flags.size()) flags.resize(other.flags.size(), 0);
+  for (size_t i = 0; i < other.flags.size(); i++) {
+    flags[i] |= other.flags[i];
+  }
+  if (!romHash) romHash = other.romHash;
+}
+
+bool Coverage::mergeFile(const std::string &filePath) {
+  Coverage earlier;
+  if (!earlier.load(filePath)) return false;
+  if (earlier.romHash != romHash) {
+    printf("%s: Coverage of a different ROM, overwriting\n", filePath.c_str());
+    return false;
+  }
+  merge(earlier);
+  return true;
+}
+
+bool Coverage::save(const std::string &filePath) {
+  TIMELINE_SCOPE("coverage flush");
+  std::vector<uint8_t> out;
+  writeLe(out, COVERAGE_MAGIC, 4);
+  writeLe(out, COVERAGE_VERSION, 2);
+  writeLe(out, COVERAGE_FLAG_COUNT, 2);
+  writeLe(out, romHash, 8);
+  writeLe(out, flags.size(), 4);
+  size_t bitmapSize = (flags.size() + 7) / 8;
+  for (int bit = 0; bit < COVERAGE_FLAG_COUNT; bit++) {
+    size_t base = out.size();
+    out.resize(base + bitmapSize, 0);
+    for (size_t i = 0; i < flags.size(); i++) {
+      if (flags[i] & (1 << bit)) out[base + i / 8] |= 1 << (i % 8);
+    }
+  }
+  std::ofstream stream(filePath, std::ios::binary | std::ios::out);
+  if (!stream.is_open()) {
+    printf("%s: Could not write coverage\n", filePath.c_str());
+    return false;
+  }
+  stream.write(reinterpret_cast<const char*>(out.data()), out.size());
+  return true;
+}
+
+bool Coverage::load(const std::string &filePath) {
+  std::ifstream stream(filePath, std::ios::binary | std::ios::in);
+  if (!stream.is_open()) return false;
+  std::vector<uint8_t> in((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+  if (in.size() < COVERAGE_HEADER_SIZE || readLe(in.data(), 4) != COVERAGE_MAGIC) {
+    printf("%s: Not a coverage file\n", filePath.c_str());
+    return false;
+  }
+  if (readLe(in.data() + 4, 2) != COVERAGE_VERSION) {
+    printf("%s: Unsupported coverage version\n", filePath.c_str());
+    return false;
+  }
+  int bitmaps = readLe(in.data() + 6, 2);
+  size_t size = readLe(in.data() + 16, 4);
+  size_t bitmapSize = (size + 7) / 8;
+  if (in.size() < COVERAGE_HEADER_SIZE + bitmapSize * bitmaps) {
+    printf("%s: Coverage file is truncated\n", filePath.c_str());
+    return false;
+  }
+  romHash = readLe(in.data() + 8, 8);
+  flags.assign(size, 0);
+  // unknown bitmaps from newer writers are skipped
+  for (int bit = 0; bit < bitmaps && bit < COVERAGE_FLAG_COUNT; bit++) {
+    const uint8_t *bitmap = in.data() + COVERAGE_HEADER_SIZE + bitmapSize * bit;
+    for (size_t i = 0; i < size; i++) {
+      if (bitmap[i / 8] & (1 << (i % 8))) flags[i] |= 1 << bit;
+    }
+  }
+  return true;
+}
+
+const std::vector<uint8_t> &Coverage::getFlags() { return flags; }
+uint64_t Coverage::getRomHash() { return romHash; }
+
+void Coverage::printSummary() {
+  size_t total[COVERAGE_FLAG_COUNT] = {}, touched = 0;
+  printf("Coverage:\n");
+  printf("%-6s %8s %8s %8s %8s\n", "bank", "opcode", "operand", "read", "covered");
+  for (size_t bank = 0; bank * COVERAGE_BANK_SIZE < flags.size(); bank++) {
+    size_t counts[COVERAGE_FLAG_COUNT] = {}, covered = 0;
+    for (size_t i = bank * COVERAGE_BANK_SIZE; i < (bank + 1) * COVERAGE_BANK_SIZE && i < flags.size(); i++) {
+      for (int bit = 0; bit < COVERAGE_FLAG_COUNT; bit++) {
+        if (flags[i] & (1 << bit)) counts[bit]++;
+      }
+      if (flags[i]) covered++;
+    }
+    touched += covered;
+    // banks the run never reached still count towards the total
+    if (!covered) continue;
+    for (int bit = 0; bit < COVERAGE_FLAG_COUNT; bit++) {
+      total[bit] += counts[bit];
+    }
+    printf("%02zX     %8zu %8zu %8zu %7.2f%%\n", bank, counts[0], counts[1], counts[2],
+        100.0 * covered / COVERAGE_BANK_SIZE);
+  }
+  printf("%-6s %8zu %8zu %8zu %7.2f%%\n", "total", total[0], total[1], total[2],
+      flags.empty() ? 0.0 : 100.0 * touched / flags.size());
+}
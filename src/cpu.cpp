@@ -17,18 +17,16 @@
  */
 
 #include <cstdint>
+#include <algorithm>
 #include "include/cpu.hpp"
 
-// poc
-uint8_t isEiRequested = false;
-uint8_t eiDelayCount = 0;
-
 Cpu::Cpu() {
     this->initializeRegisters();
 }
+Cpu::~Cpu() {}
 void Cpu::setMmu(Mmu *mmu) { this->mmu = mmu; }
 void Cpu::setHalt(bool *halt) { this->halt = halt; }
-void Cpu::setIme(bool *ime) { this->ime = ime; }
+void Cpu::setScheduler(Scheduler *scheduler) { this->scheduler = scheduler; }
 void Cpu::checkFlagH(uint8_t left, uint8_t right, bool isSubtraction) {
     if (isSubtraction) {
         uint8_t result = (left & 0x0F) - (right & 0x0F);
@@ -192,19 +190,21 @@ uint8_t Cpu::decode(uint8_t opcode) {
             break;
             // SPECIAL
         case op_nop:
+            break;
+        // CGB speed switch, armed through KEY1
         case op_stop_0:
+            if (scheduler && mmu->isCgb() && (mmu->readIo(KEY1_ADDR) & KEY1_PREPARE)) {
+                scheduler->schedule(EVENT_SPEED_SWITCH, 0);
+            }
+            break;
         case op_halt:
+            mmu->getInterrupts().halt();
+            break;
         case op_di:
-            *ime = false;
+            mmu->getInterrupts().disable();
             break;
         case op_ei:
-            // 1 ins. delay
-            isEiRequested = true;
-            if (isEiRequested && eiDelayCount == 1) {
-                *ime = true;
-                isEiRequested = false;
-                eiDelayCount = 0;
-            }
+            mmu->getInterrupts().enableDelayed();
             break;
             // ROTATES AND SHIFTS
         case op_rlca: {
@@ -452,7 +452,7 @@ uint8_t Cpu::decode(uint8_t opcode) {
                        }
                        break;
         case op_reti:
-                       *ime = true;
+                       mmu->getInterrupts().enable();
                        instructionRet();
                        break;
         case op_pop_bc:
@@ -527,7 +527,6 @@ uint8_t Cpu::decode(uint8_t opcode) {
         case op_rst_28h:
         case op_rst_30h:
         case op_rst_38h: {
-                             *ime = false;
                              uint8_t rstAddr = (opcode & 0x38);
                              instructionStackPush(currentPc + 1);
                              cpuRegister.pc = rstAddr;
@@ -1311,15 +1310,23 @@ uint8_t Cpu::decodeCb(uint8_t opcode) {
                    // unknown cb opcode
                    *halt = true;
     }
-    if (isEiRequested) {
-        if (eiDelayCount != 1) {
-            eiDelayCount++;
-        } else {
-            decode(op_ei); // do not use return value
-        }
-    }
     return tick;
 }
+void Cpu::saveState(std::vector<uint8_t> &state) {
+    state.insert(state.end(), cpuRegister.all_reg, cpuRegister.all_reg + 8);
+    uint8_t misc[] = {
+        uint8_t(cpuRegister.sp), uint8_t(cpuRegister.sp >> 8),
+        uint8_t(cpuRegister.pc), uint8_t(cpuRegister.pc >> 8),
+    };
+    state.insert(state.end(), misc, misc + sizeof(misc));
+}
+const uint8_t *Cpu::loadState(const uint8_t *state) {
+    std::copy(state, state + 8, cpuRegister.all_reg);
+    state += 8;
+    cpuRegister.sp = state[0] | (state[1] << 8);
+    cpuRegister.pc = state[2] | (state[3] << 8);
+    return state + 4;
+}
 void Cpu::initializeRegisters() {
     this->cpuRegister.reg_a = 0;
     this->cpuRegister.reg_b = 0;
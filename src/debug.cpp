@@ -16,43 +16,96 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
 #include "include/debug.hpp"
 
-Debug::Debug(Cpu *cpu, Mmu *mmu) {
+Debug::Debug(Cpu *cpu, Mmu *mmu) : console(&commands, &events), profiler(cpu, mmu), recorder(cpu, mmu),
+    comparator(cpu, mmu), coverage(mmu) {
   iterate = 0;
-  storeOpcode = storeIterate = storeFfwd = storePc = 0;
+  storeIterate = storeFfwd = 0;
   debugDisable = false;
+  traceDropped = 0;
+  profiling = false;
   this->cpu = cpu;
   this->mmu = mmu;
   break_n.breakCode = 0xFF;  // temporary break
+  mmu->setWatcher(&breakpoints);
+}
+Debug::~Debug() {
+  console.stop();
+  recorder.close();
+  coverage.stop();
+  mmu->setWatcher(nullptr);
+}
+
+// "[bank:]addr", hex
+static void parseBankAddr(const std::string &text, int &bank, uint16_t &addr) {
+  size_t colon = text.find(':');
+  bank = colon == std::string::npos ? 0 : std::stoi(text.substr(0, colon), nullptr, 16);
+  addr = std::stoul(text.substr(colon == std::string::npos ? 0 : colon + 1), nullptr, 16);
+}
+// "start[-end][=value]", hex
+static Watchpoint parseWatch(const std::string &text, uint8_t type) {
+  Watchpoint watchpoint = {};
+  size_t dash = text.find('-');
+  size_t equals = text.find('=');
+  watchpoint.type = type;
+  watchpoint.start = std::stoul(text, nullptr, 16);
+  watchpoint.end = dash == std::string::npos ? watchpoint.start : std::stoul(text.substr(dash + 1), nullptr, 16);
+  if (equals != std::string::npos) {
+    watchpoint.hasValue = true;
+    watchpoint.value = std::stoul(text.substr(equals + 1), nullptr, 16);
+  }
+  return watchpoint;
 }
 
-void Debug::print() {
-  int pc = cpu->cpuRegister.pc;
-  int sp = cpu->cpuRegister.sp;
-  printf("ITER: %lu\n", iterate);
-  printf(
-      "PC: %04X (%02X)  SP: %04X\nAF: %04X  BC: %04X  DE: %04X  HL: %04X  %s\n",
-      pc, mmu->readByte(pc), cpu->cpuRegister.sp, cpu->cpuRegister.reg_pair_af,
-      cpu->cpuRegister.reg_pair_bc, cpu->cpuRegister.reg_pair_de,
-      cpu->cpuRegister.reg_pair_hl,
-      OP_INSTRUCTION[mmu->readByte(cpu->cpuRegister.pc)]);
-  printf("MEMORY       STACK:\n");
+DebugSnapshot Debug::snapshot() {
+  DebugSnapshot snapshot;
+  snapshot.iterate = iterate;
+  snapshot.pc = cpu->cpuRegister.pc;
+  snapshot.sp = cpu->cpuRegister.sp;
+  snapshot.af = cpu->cpuRegister.reg_pair_af;
+  snapshot.bc = cpu->cpuRegister.reg_pair_bc;
+  snapshot.de = cpu->cpuRegister.reg_pair_de;
+  snapshot.hl = cpu->cpuRegister.reg_pair_hl;
   for (int x = 0; x < 4; x++) {
-    if (pc + x < 0xFFFF)
-      printf("[%04X: %02X]   ", pc + x, mmu->readByte(pc + x));
-    if (sp + x < 0xFFFF)
-      printf("[%04X: %02X]   ", sp + x, mmu->readByte(sp + x));
-    printf("\n");
+    snapshot.code[x] = mmu->peekByte(snapshot.pc + x);
+    snapshot.stack[x] = mmu->peekByte(snapshot.sp + x);
   }
+  return snapshot;
 }
-void Debug::endDebug() {
+void Debug::endDebug(const PerfCounters &counters) {
+  flushTrace();
+  console.stop();
+  if (comparator.isOpen()) {
+    comparator.finish();
+    return;
+  }
+  if (recorder.isOpen()) {
+    recorder.close();
+    printf("Recorded %lu instructions, %lu bytes\n", recorder.getRecords(), recorder.getBytes());
+    return;
+  }
+  if (profiling) {
+    profiler.writeFolded(PROFILE_PATH);
+    profiler.printTable();
+    return;
+  }
+  if (coverage.isActive()) {
+    coverage.stop();
+    // accumulates over earlier runs of the same ROM
+    coverage.mergeFile(COVERAGE_PATH);
+    coverage.save(COVERAGE_PATH);
+    coverage.printSummary();
+  }
   int usedOpcodes = 0;
   printf("Program ended with %lu iterations!\n", iterate);
   printf("All used opcodes:\n");
   printf("Opcodes:\n");
-  for (int a = 0; a < 0xFF; a++) {
-    uint64_t tmp = opcodeTally[a];
+  for (int a = 0; a < 0x100; a++) {
+    uint64_t tmp = counters.opcodes[a];
     if (tmp) {
       printf("%02X: %lu\n", a, tmp);
       usedOpcodes++;
@@ -62,8 +115,8 @@ void Debug::endDebug() {
   printf("-----------\n");
   usedOpcodes = 0;
   printf("CB Opcodes:\n");
-  for (int a = 0; a < 0xFF; a++) {
-    uint64_t tmp = opcodeTallyCb[a];
+  for (int a = 0; a < 0x100; a++) {
+    uint64_t tmp = counters.opcodesCb[a];
     if (tmp) {
       printf("%02X: %lu\n", a, tmp);
       usedOpcodes++;
@@ -72,93 +125,298 @@ void Debug::endDebug() {
   printf("(%03d used)\n", usedOpcodes);
   printf("-----------\n");
 }
-void Debug::interact() {
-  std::string convert;
-  char x[100];
-  char opt;
-  std::cin.getline(x, 100);
-  convert = x + 1;
-  opt = x[0];
-
-  std::stringstream ss;
-  switch (opt) {
-      case 'a':
-        break_n.breakCode = 0;
-          break_n.continous = 1;
-          break;
-    case 'f':
-      if (!(x[1] == '\0')) {
-        break_n.breakCode = 0;
-        break_n.ffwd = 1;
-        storeFfwd = iterate + std::stoul(convert);
-      }
-      break;
-    case 'c':
+// runs on the emulator thread, commands that set a break condition resume
+bool Debug::apply(const DebugCommand &command) {
+  switch (command.type) {
+    case COMMAND_CONTINUOUS:
       break_n.breakCode = 0;
-      break;
-    case 'o': {
-      if (!(x[1] == '\0')) {
-        break_n.breakCode = 0;
-        break_n.opcode = 1;
-        ss << std::hex << convert;
-        ss >> storeOpcode;
-      }
-    } break;
-    case 'p':
-      if (!(x[1] == '\0')) {
-        break_n.breakCode = 0;
-        break_n.pc = 1;
-        ss << std::hex << convert;
-        ss >> storePc;
-      }
-      break;
-    case 'n':
-      if (!(x[1] == '\0')) {
-        break_n.breakCode = 0;
-        break_n.next = 1;
-        storeFfwd = iterate + std::stoul(convert);
-      } else {
-        break_n.breakCode = 0;
-        break_n.next = 1;
-        storeFfwd = 1;
-      }
-      break;
-    case 'g':
-      if (!(x[1] == '\0')) {
-        break_n.breakCode = 0;
-        break_n.step = 1;
+      break_n.continous = 1;
+      return false;
+    case COMMAND_FFWD:
+      break_n.breakCode = 0;
+      break_n.ffwd = 1;
+      storeFfwd = iterate + command.count;
+      return false;
+    case COMMAND_CONTINUE:
+      break_n.breakCode = 0;
+      return false;
+    case COMMAND_OPCODE:
+      break_n.breakCode = 0;
+      breakpoints.addOpcode(command.addr);
+      return false;
+    case COMMAND_EXEC_ADD:
+      break_n.breakCode = 0;
+      breakpoints.addExec(command.addr, command.bank);
+      return false;
+    case COMMAND_EXEC_REMOVE:
+      breakpoints.removeExec(command.addr, command.bank);
+      return true;
+    case COMMAND_WATCH:
+      break_n.breakCode = 0;
+      breakpoints.addWatch(command.watchpoint);
+      return false;
+    case COMMAND_IO:
+      break_n.breakCode = 0;
+      breakpoints.addIo(command.addr);
+      return false;
+    case COMMAND_NEXT:
+      break_n.breakCode = 0;
+      break_n.next = 1;
+      storeFfwd = command.count ? iterate + command.count : 1;
+      return false;
+    case COMMAND_STEP:
+      break_n.breakCode = 0;
+      break_n.step = 1;
+      return false;
+    case COMMAND_PAUSE:
+      break_n.step = 1;
+      return true;
+    case COMMAND_MEMORY: {
+      DebugEvent event = {};
+      event.type = EVENT_MEMORY;
+      event.addr = command.addr;
+      for (int x = 0; x < DEBUG_MEMORY_VIEW; x++) {
+        event.memory.push_back(mmu->peekByte(command.addr + x));
       }
-      break;
-    case 'd': {
+      events.push(std::move(event));
+    } return true;
+    case COMMAND_DUMP: {
         std::ofstream stream("dump");
         if (stream.is_open()) {
             for (int x = 0; x < 0xFFFF; x++) {
-                stream << mmu->readByte(x);
+                stream << mmu->peekByte(x);
             }
         }
-        printf("\nDump saved!\n");
         stream.close();
-    } break;
+        DebugEvent event = {};
+        event.type = EVENT_MESSAGE;
+        event.message = "\nDump saved!\n";
+        events.push(std::move(event));
+    } return true;
+    case COMMAND_DETACH:
+      breakpoints.clear();
+      break_n.breakCode = 0;
+      return false;
   }
+  return true;
 }
-void Debug::startDebug() {
-  uint8_t opcode = mmu->readByte(cpu->cpuRegister.pc);
-  opcodeTally[opcode]++;
-  if (opcode == 0xCB) {
-    uint8_t opcodeCb = mmu->readByte(cpu->cpuRegister.pc + 1);
-    opcodeTallyCb[opcodeCb]++;
+// blocks the emulator until a command resumes it
+void Debug::pause() {
+  flushTrace();
+  DebugEvent event = {};
+  event.type = EVENT_PAUSED;
+  event.snapshot = snapshot();
+  event.hits = hits;
+  events.push(std::move(event));
+  DebugCommand command;
+  while (!commands.pop(command, 100) || apply(command)) {
   }
+}
+void Debug::trace() {
+  traceBuffer.push_back(snapshot());
+  if (traceBuffer.size() >= DEBUG_TRACE_BATCH) flushTrace();
+}
+// drops the batch instead of waiting when the console falls behind
+void Debug::flushTrace() {
+  if (traceBuffer.empty()) return;
+  if (events.size() >= DEBUG_TRACE_BACKLOG) {
+    traceDropped += traceBuffer.size();
+    traceBuffer.clear();
+    return;
+  }
+  DebugEvent event = {};
+  event.type = EVENT_TRACE;
+  event.trace.swap(traceBuffer);
+  event.dropped = traceDropped;
+  traceDropped = 0;
+  events.push(std::move(event));
+  traceBuffer.reserve(DEBUG_TRACE_BATCH);
+}
+void Debug::tally() { iterate++; }
+void Debug::checkBreak() {
+  DebugCommand command;
+  while (commands.tryPop(command)) {
+    apply(command);
+  }
+  uint8_t opcode = mmu->peekByte(cpu->cpuRegister.pc);
+  uint16_t pc = cpu->cpuRegister.pc;
+  // accesses of the previous instruction
+  bool watchHit = breakpoints.takeHits(hits);
   // forward, opc, pc
   if ((break_n.ffwd && storeFfwd < iterate) ||
-      (break_n.opcode && opcode == storeOpcode) ||
-      (break_n.pc && storePc == cpu->cpuRegister.pc) ||
+      breakpoints.isExecHit(pc, mmu->getRomBank(), opcode) || watchHit ||
       (break_n.next && storeFfwd < iterate) || (break_n.step)) {
-    print();
-    interact();
+    pause();
   }
   if (break_n.continous) {
-    //  iterate = 0;
-      print();
+    trace();
   };
-  iterate++;
+}
+void Debug::startConsole() { console.start(); }
+
+DebugConsole::DebugConsole(DebugQueue<DebugCommand> *commands, DebugQueue<DebugEvent> *events) {
+  this->commands = commands;
+  this->events = events;
+  running = false;
+  inputOpen = false;
+}
+void DebugConsole::start() {
+  running = true;
+  inputOpen = true;
+  thread = std::thread(&DebugConsole::loop, this);
+}
+void DebugConsole::stop() {
+  if (!thread.joinable()) return;
+  running = false;
+  thread.join();
+}
+void DebugConsole::loop() {
+  DebugEvent event;
+  while (running) {
+    while (events->tryPop(event)) {
+      printEvent(event);
+    }
+    struct pollfd input = {STDIN_FILENO, POLLIN, 0};
+    if (!inputOpen) {
+      if (events->pop(event, 10)) printEvent(event);
+    } else if (poll(&input, 1, 10) > 0) {
+      readInput();
+    }
+  }
+  while (events->tryPop(event)) {
+    printEvent(event);
+  }
+  fflush(stdout);
+}
+// reads what is available and queues every complete line. End of input
+// detaches the debugger so emulation is not left paused.
+void DebugConsole::readInput() {
+  char buffer[256];
+  ssize_t length = read(STDIN_FILENO, buffer, sizeof(buffer));
+  if (length <= 0) {
+    DebugCommand command = {};
+    command.type = COMMAND_DETACH;
+    commands->push(std::move(command));
+    inputOpen = false;
+    return;
+  }
+  pendingInput.append(buffer, length);
+  size_t newline;
+  while ((newline = pendingInput.find('\n')) != std::string::npos) {
+    std::string line = pendingInput.substr(0, newline);
+    pendingInput.erase(0, newline + 1);
+    DebugCommand command = {};
+    try {
+      if (parseCommand(line, command)) commands->push(std::move(command));
+    } catch (const std::exception &) {
+      printf("%s: Invalid argument\n", line.c_str());
+    }
+  }
+}
+bool DebugConsole::parseCommand(const std::string &line, DebugCommand &command) {
+  if (line.empty()) return false;
+  std::string convert = line.substr(1);
+  bool hasArgument = !convert.empty();
+  switch (line[0]) {
+    case 'a':
+      command.type = COMMAND_CONTINUOUS;
+      return true;
+    case 'f':
+      command.type = COMMAND_FFWD;
+      command.count = std::stoul(convert);
+      return hasArgument;
+    case 'c':
+      command.type = COMMAND_CONTINUE;
+      return true;
+    case 'o':
+      command.type = COMMAND_OPCODE;
+      command.addr = std::stoul(convert, nullptr, 16);
+      return hasArgument;
+    case 'p':
+      command.type = COMMAND_EXEC_ADD;
+      parseBankAddr(convert, command.bank, command.addr);
+      return hasArgument;
+    case 'u':
+      command.type = COMMAND_EXEC_REMOVE;
+      parseBankAddr(convert, command.bank, command.addr);
+      return hasArgument;
+    case 'r':
+      command.type = COMMAND_WATCH;
+      command.watchpoint = parseWatch(convert, WATCH_READ);
+      return hasArgument;
+    case 'w':
+      command.type = COMMAND_WATCH;
+      command.watchpoint = parseWatch(convert, WATCH_WRITE);
+      return hasArgument;
+    case 'i':
+      command.type = COMMAND_IO;
+      command.addr = std::stoul(convert, nullptr, 16);
+      return hasArgument;
+    case 'n':
+      command.type = COMMAND_NEXT;
+      command.count = hasArgument ? std::stoul(convert) : 0;
+      return true;
+    case 'g':
+      command.type = COMMAND_STEP;
+      return true;
+    case 'b':
+      command.type = COMMAND_PAUSE;
+      return true;
+    case 'm':
+      command.type = COMMAND_MEMORY;
+      command.addr = std::stoul(convert, nullptr, 16);
+      return hasArgument;
+    case 'd':
+      command.type = COMMAND_DUMP;
+      return true;
+  }
+  return false;
+}
+void DebugConsole::printEvent(const DebugEvent &event) {
+  const DebugSnapshot &snapshot = event.snapshot;
+  switch (event.type) {
+    case EVENT_PAUSED:
+      for (auto &hit : event.hits) {
+        printf("%s %s %04X: %02X\n", (hit.type & WATCH_IO) ? "IO" : "WATCH",
+            (hit.type & WATCH_WRITE) ? "write" : "read", hit.addr, hit.value);
+      }
+      printf("ITER: %lu\n", snapshot.iterate);
+      printf(
+          "PC: %04X (%02X)  SP: %04X\nAF: %04X  BC: %04X  DE: %04X  HL: %04X  %s\n",
+          snapshot.pc, snapshot.code[0], snapshot.sp, snapshot.af, snapshot.bc,
+          snapshot.de, snapshot.hl, OP_INSTRUCTION[snapshot.code[0]]);
+      printf("MEMORY       STACK:\n");
+      for (int x = 0; x < 4; x++) {
+        printf("[%04X: %02X]   [%04X: %02X]\n", (snapshot.pc + x) & 0xFFFF, snapshot.code[x],
+            (snapshot.sp + x) & 0xFFFF, snapshot.stack[x]);
+      }
+      break;
+    case EVENT_TRACE: {
+      // one write per batch
+      std::string text;
+      char line[128];
+      if (event.dropped) {
+        snprintf(line, sizeof(line), "(%lu trace records dropped)\n", event.dropped);
+        text += line;
+      }
+      for (auto &record : event.trace) {
+        snprintf(line, sizeof(line), "%lu PC: %04X (%02X) SP: %04X AF: %04X BC: %04X DE: %04X HL: %04X  %s\n",
+            record.iterate, record.pc, record.code[0], record.sp, record.af, record.bc, record.de,
+            record.hl, OP_INSTRUCTION[record.code[0]]);
+        text += line;
+      }
+      fwrite(text.data(), 1, text.size(), stdout);
+    } break;
+    case EVENT_MEMORY:
+      for (size_t x = 0; x < event.memory.size(); x++) {
+        if (x % 16 == 0) printf("%s%04X:", x ? "\n" : "", static_cast<unsigned>((event.addr + x) & 0xFFFF));
+        printf(" %02X", event.memory[x]);
+      }
+      printf("\n");
+      break;
+    case EVENT_MESSAGE:
+      printf("%s", event.message.c_str());
+      break;
+  }
+  fflush(stdout);
 }
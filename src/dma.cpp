@@ -0,0 +1,126 @@
+/*
+ * dma.cpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdint>
+#include "include/dma.hpp"
+#include "include/mmu.hpp"
+
+Dma::Dma(Mmu *mmu, Scheduler *scheduler) {
+  this->mmu = mmu;
+  this->scheduler = scheduler;
+  mmu->mapIo(DMA_ADDR, this, IO_WRITE);
+  // DMG carts see plain memory here
+  if (mmu->isCgb()) mmu->mapIo(HDMA5_ADDR, this, IO_READ | IO_WRITE);
+  reset();
+}
+
+void Dma::reset() {
+  oamSource = 0;
+  hdmaSource = 0;
+  hdmaDest = 0;
+  hdmaBlocks = 0x7F;
+  hdmaActive = false;
+  hdmaHblank = false;
+  scheduler->cancel(EVENT_OAM_DMA);
+  scheduler->cancel(EVENT_HDMA);
+  mmu->lockBus(false);
+}
+
+uint8_t Dma::readRegister(uint16_t addr) {
+  return (hdmaActive ? 0 : 0x80) | hdmaBlocks;
+}
+
+void Dma::writeRegister(uint16_t addr, uint8_t value) {
+  mmu->writeIo(addr, value);
+  if (addr == DMA_ADDR) {
+    // a new transfer restarts the window
+    oamSource = value << 8;
+    mmu->lockBus(true);
+    scheduler->schedule(EVENT_OAM_DMA, scheduler->toClock(OAM_DMA_CYCLES));
+    return;
+  }
+  // HDMA5, clearing bit 7 stops a running HBlank transfer
+  if (hdmaActive && hdmaHblank && !(value & 0x80)) {
+    hdmaActive = false;
+    return;
+  }
+  hdmaSource = ((mmu->readIo(HDMA1_ADDR) << 8) | mmu->readIo(HDMA2_ADDR)) & 0xFFF0;
+  hdmaDest = ((mmu->readIo(HDMA3_ADDR) << 8) | mmu->readIo(HDMA4_ADDR)) & 0x1FF0;
+  hdmaBlocks = value & 0x7F;
+  hdmaActive = true;
+  hdmaHblank = value & 0x80;
+  if (!hdmaHblank) scheduler->schedule(EVENT_HDMA, 0);
+}
+
+void Dma::finishOam() {
+  mmu->lockBus(false);
+  mmu->copyBlock(OAM_ADDR, oamSource, OAM_DMA_LENGTH);
+}
+
+uint32_t Dma::runHdma() {
+  if (!hdmaActive) return 0;
+  uint32_t blocks = hdmaHblank ? 1 : hdmaBlocks + 1;
+  // the destination wraps within VRAM
+  uint32_t length = blocks * HDMA_BLOCK_SIZE;
+  if (hdmaDest + length > 0x2000) length = 0x2000 - hdmaDest;
+  mmu->copyBlock(0x8000 | hdmaDest, hdmaSource, length);
+  if (length < blocks * HDMA_BLOCK_SIZE) {
+    mmu->copyBlock(0x8000, hdmaSource + length, blocks * HDMA_BLOCK_SIZE - length);
+  }
+  hdmaSource += blocks * HDMA_BLOCK_SIZE;
+  hdmaDest = (hdmaDest + blocks * HDMA_BLOCK_SIZE) & 0x1FF0;
+  hdmaBlocks -= blocks - 1;
+  if (hdmaBlocks-- == 0) {
+    hdmaBlocks = 0x7F;
+    hdmaActive = false;
+  }
+  return blocks * HDMA_BLOCK_CYCLES;
+}
+
+void Dma::forkFrom(Dma *parent) {
+  std::vector<uint8_t> state;
+  parent->saveState(state);
+  loadState(state.data());
+}
+
+void Dma::saveState(std::vector<uint8_t> &state) {
+  uint16_t remaining = 0;
+  if (scheduler->isScheduled(EVENT_OAM_DMA)) {
+    remaining = scheduler->getDue(EVENT_OAM_DMA) - scheduler->now();
+  }
+  uint8_t data[] = {uint8_t(remaining), uint8_t(remaining >> 8), uint8_t(oamSource >> 8),
+      uint8_t(hdmaSource), uint8_t(hdmaSource >> 8), uint8_t(hdmaDest), uint8_t(hdmaDest >> 8),
+      hdmaBlocks, uint8_t(hdmaActive | (hdmaHblank << 1))};
+  state.insert(state.end(), data, data + sizeof(data));
+}
+const uint8_t *Dma::loadState(const uint8_t *state) {
+  uint16_t remaining = state[0] | (state[1] << 8);
+  oamSource = state[2] << 8;
+  hdmaSource = state[3] | (state[4] << 8);
+  hdmaDest = state[5] | (state[6] << 8);
+  hdmaBlocks = state[7];
+  hdmaActive = state[8] & 0x01;
+  hdmaHblank = state[8] & 0x02;
+  if (remaining) {
+    scheduler->schedule(EVENT_OAM_DMA, remaining);
+  } else {
+    scheduler->cancel(EVENT_OAM_DMA);
+  }
+  mmu->lockBus(remaining != 0);
+  return state + 9;
+}
@@ -0,0 +1,256 @@
+/*
+ * farm.cpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdint>
+#include <cstdlib>
+#include <chrono>
+#include <new>
+#include "include/farm.hpp"
+#include "include/timeline.hpp"
+
+static uint64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Farm::Farm(uint8_t *romData, int instanceCount, int workerCount) {
+    if (workerCount <= 0) {
+        workerCount = std::thread::hardware_concurrency();
+        if (workerCount <= 0) workerCount = 1;
+    }
+    this->instanceCount = instanceCount;
+    this->workerCount = workerCount;
+    // pad machines to cache lines so workers never share one
+    machineStride = (sizeof(Machine) + sizeof(MemoryPage) * MMU_PAGE_COUNT + FARM_ARENA_ALIGN - 1)
+        & ~size_t(FARM_ARENA_ALIGN - 1);
+    arena = static_cast<uint8_t*>(std::aligned_alloc(FARM_ARENA_ALIGN, machineStride * instanceCount));
+    if (arena == NULL) throw std::bad_alloc();
+    for (int i = 0; i < instanceCount; i++) {
+        uint8_t *slot = arena + machineStride * i;
+        new (slot) Machine(romData, reinterpret_cast<MemoryPage*>(slot + sizeof(Machine)));
+    }
+    for (int i = 0; i < workerCount; i++) {
+        workers.push_back(new Worker());
+        workers[i]->steals = 0;
+    }
+    framesLeft.assign(instanceCount, 0);
+    latency.assign(instanceCount, {0, 0, UINT64_MAX, 0});
+    slicesLeft = 0;
+    stats = {};
+    generation = 0;
+    busyWorkers = 0;
+    stopping = false;
+    for (int i = 1; i < workerCount; i++) {
+        threads.emplace_back(&Farm::poolLoop, this, i);
+    }
+}
+
+Farm::~Farm() {
+    {
+        std::lock_guard<std::mutex> guard(poolLock);
+        stopping = true;
+    }
+    poolWake.notify_all();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (auto debug : debuggers) {
+        delete debug;
+    }
+    for (int i = 0; i < instanceCount; i++) {
+        getMachine(i)->~Machine();
+    }
+    std::free(arena);
+    for (auto worker : workers) {
+        delete worker;
+    }
+}
+
+int Farm::getInstanceCount() { return instanceCount; }
+
+bool Farm::openSaveFiles(const std::string &prefix) {
+    for (int i = 0; i < instanceCount; i++) {
+        if (!getMachine(i)->gameboy.openSaveFile(prefix + "." + std::to_string(i))) return false;
+    }
+    return true;
+}
+
+Machine *Farm::getMachine(int index) {
+    return reinterpret_cast<Machine*>(arena + machineStride * index);
+}
+
+const FarmLatency &Farm::getLatency(int index) { return latency[index]; }
+
+FarmStats Farm::getStats() { return stats; }
+
+// owner takes the most recently pushed instance, it is still in cache
+bool Farm::popTask(int worker, int &index) {
+    Worker *self = workers[worker];
+    std::lock_guard<std::mutex> guard(self->lock);
+    if (self->tasks.empty()) return false;
+    index = self->tasks.back();
+    self->tasks.pop_back();
+    return true;
+}
+
+// thieves take the oldest instance from the other end
+bool Farm::stealTask(int worker, int &index) {
+    for (int i = 1; i < workerCount; i++) {
+        Worker *victim = workers[(worker + i) % workerCount];
+        std::lock_guard<std::mutex> guard(victim->lock);
+        if (victim->tasks.empty()) continue;
+        index = victim->tasks.front();
+        victim->tasks.pop_front();
+        workers[worker]->steals++;
+        return true;
+    }
+    return false;
+}
+
+void Farm::runSlice(int worker, int index) {
+    TIMELINE_SCOPE_ARG("cpu slice", index);
+    Gameboy *gameboy = &getMachine(index)->gameboy;
+    uint64_t start = nowNs();
+    if (debuggers.empty()) {
+        gameboy->runFrame();
+    } else {
+        gameboy->runFrame<DebugCoverage>(debuggers[index]);
+    }
+    uint64_t elapsed = nowNs() - start;
+
+    FarmLatency &slice = latency[index];
+    slice.slices++;
+    slice.totalNs += elapsed;
+    if (elapsed < slice.minNs) slice.minNs = elapsed;
+    if (elapsed > slice.maxNs) slice.maxNs = elapsed;
+
+    // halted instances drop the rest of their frames
+    uint32_t done = gameboy->isHalted() ? framesLeft[index] : 1;
+    framesLeft[index] -= done;
+    if (framesLeft[index] > 0) {
+        Worker *self = workers[worker];
+        std::lock_guard<std::mutex> guard(self->lock);
+        self->tasks.push_back(index);
+    }
+    slicesLeft -= done;
+}
+
+// pool threads sleep between runFrames calls
+void Farm::poolLoop(int worker) {
+    TIMELINE_THREAD("farm worker " + std::to_string(worker));
+    uint64_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> guard(poolLock);
+            poolWake.wait(guard, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+        }
+        workerLoop(worker);
+        std::lock_guard<std::mutex> guard(poolLock);
+        if (--busyWorkers == 0) poolDone.notify_one();
+    }
+}
+
+void Farm::workerLoop(int worker) {
+    int index;
+    while (slicesLeft > 0) {
+        if (popTask(worker, index) || stealTask(worker, index)) {
+            runSlice(worker, index);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void Farm::runFrames(uint32_t frames) {
+    uint64_t startCycles = 0;
+    uint64_t total = 0;
+    for (int i = 0; i < instanceCount; i++) {
+        Gameboy *gameboy = &getMachine(i)->gameboy;
+        startCycles += gameboy->getCycles();
+        latency[i] = {0, 0, UINT64_MAX, 0};
+        framesLeft[i] = gameboy->isHalted() ? 0 : frames;
+        total += framesLeft[i];
+        if (framesLeft[i] > 0) {
+            workers[i % workerCount]->tasks.push_back(i);
+        }
+    }
+    for (auto worker : workers) {
+        worker->steals = 0;
+    }
+    slicesLeft = total;
+
+    uint64_t start = nowNs();
+    {
+        std::lock_guard<std::mutex> guard(poolLock);
+        busyWorkers = workerCount - 1;
+        generation++;
+    }
+    poolWake.notify_all();
+    workerLoop(0);
+    {
+        std::unique_lock<std::mutex> guard(poolLock);
+        poolDone.wait(guard, [&] { return busyWorkers == 0; });
+    }
+    uint64_t elapsed = nowNs() - start;
+
+    uint64_t endCycles = 0;
+    uint64_t slices = 0, sliceNs = 0;
+    stats.maxSliceNs = 0;
+    for (int i = 0; i < instanceCount; i++) {
+        endCycles += getMachine(i)->gameboy.getCycles();
+        slices += latency[i].slices;
+        sliceNs += latency[i].totalNs;
+        if (latency[i].maxNs > stats.maxSliceNs) stats.maxSliceNs = latency[i].maxNs;
+    }
+    // one slice per frame actually run, halted instances stop early
+    stats.frames = slices;
+    stats.cycles = endCycles - startCycles;
+    stats.steals = 0;
+    for (auto worker : workers) {
+        stats.steals += worker->steals;
+    }
+    stats.seconds = elapsed / 1e9;
+    stats.framesPerSecond = stats.seconds > 0 ? stats.frames / stats.seconds : 0;
+    stats.speed = stats.seconds > 0 ? stats.cycles / stats.seconds / GAMEBOY_CLOCK : 0;
+    stats.avgSliceNs = slices ? double(sliceNs) / slices : 0;
+}
+
+void Farm::enableCoverage() {
+    if (!debuggers.empty()) return;
+    for (int i = 0; i < instanceCount; i++) {
+        Machine *machine = getMachine(i);
+        debuggers.push_back(new Debug(&machine->cpu, &machine->mmu));
+        debuggers[i]->coverage.start();
+    }
+}
+
+void Farm::mergeCoverage(Coverage &total) {
+    for (auto debug : debuggers) {
+        total.merge(debug->coverage);
+    }
+}
+
+void Farm::printStats() {
+    printf("Farm: %d instances, %d workers\n", instanceCount, workerCount);
+    printf("Frames: %lu in %.3fs (%.1f frames/s, %.1fx realtime)\n",
+            stats.frames, stats.seconds, stats.framesPerSecond, stats.speed);
+    printf("Slice latency: avg %.1fus, max %.1fus, %lu steals\n",
+            stats.avgSliceNs / 1e3, stats.maxSliceNs / 1e3, stats.steals);
+}
@@ -17,113 +17,86 @@
  */
 
 #include <cstdint>
+#include <cstring>
+#include <chrono>
 #include "include/gameboy.hpp"
+#include "include/timeline.hpp"
 
-// isMessagePassed
-const char PASSED[] = {0x50, 0x61, 0x73, 0x73, 0x65, 0x64, 0x0a}; // PASSED\n
-int passedCount = 0;
-bool isPassed = false;
-// get first line message
-std::string buildMessage = "";
-bool isInitialMessageFetched = false;
-// islooping
-uint16_t lastPc = 0;
-uint8_t lastInstruction = 0;
-
-Gameboy::Gameboy(Cpu *cpu, Mmu *mmu) {
+static uint64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Gameboy::Gameboy(Cpu *cpu, Mmu *mmu) : ppu(mmu), serial(mmu, &scheduler), timer(mmu, &scheduler),
+        dma(mmu, &scheduler) {
     halt = false;
-    ime = false;
+    cycles = 0;
+    scheduler.setClock(&cycles);
+    lastPc = 0;
+    lastInstruction = 0;
+    memset(&counters, 0, sizeof(counters));
+    countOpcodes = false;
+    debugging = false;
+    statsInterval = 0;
+    statsStartNs = 0;
+    schedulerNs = 0;
     this->cpu = cpu;
     this->mmu = mmu;
     cpu->setMmu(mmu);
     cpu->setHalt(&halt);
-    cpu->setIme(&ime);
-}
-
-bool isMessagePassed(char msg) {
-    // check if program is building PASSED string
-    // and if it is, create custom message
-    char passed = PASSED[passedCount];
-    if (!isPassed) {
-        if (msg == passed) {
-            passedCount++;
-            if (sizeof(PASSED) == passedCount)
-                return true;
-        } else {
-            passedCount = 0;
-        }
-    }
-    return false;
-}
-
-void fetchInitialMessage(char msg) {
-    if (msg != 0x0a && !isInitialMessageFetched) {
-        buildMessage += msg;
-    } else {
-        if (!isInitialMessageFetched) {
-            printf("TEST: %-40s", buildMessage.c_str());
-            isInitialMessageFetched = true;
-        }
-    }
+    cpu->setScheduler(&scheduler);
+    ppu.setDma(&dma);
 }
 
 // check if pc is the same as pevious pc
 // and instruction fetched is the same as previous one
-bool isLooping(Cpu *cpu, Mmu *mmu) {
-    if (cpu->cpuRegister.pc == lastPc && (mmu->readByte(cpu->cpuRegister.pc) == lastInstruction) && lastInstruction == 0x18) {
+bool Gameboy::isLooping() {
+    if (cpu->cpuRegister.pc == lastPc && (mmu->peekByte(cpu->cpuRegister.pc) == lastInstruction) && lastInstruction == 0x18) {
         return true;
     }
     lastPc = cpu->cpuRegister.pc;
-    lastInstruction = mmu->readByte(lastPc);
+    lastInstruction = mmu->peekByte(lastPc);
     return false;
 }
 
-void Gameboy::handleInterrupt(uint16_t pc) {
-    if (ime) {
-        uint8_t const IF = mmu->readByte(INTERRUPT_FLAG);
-        uint8_t const IE = mmu->readByte(INTERRUPT_ENABLE);
-        if (IE & IF) {
-            // VBLANK
-            cpu->instructionStackPush(pc + 1);
-            cpu->cpuRegister.pc = INT_VBLANK;
-        }
+// runs in place of an instruction while the controller is active,
+// returns the t-cycles used or 0 to execute the next instruction
+uint8_t Gameboy::serviceInterrupts() {
+    InterruptController &interrupts = mmu->getInterrupts();
+    int source = interrupts.poll();
+    if (source >= 0) {
+        interrupts.disable();
+        mmu->writeIo(INTERRUPT_FLAG, mmu->readIo(INTERRUPT_FLAG) & ~(1 << source));
+        cpu->instructionStackPush(cpu->cpuRegister.pc);
+        cpu->cpuRegister.pc = INT_VBLANK + source * (INT_LCDSTAT - INT_VBLANK);
+        counters.interrupts++;
+        return INTERRUPT_DISPATCH_CYCLES;
     }
-}
-
-// for blaarg test suite
-void testSerialOutput(Mmu *mmu) {
-    if (mmu->readByte(0xff02) == 0x81) {
-        char c = mmu->readByte(0xff01);
-        // printf("%c", c);
-        fetchInitialMessage(c);
-        isPassed = isMessagePassed(c);
-        mmu->writeByte(0xff02, 0);
+    if (interrupts.isHalted()) {
+        counters.haltedCycles += 4;
+        return 4;
     }
+    return 0;
 }
 
-void testAutomation(Cpu *cpu, Mmu *mmu, bool *halt) {
-    testSerialOutput(mmu);
+// for blaarg test suite, serial output goes to testResult
+void Gameboy::testAutomation() {
     // check if looping endlessly
-    if (isLooping(cpu, mmu)) {
-        std::string msg = isPassed ? "OK!" : "FAIL!";
+    if (isLooping()) {
+        std::string msg = testResult.isPassed() ? "OK!" : "FAIL!";
         printf("%s\n", msg.c_str());
-        *halt = true;
+        halt = true;
     }
 }
 
-void Gameboy::start() {
-    // isMessagePassed
-    passedCount = 0;
-    isPassed = false;
-    // get first line message
-    buildMessage = "";
-    isInitialMessageFetched = false;
-    // islooping
-    lastPc = 0;
-    lastInstruction = 0;
-    // debugger attach
-    Debug *debug = NULL;
-    // debug = new Debug(cpu, mmu); // remove comment if needs to debug
+void Gameboy::reset() {
+    halt = false;
+    cycles = 0;
+    scheduler.resetSpeed(false);
+    mmu->getInterrupts().reset();
+    serial.reset();
+    timer.reset();
+    dma.reset();
     // initial setup
     cpu->cpuRegister.pc = 0x0100;
     cpu->cpuRegister.sp = 0xFFFE;
@@ -133,74 +106,328 @@ void Gameboy::start() {
     cpu->cpuRegister.reg_c = 0x00;
     cpu->cpuRegister.reg_pair_de = 0xFF56;
     cpu->cpuRegister.reg_pair_hl = 0x000D;
-    uint8_t clk_div = 0;
-    uint8_t old_clk_div = 0;
-    uint8_t div_value = 0;
-    uint16_t tac_clk_frq = 0;
-    uint16_t tima_clk = 0;
-    while (!this->halt) {
-        // debug
-        if (debug != NULL) {
-            debug->startDebug();
-        }
-        // serial automation
-        testAutomation(cpu, mmu, &this->halt);
-        // pre-fetch
-        uint8_t tma_value = mmu->readByte(0xFF06);
+    // io registers left by the boot rom
+    mmu->writeIo(0xFF40, 0x91);
+    mmu->writeIo(0xFF47, 0xFC);
+    mmu->writeIo(0xFF48, 0xFF);
+    mmu->writeIo(0xFF49, 0xFF);
+    mmu->writeIo(INTERRUPT_FLAG, 0xE1);
+    mmu->writeIo(INTERRUPT_ENABLE, 0x00);
+    if (mmu->isCgb()) {
+        mmu->writeIo(KEY1_ADDR, 0x7E);
+        mmu->writeRegister(VBK_ADDR, 0);
+        mmu->writeRegister(SVBK_ADDR, 0);
+    }
+    ppu.reset();
+    if (stats.isOpen()) scheduler.scheduleAt(EVENT_STATS, statsInterval);
+    if (mmu->hasSaveFile()) scheduler.scheduleAt(EVENT_SAVE_SYNC, uint64_t(SAVE_SYNC_FRAMES) * CYCLES_PER_FRAME);
+}
+
+// executes a single instruction, returns elapsed t-cycles
+uint8_t Gameboy::step() {
+    // interrupts, the only per-instruction check while none can fire
+    uint8_t tick = mmu->getInterrupts().isActive() ? serviceInterrupts() : 0;
+    if (tick == 0) {
         // decode
         uint16_t pc = cpu->cpuRegister.pc;
         uint8_t opcode = mmu->readByte(pc);
-        uint8_t tick = cpu->decode(opcode);
+        counters.instructions++;
+        if (countOpcodes) {
+            counters.opcodes[opcode]++;
+            if (opcode == 0xCB) counters.opcodesCb[mmu->peekByte(pc + 1)]++;
+        }
+        tick = cpu->decode(opcode);
         if (tick == 0) {
             printf("Clock returned 0!\n");
-            break;
-        }
-        // 0xff04
-        old_clk_div = clk_div;
-        clk_div += tick;
-        if (old_clk_div > clk_div) {
-            div_value = mmu->readByte(0xFF04);
-            mmu->writeDiv(div_value + 1);
-            uint8_t new_div_value = mmu->readByte(0xFF04);
-            if ((div_value == 0) && (new_div_value == 1)) {
-                uint16_t tima_value = mmu->readByte(0xFF05);
-                mmu->writeByte(0xFF05, tima_value + 1);
-            }
+            halt = true;
+            return 0;
         }
-        // 0xff07
-        uint8_t tac_value = mmu->readByte(0xFF07);
-        bool tac_timer_enable = (tac_value & 0x04) != 0 ? true : false;
-        uint8_t tac_clk_mode = (tac_value & 0x03);
-        if (tac_timer_enable) {
-            switch (tac_clk_mode) {
-                case 0:
-                    tac_clk_frq = 1024;
-                    break;
-                case 1:
-                    tac_clk_frq = 16;
-                    break;
-                case 2:
-                    tac_clk_frq = 64;
-                    break;
-                case 3:
-                    tac_clk_frq = 256;
-                    break;
-            }
-            tima_clk += tick;
-            if (tima_clk > tac_clk_frq) {
-                uint16_t tima_value = mmu->readByte(0xFF05);
-                if ((tima_value + 1) > 0xFF) {
-                    mmu->writeByte(0xFF05, tma_value);
-                } else {
-                    mmu->writeByte(0xFF05, tima_value + 1);
-                }
-                tima_clk -= tac_clk_frq;
-            }
+    }
+    uint8_t elapsed = scheduler.toClock(tick);
+    cycles += elapsed;
+    ppu.tick(elapsed);
+    if (cycles >= scheduler.getNext()) runEvents();
+    return tick;
+}
+
+// nothing but the clock moved before the last of the instructions, so
+// the ppu and the scheduler see them at once
+void Gameboy::advance(uint32_t instructions, uint32_t fetches, uint32_t ticks) {
+    counters.instructions += instructions;
+    mmu->countFetches(fetches);
+    uint32_t elapsed = uint32_t(scheduler.toClock(ticks));
+    cycles += elapsed;
+    ppu.tick(uint16_t(elapsed));
+    if (cycles >= scheduler.getNext()) runEvents();
+}
+
+// what the ppu requests only matters once IME lets it be dispatched
+uint64_t Gameboy::getQuietCycles() {
+    uint8_t enabled = mmu->getInterrupts().isMasterEnabled() ? mmu->readIo(IE_ADDR) : 0;
+    uint64_t quiet = ppu.getQuietCycles(enabled, dma.waitsForHblank());
+    uint64_t next = scheduler.getNext();
+    if (next <= cycles) return 0;
+    return next - cycles < quiet ? next - cycles : quiet;
+}
+
+bool Gameboy::isCountingOpcodes() { return countOpcodes; }
+void Gameboy::countOpcode(uint8_t opcode) { counters.opcodes[opcode]++; }
+bool Gameboy::isDoubleSpeed() { return scheduler.isDoubleSpeed(); }
+
+void Gameboy::runEvents() {
+    TIMELINE_SCOPE("scheduler");
+    uint64_t start = stats.isOpen() ? nowNs() : 0;
+    uint64_t renderStart = ppu.getRenderNs();
+    int event;
+    while ((event = scheduler.pop(cycles)) >= 0) {
+        switch (event) {
+            case EVENT_STATS:
+                writeStats();
+                break;
+            case EVENT_SERIAL:
+                serial.complete();
+                break;
+            case EVENT_TIMER:
+                timer.overflow();
+                break;
+            case EVENT_OAM_DMA:
+                dma.finishOam();
+                ppu.syncSprites();
+                break;
+            case EVENT_HDMA:
+                idle(dma.runHdma());
+                break;
+            case EVENT_SPEED_SWITCH:
+                switchSpeed();
+                break;
+            case EVENT_SAVE_SYNC:
+                mmu->syncSaveFile(false);
+                scheduler.schedule(EVENT_SAVE_SYNC, uint64_t(SAVE_SYNC_FRAMES) * CYCLES_PER_FRAME);
+                break;
         }
     }
+    if (start) schedulerNs += nowNs() - start - (ppu.getRenderNs() - renderStart);
+}
+
+// STOP with KEY1 armed. The timer overflow is rescheduled for the new
+// ratio, a serial transfer or OAM DMA in flight keeps its deadline.
+void Gameboy::switchSpeed() {
+    bool doubleSpeed = !scheduler.isDoubleSpeed();
+    scheduler.setDoubleSpeed(doubleSpeed);
+    mmu->writeIo(KEY1_ADDR, doubleSpeed ? (KEY1_DOUBLE_SPEED | 0x7E) : 0x7E);
+    timer.rebase();
+}
+
+// advances the clock with the cpu stopped, events due meanwhile are
+// picked up by the caller's loop
+void Gameboy::idle(uint32_t stall) {
+    cycles += stall;
+    while (stall > 0) {
+        uint8_t tick = stall > 0x80 ? 0x80 : stall;
+        ppu.tick(tick);
+        stall -= tick;
+    }
+}
+
+// the policy is a template argument so the uninstrumented loop carries
+// no per-instruction debug checks
+template <class Policy>
+void Gameboy::run(Debug *debug) {
+    while (!this->halt) {
+        Policy::before(debug);
+        if (Policy::isDone(debug)) break;
+        // serial automation
+        testAutomation();
+        if (this->halt) break;
+        Policy::after(debug, step());
+    }
+}
+
+void Gameboy::start(int debugMode, const std::string &debugPath) {
+    testResult.reset();
+    serial.setSink(&testResult);
+    // islooping
+    lastPc = 0;
+    lastInstruction = 0;
+    // debugger attach
+    Debug *debug = NULL;
+    if (debugMode != DEBUG_NONE) {
+        debug = new Debug(cpu, mmu);
+        debug->profiling = (debugMode == DEBUG_PROFILE);
+        if (debugMode == DEBUG_BREAK || debugMode == DEBUG_TRACE) debug->startConsole();
+        if (debugMode == DEBUG_RECORD && !debug->recorder.open(TRACE_PATH)) debugMode = DEBUG_TALLY;
+        if (debugMode == DEBUG_COMPARE && !debug->comparator.open(debugPath)) debugMode = DEBUG_TALLY;
+        if (debugMode == DEBUG_COVERAGE) debug->coverage.start();
+        debugging = countOpcodes = true;
+    }
+    reset();
+    switch (debugMode) {
+        case DEBUG_TALLY:
+            run<DebugTally>(debug);
+            break;
+        case DEBUG_BREAK:
+            run<DebugBreak>(debug);
+            break;
+        case DEBUG_TRACE:
+            run<DebugTrace>(debug);
+            break;
+        case DEBUG_PROFILE:
+            run<DebugProfile>(debug);
+            break;
+        case DEBUG_RECORD:
+            run<DebugRecord>(debug);
+            break;
+        case DEBUG_COMPARE:
+            run<DebugCompare>(debug);
+            break;
+        case DEBUG_COVERAGE:
+            run<DebugCoverage>(debug);
+            break;
+        default:
+            run<DebugNone>(debug);
+    }
     if (debug != NULL) {
-        debug->endDebug();
+        debug->endDebug(getCounters());
+        delete debug;
+        debugging = false;
+        countOpcodes = stats.isOpen();
+    }
+    serial.setSink(nullptr);
+}
+
+bool Gameboy::isHalted() { return halt; }
+Ppu *Gameboy::getPpu() { return &ppu; }
+SerialPort *Gameboy::getSerial() { return &serial; }
+uint64_t Gameboy::getCycles() { return cycles; }
+void Gameboy::setJoypad(uint8_t buttons) { mmu->setJoypad(buttons); }
+void Gameboy::setSerialSink(SerialSink *sink) { serial.setSink(sink); }
+
+// copies everything but memory, which the mmu shares
+void Gameboy::forkFrom(Gameboy *parent) {
+    std::vector<uint8_t> registers;
+    parent->cpu->saveState(registers);
+    cpu->loadState(registers.data());
+    halt = parent->halt;
+    cycles = parent->cycles;
+    scheduler.forkFrom(&parent->scheduler);
+    serial.forkFrom(&parent->serial);
+    timer.forkFrom(&parent->timer);
+    dma.forkFrom(&parent->dma);
+    testResult = parent->testResult;
+    lastPc = parent->lastPc;
+    lastInstruction = parent->lastInstruction;
+    ppu.forkFrom(&parent->ppu);
+}
+
+void Gameboy::saveState(std::vector<uint8_t> &state) {
+    TIMELINE_SCOPE("snapshot save");
+    state.clear();
+    cpu->saveState(state);
+    mmu->saveState(state);
+    ppu.saveState(state);
+    state.push_back(halt);
+    for (int shift = 0; shift < 64; shift += 8) {
+        state.push_back(uint8_t(cycles >> shift));
     }
+    serial.saveState(state);
+    timer.saveState(state);
+    dma.saveState(state);
 }
 
-Gameboy::~Gameboy() {}
+bool Gameboy::loadState(const std::vector<uint8_t> &state) {
+    TIMELINE_SCOPE("snapshot load");
+    std::vector<uint8_t> current;
+    saveState(current);
+    if (current.size() != state.size()) {
+        printf("State size mismatch! (%zu, expected %zu)\n", state.size(), current.size());
+        return false;
+    }
+    const uint8_t *data = cpu->loadState(state.data());
+    data = mmu->loadState(data);
+    data = ppu.loadState(data);
+    halt = *data++;
+    cycles = 0;
+    for (int shift = 0; shift < 64; shift += 8) {
+        cycles |= uint64_t(*data++) << shift;
+    }
+    scheduler.resetSpeed(mmu->isCgb() && (mmu->readIo(KEY1_ADDR) & KEY1_DOUBLE_SPEED));
+    data = serial.loadState(data);
+    data = timer.loadState(data);
+    dma.loadState(data);
+    return true;
+}
+
+uint64_t Gameboy::hashState() {
+    std::vector<uint8_t> state;
+    saveState(state);
+    return fnv1a(state.data(), state.size());
+}
+
+uint64_t fnv1a(const uint8_t *data, size_t size, uint64_t hash) {
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+Gameboy::~Gameboy() { closeStats(); }
+
+Machine::Machine(uint8_t *romData, MemoryPage *storage) : mmu(romData, storage), gameboy(&cpu, &mmu) {
+    gameboy.reset();
+}
+
+Machine::Machine(Machine *parent) : mmu(&parent->mmu), gameboy(&cpu, &mmu) {
+    gameboy.forkFrom(&parent->gameboy);
+}
+
+// child shares all memory pages copy-on-write, parent must not be
+// running while it is forked
+Machine *Machine::fork() {
+    return new Machine(this);
+}
+
+bool Gameboy::openStats(const std::string &filePath, uint32_t intervalFrames) {
+    if (!stats.open(filePath)) return false;
+    statsInterval = uint64_t(intervalFrames ? intervalFrames : 1) * CYCLES_PER_FRAME;
+    scheduler.scheduleAt(EVENT_STATS, (cycles / statsInterval + 1) * statsInterval);
+    statsStartNs = nowNs();
+    schedulerNs = 0;
+    ppu.setTimed(true);
+    countOpcodes = true;
+    return true;
+}
+
+bool Gameboy::openSaveFile(const std::string &filePath) {
+    if (!mmu->openSaveFile(filePath.c_str())) return false;
+    scheduler.schedule(EVENT_SAVE_SYNC, uint64_t(SAVE_SYNC_FRAMES) * CYCLES_PER_FRAME);
+    return true;
+}
+
+void Gameboy::closeStats() {
+    if (!stats.isOpen()) return;
+    stats.close(getCounters());
+    scheduler.cancel(EVENT_STATS);
+    ppu.setTimed(false);
+    countOpcodes = debugging;
+}
+
+void Gameboy::writeStats() {
+    stats.write(getCounters());
+    scheduler.schedule(EVENT_STATS, statsInterval - cycles % statsInterval);
+}
+
+PerfCounters Gameboy::getCounters() {
+    PerfCounters snapshot = counters;
+    snapshot.cycles = cycles;
+    snapshot.frames = ppu.getFrames();
+    snapshot.memory = mmu->getCounters();
+    if (stats.isOpen()) {
+        // everything outside of line rendering and event dispatch is
+        // charged to the cpu
+        snapshot.hostNs[STATS_HOST_PPU] = ppu.getRenderNs();
+        snapshot.hostNs[STATS_HOST_SCHEDULER] = schedulerNs;
+        snapshot.hostNs[STATS_HOST_CPU] = nowNs() - statsStartNs - ppu.getRenderNs() - schedulerNs;
+    }
+    return snapshot;
+}
@@ -0,0 +1,107 @@
+/*
+ * gym.cpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdint>
+#include "include/gym.hpp"
+#include "include/timeline.hpp"
+
+static GymObservation observe(Machine *machine, uint64_t frame, uint64_t maxFrames) {
+    GymObservation observation;
+    observation.framebuffer = machine->gameboy.getPpu()->getFramebuffer();
+    observation.colorFramebuffer = machine->gameboy.getPpu()->getColorFramebuffer();
+    observation.wram[0] = machine->mmu.getPage(PAGE_WRAM0);
+    observation.wram[1] = machine->mmu.getPage(machine->mmu.getWramPage());
+    observation.hram = machine->mmu.getPage(PAGE_HIGH) + (0xFF80 & (HIGH_AREA_SIZE - 1));
+    observation.frame = frame;
+    observation.done = machine->gameboy.isHalted() || (maxFrames && frame >= maxFrames);
+    return observation;
+}
+
+GymEnv::GymEnv(uint8_t *romData, uint64_t maxFrames, MemoryPage *storage)
+    : machine(romData, storage) {
+    this->maxFrames = maxFrames;
+    frame = 0;
+    machine.gameboy.saveState(initialState);
+}
+
+GymObservation GymEnv::reset() {
+    machine.gameboy.loadState(initialState);
+    machine.gameboy.setJoypad(0);
+    frame = 0;
+    return observe(&machine, frame, maxFrames);
+}
+
+GymObservation GymEnv::step(uint8_t action, uint32_t frames) {
+    TIMELINE_SCOPE_ARG("cpu slice", frames);
+    Gameboy &gameboy = machine.gameboy;
+    gameboy.setJoypad(action);
+    for (uint32_t i = 0; i < frames && !gameboy.isHalted(); i++) {
+        gameboy.getPpu()->setRendering(i + 1 == frames);
+        gameboy.runFrame();
+        frame++;
+    }
+    return observe(&machine, frame, maxFrames);
+}
+
+Machine *GymEnv::getMachine() { return &machine; }
+
+GymBatch::GymBatch(uint8_t *romData, int count, uint64_t maxFrames) : farm(romData, count) {
+    this->maxFrames = maxFrames;
+    frame.assign(count, 0);
+    farm.getMachine(0)->gameboy.saveState(initialState);
+}
+
+int GymBatch::getCount() { return farm.getInstanceCount(); }
+
+Machine *GymBatch::getMachine(int index) { return farm.getMachine(index); }
+
+void GymBatch::reset(GymObservation *observations) {
+    for (int i = 0; i < getCount(); i++) {
+        Machine *machine = farm.getMachine(i);
+        machine->gameboy.loadState(initialState);
+        machine->gameboy.setJoypad(0);
+        frame[i] = 0;
+        observations[i] = observe(machine, frame[i], maxFrames);
+    }
+}
+
+// the farm drops the frames left to halted instances, so each one counts
+// the slices it actually ran
+void GymBatch::run(uint32_t frames, bool rendering) {
+    if (frames == 0) return;
+    for (int i = 0; i < getCount(); i++) {
+        farm.getMachine(i)->gameboy.getPpu()->setRendering(rendering);
+    }
+    farm.runFrames(frames);
+    for (int i = 0; i < getCount(); i++) {
+        frame[i] += farm.getLatency(i).slices;
+    }
+}
+
+void GymBatch::step(const uint8_t *actions, uint32_t frames, GymObservation *observations) {
+    for (int i = 0; i < getCount(); i++) {
+        farm.getMachine(i)->gameboy.setJoypad(actions[i]);
+    }
+    if (frames > 0) {
+        run(frames - 1, false);
+        run(1, true);
+    }
+    for (int i = 0; i < getCount(); i++) {
+        observations[i] = observe(farm.getMachine(i), frame[i], maxFrames);
+    }
+}
@@ -53,14 +53,18 @@ void Host::readFileContents(string filePath)
 {
   ifstream stream;
   stream.open(filePath.c_str(), ios::binary | ios::in);
+  romData.assign(fileSize > ROM_SIZE ? fileSize : ROM_SIZE, 0);
   if (stream.is_open())
   {
-    while (stream.good())
-    {
-      stream.read(reinterpret_cast<char*>(romData), fileSize);
-    }
+    stream.read(reinterpret_cast<char*>(romData.data()), fileSize);
   }
   stream.close();
+  // banks past the end of a short dump read as zero
+  uint8_t sizeCode = romData[CART_ROM_SIZE_ADDR];
+  if (sizeCode <= 8 && romData.size() < size_t(ROM_SIZE) << sizeCode)
+  {
+    romData.resize(size_t(ROM_SIZE) << sizeCode, 0);
+  }
 }
 bool Host::loadFile(const string filePath)
 {
@@ -89,5 +93,9 @@ bool Host::loadFileOnArgument()
 }
 
 uint8_t* Host::getRomData() {
-  return this->romData;
+  return romData.data();
+}
+
+int Host::getRomSize() {
+  return fileSize;
 }
@@ -0,0 +1,101 @@
+/*
+ * breakpoint.hpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_INCLUDE_BREAKPOINT_HPP_
+#define SRC_INCLUDE_BREAKPOINT_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// one bit per address of the 64K map
+#define BREAKPOINT_BITMAP_WORDS (0x10000 / 64)
+// watch granularity of the memory map
+#define WATCH_PAGE_SHIFT 8
+#define WATCH_PAGE_COUNT (0x10000 >> WATCH_PAGE_SHIFT)
+
+enum WATCH_TYPE {
+  WATCH_READ = 0x01,
+  WATCH_WRITE = 0x02,
+  // register access, reported separately from memory watchpoints
+  WATCH_IO = 0x04,
+  // set by the Mmu while OAM DMA owns the bus, never by a watcher
+  WATCH_BUS = 0x80,
+};
+
+struct Watchpoint {
+  uint16_t start;
+  uint16_t end;
+  uint8_t type;
+  // only hit when the accessed value equals value
+  bool hasValue;
+  uint8_t value;
+};
+
+struct BreakHit {
+  uint8_t type;
+  uint16_t addr;
+  uint8_t value;
+};
+
+// Receives the accesses the Mmu sees on pages flagged in
+// getWatchedPages(), each flag is a mask of WATCH_READ and WATCH_WRITE.
+class MemoryWatcher {
+ public:
+  virtual ~MemoryWatcher() {}
+  virtual const uint8_t *getWatchedPages() = 0;
+  virtual void onRead(uint16_t addr, uint8_t value) = 0;
+  virtual void onWrite(uint16_t addr, uint8_t value) = 0;
+};
+
+// Execute breakpoints are bitmaps, one per ROM bank, so checking an
+// instruction is a single bit test. Watchpoints are only evaluated for
+// accesses inside pages flagged in watchedPages, which the Mmu tests
+// before calling in.
+class Breakpoints : public MemoryWatcher {
+ private:
+  std::vector<std::vector<uint64_t>> execBits;
+  uint64_t opcodeBits[4];
+  std::vector<Watchpoint> watchpoints;
+  uint8_t watchedPages[WATCH_PAGE_COUNT];
+  std::vector<BreakHit> hits;
+  void updateWatchedPages();
+  void check(uint8_t type, uint16_t addr, uint8_t value);
+
+ public:
+  Breakpoints();
+  // bank only matters for 0x4000-0x7FFF, everything else is bank 0
+  void addExec(uint16_t addr, int bank = 0);
+  void removeExec(uint16_t addr, int bank = 0);
+  void addOpcode(uint8_t opcode);
+  void addWatch(const Watchpoint &watchpoint);
+  void addIo(uint16_t addr);
+  void clear();
+  bool isExecHit(uint16_t pc, int bank, uint8_t opcode) {
+    size_t index = (pc >= 0x4000 && pc < 0x8000) ? bank : 0;
+    if (index < execBits.size() && ((execBits[index][pc >> 6] >> (pc & 63)) & 1)) return true;
+    return (opcodeBits[opcode >> 6] >> (opcode & 63)) & 1;
+  }
+  const uint8_t *getWatchedPages() override;
+  void onRead(uint16_t addr, uint8_t value) override;
+  void onWrite(uint16_t addr, uint8_t value) override;
+  // hits since the last call, cleared on return
+  bool takeHits(std::vector<BreakHit> &out);
+};
+
+#endif  // SRC_INCLUDE_BREAKPOINT_HPP_
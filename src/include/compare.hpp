@@ -0,0 +1,64 @@
+/*
+ * compare.hpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_INCLUDE_COMPARE_HPP_
+#define SRC_INCLUDE_COMPARE_HPP_
+
+#include <stdint.h>
+#include <string>
+#include "cpu.hpp"
+#include "mmu.hpp"
+#include "tracefile.hpp"
+
+// instructions shown before and after the first divergence
+#define COMPARE_CONTEXT 8
+
+// Checks live execution against a reference trace, Gameboy Doctor log
+// or TraceRecorder file, before every instruction. Only the last
+// COMPARE_CONTEXT live entries are kept and only formatted on a
+// divergence, the reference is streamed from its mapping.
+class TraceComparator {
+ private:
+  Cpu *cpu;
+  Mmu *mmu;
+  TraceSource *reference;
+  TraceEntry live;
+  // last matched entries, slot matched % COMPARE_CONTEXT is the oldest
+  TraceEntry history[COMPARE_CONTEXT];
+  uint64_t matched;
+  // live instructions still to print after the divergence
+  int remaining;
+  bool diverged;
+  bool done;
+  void capture();
+  std::string describe(const TraceEntry &entry);
+  void report(const TraceEntry &expected);
+
+ public:
+  TraceComparator(Cpu *cpu, Mmu *mmu);
+  ~TraceComparator();
+  bool open(const std::string &filePath);
+  bool isOpen();
+  void before();
+  bool isDone();
+  bool isDiverged();
+  // summary when the run ended without a divergence
+  void finish();
+};
+
+#endif  // SRC_INCLUDE_COMPARE_HPP_
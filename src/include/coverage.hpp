@@ -0,0 +1,104 @@
+/*
+ * coverage.hpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_INCLUDE_COVERAGE_HPP_
+#define SRC_INCLUDE_COVERAGE_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "mmu.hpp"
+#include "opcode.hpp"
+#include "breakpoint.hpp"
+
+// "GBCV"
+#define COVERAGE_MAGIC 0x56434247
+#define COVERAGE_VERSION 1
+#define COVERAGE_BANK_SIZE 0x4000
+#define COVERAGE_PATH "coverage.gbc"
+
+// File layout: magic (4 bytes), version (2 bytes), bitmap count
+// (2 bytes), hash of ROM bank 0 (8 bytes), ROM bytes covered (4 bytes),
+// then one bitmap per COVERAGE_FLAG, one bit per ROM byte, little
+// endian.
+enum COVERAGE_FLAG {
+  COVER_OPCODE = 0x01,
+  COVER_OPERAND = 0x02,
+  COVER_READ = 0x04,
+};
+#define COVERAGE_FLAG_COUNT 3
+
+// One flags byte per ROM byte of the banks in the header, indexed by
+// bank * COVERAGE_BANK_SIZE + offset. Instruction bytes are marked from
+// before(), data reads come in through the Mmu watcher on the ROM
+// pages. Maps from separate runs or farm instances merge with a plain
+// OR.
+class Coverage : public MemoryWatcher {
+ private:
+  Mmu *mmu;
+  std::vector<uint8_t> flags;
+  uint64_t romHash;
+  uint8_t watchedPages[WATCH_PAGE_COUNT];
+  bool active;
+  // bytes of the executing instruction, its own fetches are not data
+  uint16_t fetchStart;
+  uint16_t fetchEnd;
+  // both windows go through the mapped bank, MBC1 mode 1 moves bank 0
+  size_t romOffset(uint16_t addr) {
+    if (addr < COVERAGE_BANK_SIZE) return size_t(mmu->getRomBank0()) * COVERAGE_BANK_SIZE + addr;
+    return size_t(mmu->getRomBank()) * COVERAGE_BANK_SIZE + (addr - COVERAGE_BANK_SIZE);
+  }
+
+ public:
+  explicit Coverage(Mmu *mmu = nullptr);
+  ~Coverage();
+  void start();
+  void stop();
+  bool isActive();
+  // marks the instruction at pc, call before it executes
+  void before(uint16_t pc) {
+    if (pc >= 2 * COVERAGE_BANK_SIZE) {
+      fetchStart = fetchEnd = 0;
+      return;
+    }
+    uint8_t opcode = mmu->peekByte(pc);
+    int length = opcode == 0xCB ? 2 : OP_BYTES[opcode];
+    if (length < 1) length = 1;
+    fetchStart = pc;
+    fetchEnd = pc + length;
+    flags[romOffset(pc)] |= COVER_OPCODE;
+    for (uint16_t addr = pc + 1; addr != fetchEnd && addr < 2 * COVERAGE_BANK_SIZE; addr++) {
+      flags[romOffset(addr)] |= COVER_OPERAND;
+    }
+  }
+  const uint8_t *getWatchedPages() override;
+  void onRead(uint16_t addr, uint8_t value) override;
+  void onWrite(uint16_t addr, uint8_t value) override;
+  void merge(const Coverage &other);
+  // merges an earlier map of the same ROM, false if missing or foreign
+  bool mergeFile(const std::string &filePath);
+  bool save(const std::string &filePath);
+  bool load(const std::string &filePath);
+  const std::vector<uint8_t> &getFlags();
+  uint64_t getRomHash();
+  // bytes per bank by classification
+  void printSummary();
+};
+
+#endif  // SRC_INCLUDE_COVERAGE_HPP_
@@ -20,8 +20,10 @@
 #define SRC_INCLUDE_CPU_HPP_
 
 #include <stdint.h>
+#include <vector>
 #include "opcode.hpp"
 #include "mmu.hpp"
+#include "scheduler.hpp"
 
 enum opcodeInstruction {
     op_nop,
@@ -332,7 +334,8 @@ class Cpu {
         // class declaration
         Mmu* mmu;
         bool* halt;
-        bool* ime;
+        // takes the speed switch requested by STOP
+        Scheduler* scheduler = nullptr;
         // functions
         uint8_t decodeCb(uint8_t opcode);
         uint8_t instructionInc(uint8_t regAddrValue);
@@ -361,8 +364,10 @@ class Cpu {
         struct CpuRegister cpuRegister = {};
         void setMmu(Mmu* mmu);
         void setHalt(bool* halt);
-        void setIme(bool* ime);
+        void setScheduler(Scheduler* scheduler);
         void instructionStackPush(uint16_t addr_value);
         uint8_t decode(uint8_t opcode);
+        void saveState(std::vector<uint8_t>& state);
+        const uint8_t* loadState(const uint8_t* state);
 };
 #endif  // SRC_INCLUDE_CPU_HPP_
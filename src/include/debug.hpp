@@ -19,13 +19,150 @@
 #ifndef SRC_INCLUDE_DEBUG_HPP_
 #define SRC_INCLUDE_DEBUG_HPP_
 
+
 #include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <iostream>
 #include <sstream>
 #include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 #include "opcode.hpp"
 #include "cpu.hpp"
 #include "mmu.hpp"
+#include "breakpoint.hpp"
+#include "profiler.hpp"
+#include "trace.hpp"
+#include "compare.hpp"
+#include "coverage.hpp"
+#include "stats.hpp"
+
+// trace records per event
+#define DEBUG_TRACE_BATCH 4096
+// queued trace events before new ones are dropped
+#define DEBUG_TRACE_BACKLOG 64
+#define DEBUG_MEMORY_VIEW 0x100
+
+// Mutex queue between the emulator and the console thread. size is
+// atomic so the emulator can poll it without taking the lock.
+template <class T>
+class DebugQueue {
+ private:
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::deque<T> items;
+  std::atomic<size_t> count{0};
+
+ public:
+  void push(T &&item) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      items.push_back(std::move(item));
+      count.store(items.size(), std::memory_order_release);
+    }
+    ready.notify_one();
+  }
+  bool tryPop(T &item) {
+    if (count.load(std::memory_order_acquire) == 0) return false;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (items.empty()) return false;
+    item = std::move(items.front());
+    items.pop_front();
+    count.store(items.size(), std::memory_order_release);
+    return true;
+  }
+  // false on timeout
+  bool pop(T &item, int timeoutMs) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!ready.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this] { return !items.empty(); })) {
+      return false;
+    }
+    item = std::move(items.front());
+    items.pop_front();
+    count.store(items.size(), std::memory_order_release);
+    return true;
+  }
+  size_t size() { return count.load(std::memory_order_acquire); }
+};
+
+enum DEBUG_COMMAND {
+  COMMAND_CONTINUE,
+  COMMAND_CONTINUOUS,
+  COMMAND_STEP,
+  COMMAND_NEXT,
+  COMMAND_FFWD,
+  COMMAND_PAUSE,
+  COMMAND_EXEC_ADD,
+  COMMAND_EXEC_REMOVE,
+  COMMAND_OPCODE,
+  COMMAND_WATCH,
+  COMMAND_IO,
+  COMMAND_MEMORY,
+  COMMAND_DUMP,
+  // end of input, clears all breaks and lets emulation run
+  COMMAND_DETACH,
+};
+
+struct DebugCommand {
+  uint8_t type;
+  int bank;
+  uint16_t addr;
+  uint64_t count;
+  Watchpoint watchpoint;
+};
+
+// cpu state copied at a pause point or per traced instruction
+struct DebugSnapshot {
+  uint64_t iterate;
+  uint16_t pc, sp, af, bc, de, hl;
+  uint8_t code[4];
+  uint8_t stack[4];
+};
+
+enum DEBUG_EVENT {
+  EVENT_PAUSED,
+  EVENT_TRACE,
+  EVENT_MEMORY,
+  EVENT_MESSAGE,
+};
+
+struct DebugEvent {
+  uint8_t type;
+  DebugSnapshot snapshot;
+  std::vector<BreakHit> hits;
+  std::vector<DebugSnapshot> trace;
+  // trace records dropped before this event
+  uint64_t dropped;
+  uint16_t addr;
+  std::vector<uint8_t> memory;
+  std::string message;
+};
+
+// Front end on its own thread. It parses stdin into commands and prints
+// events, so printing never stalls emulation.
+class DebugConsole {
+ private:
+  DebugQueue<DebugCommand> *commands;
+  DebugQueue<DebugEvent> *events;
+  std::thread thread;
+  std::atomic<bool> running;
+  bool inputOpen;
+  std::string pendingInput;
+  void loop();
+  void readInput();
+  bool parseCommand(const std::string &line, DebugCommand &command);
+  void printEvent(const DebugEvent &event);
+
+ public:
+  DebugConsole(DebugQueue<DebugCommand> *commands, DebugQueue<DebugEvent> *events);
+  void start();
+  // prints what is still queued, then joins
+  void stop();
+};
 
 class Debug {
  public:
@@ -34,20 +171,94 @@ class Debug {
   union {
     uint8_t breakCode;
     struct {
-      uint8_t pc : 1, opcode : 1, ffwd : 1, step : 1, next : 1, iterate : 1, continous : 1;
+      uint8_t ffwd : 1, step : 1, next : 1, iterate : 1, continous : 1;
     };
   } break_n;
-  uint16_t storeOpcode;
   uint64_t storeIterate, storeFfwd;
-  uint16_t storePc;
+  Breakpoints breakpoints;
+  std::vector<BreakHit> hits;
   uint64_t iterate;
-  uint64_t opcodeTally[0xFF];
-  uint64_t opcodeTallyCb[0xFF];
   int debugDisable;
+  DebugQueue<DebugCommand> commands;
+  DebugQueue<DebugEvent> events;
+  DebugConsole console;
+  std::vector<DebugSnapshot> traceBuffer;
+  uint64_t traceDropped;
+  Profiler profiler;
+  bool profiling;
+  TraceRecorder recorder;
+  TraceComparator comparator;
+  Coverage coverage;
   explicit Debug(Cpu *cpu, Mmu *mmu);
-  void print();
-  void interact();
-  void startDebug();
-  void endDebug();
+  ~Debug();
+  DebugSnapshot snapshot();
+  // false if the command resumes execution
+  bool apply(const DebugCommand &command);
+  void pause();
+  void trace();
+  void flushTrace();
+  void tally();
+  void checkBreak();
+  void startConsole();
+  // opcode counts come from the instance counters
+  void endDebug(const PerfCounters &counters);
+};
+
+enum DEBUG_MODE {
+  DEBUG_NONE,
+  DEBUG_TALLY,
+  DEBUG_BREAK,
+  DEBUG_TRACE,
+  DEBUG_PROFILE,
+  DEBUG_RECORD,
+  DEBUG_COMPARE,
+  DEBUG_COVERAGE,
+};
+
+#define PROFILE_PATH "profile.folded"
+
+
+// instrumentation policies for Gameboy::run, called around every
+// instruction. Policies only override the hooks they need, DebugNone
+// compiles away entirely.
+struct DebugPolicy {
+  static void before(Debug * /*debug*/) {}
+  static void after(Debug * /*debug*/, uint8_t /*tick*/) {}
+  // stops the run loop early
+  static bool isDone(Debug * /*debug*/) { return false; }
+};
+struct DebugNone : DebugPolicy {};
+struct DebugTally : DebugPolicy {
+  static void before(Debug *debug) { debug->tally(); }
+};
+struct DebugBreak : DebugPolicy {
+  static void before(Debug *debug) {
+    debug->tally();
+    debug->checkBreak();
+  }
+};
+struct DebugTrace : DebugPolicy {
+  static void before(Debug *debug) {
+    debug->tally();
+    debug->trace();
+  }
+};
+struct DebugRecord : DebugPolicy {
+  static void before(Debug *debug) { debug->recorder.before(); }
+  static void after(Debug *debug, uint8_t tick) { debug->recorder.after(tick); }
+};
+struct DebugProfile : DebugPolicy {
+  static void before(Debug *debug) { debug->profiler.before(); }
+  static void after(Debug *debug, uint8_t tick) { debug->profiler.after(tick); }
+};
+struct DebugCompare : DebugPolicy {
+  static void before(Debug *debug) { debug->comparator.before(); }
+  static bool isDone(Debug *debug) { return debug->comparator.isDone(); }
+};
+struct DebugCoverage : DebugPolicy {
+  static void before(Debug *debug) {
+    debug->tally();
+    debug->coverage.before(debug->cpu->cpuRegister.pc);
+  }
 };
 #endif  // SRC_INCLUDE_DEBUG_HPP_
@@ -0,0 +1,81 @@
+/*
+ * dma.hpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_INCLUDE_DMA_HPP_
+#define SRC_INCLUDE_DMA_HPP_
+
+#include <stdint.h>
+#include <vector>
+#include "scheduler.hpp"
+#include "io.hpp"
+
+#define DMA_ADDR 0xFF46
+#define HDMA1_ADDR 0xFF51
+#define HDMA2_ADDR 0xFF52
+#define HDMA3_ADDR 0xFF53
+#define HDMA4_ADDR 0xFF54
+#define HDMA5_ADDR 0xFF55
+#define OAM_ADDR 0xFE00
+#define OAM_DMA_LENGTH 0xA0
+// one m-cycle of setup, then one byte per m-cycle
+#define OAM_DMA_CYCLES (4 + OAM_DMA_LENGTH * 4)
+#define HDMA_BLOCK_SIZE 0x10
+// the cpu is stopped for 8 m-cycles per block, 16 in double speed
+#define HDMA_BLOCK_CYCLES 32
+
+class Mmu;
+
+// OAM DMA and CGB HDMA as block copies. OAM DMA locks the bus for its
+// whole window and copies at the end of it (EVENT_OAM_DMA). HDMA copies
+// on EVENT_HDMA, right after the HDMA5 write for general purpose
+// transfers or at each HBlank for one block, and returns the t-cycles
+// the cpu is stopped for.
+class Dma : public IoDevice {
+ private:
+  Mmu *mmu;
+  Scheduler *scheduler;
+  uint16_t oamSource;
+  uint16_t hdmaSource;
+  uint16_t hdmaDest;
+  // blocks left minus one, as read back from HDMA5
+  uint8_t hdmaBlocks;
+  bool hdmaActive;
+  bool hdmaHblank;
+
+ public:
+  Dma(Mmu *mmu, Scheduler *scheduler);
+  void reset();
+  uint8_t readRegister(uint16_t addr) override;
+  void writeRegister(uint16_t addr, uint8_t value) override;
+  // EVENT_OAM_DMA
+  void finishOam();
+  // EVENT_HDMA, returns the stall in t-cycles
+  uint32_t runHdma();
+  // HBlank HDMA with blocks left
+  bool waitsForHblank() const { return hdmaActive && hdmaHblank; }
+  // called by the Ppu when a visible line enters HBlank
+  void hblank() {
+    if (hdmaActive && hdmaHblank) scheduler->schedule(EVENT_HDMA, 0);
+  }
+  void forkFrom(Dma *parent);
+  // relative to the scheduler clock, which must be restored first
+  void saveState(std::vector<uint8_t> &state);
+  const uint8_t *loadState(const uint8_t *state);
+};
+
+#endif  // SRC_INCLUDE_DMA_HPP_
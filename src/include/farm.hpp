@@ -0,0 +1,110 @@
+/*
+ * farm.hpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_INCLUDE_FARM_HPP_
+#define SRC_INCLUDE_FARM_HPP_
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "gameboy.hpp"
+
+#define FARM_ARENA_ALIGN 64
+#define GAMEBOY_CLOCK 4194304
+
+// host time spent running one instance's frame slices during the last
+// runFrames call
+struct FarmLatency {
+    uint64_t slices;
+    uint64_t totalNs;
+    uint64_t minNs;
+    uint64_t maxNs;
+};
+
+struct FarmStats {
+    uint64_t frames;
+    uint64_t cycles;
+    uint64_t steals;
+    double seconds;
+    double framesPerSecond;
+    // aggregate speed relative to one real gameboy
+    double speed;
+    double avgSliceNs;
+    uint64_t maxSliceNs;
+};
+
+// Runs many independent instances of one ROM. The ROM buffer is shared
+// read-only, every Machine lives in a single arena and frame slices are
+// scheduled by a work-stealing pool with one deque per worker. The pool
+// threads live as long as the farm, the caller of runFrames is worker 0. Memory
+// pages live in the arena too, so forks must not outlive the farm.
+class Farm {
+    private:
+        struct Worker {
+            std::mutex lock;
+            std::deque<int> tasks;
+            uint64_t steals;
+        };
+        int instanceCount;
+        int workerCount;
+        size_t machineStride;
+        uint8_t *arena;
+        std::vector<Worker*> workers;
+        std::vector<uint32_t> framesLeft;
+        std::vector<FarmLatency> latency;
+        std::atomic<uint64_t> slicesLeft;
+        FarmStats stats;
+        std::vector<std::thread> threads;
+        std::mutex poolLock;
+        // bumped by runFrames to wake the pool, busyWorkers counts down
+        // as threads run out of slices
+        std::condition_variable poolWake;
+        std::condition_variable poolDone;
+        uint64_t generation;
+        int busyWorkers;
+        bool stopping;
+        // per instance coverage collectors, empty unless enabled
+        std::vector<Debug*> debuggers;
+        bool popTask(int worker, int &index);
+        bool stealTask(int worker, int &index);
+        void runSlice(int worker, int index);
+        void workerLoop(int worker);
+        void poolLoop(int worker);
+
+    public:
+        Farm(uint8_t *romData, int instanceCount, int workerCount = 0);
+        ~Farm();
+        int getInstanceCount();
+        Machine *getMachine(int index);
+        void runFrames(uint32_t frames);
+        const FarmLatency &getLatency(int index);
+        FarmStats getStats();
+        void printStats();
+        // instance i keeps its battery RAM in prefix.i
+        bool openSaveFiles(const std::string &prefix);
+        // every instance collects its own map, merged after the run
+        void enableCoverage();
+        void mergeCoverage(Coverage &total);
+};
+
+#endif  // SRC_INCLUDE_FARM_HPP_
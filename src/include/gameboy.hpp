@@ -20,12 +20,28 @@
 #define SRC_INCLUDE_GAMEBOY_HPP_
 
 #include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
 #include "cpu.hpp"
 #include "mmu.hpp"
+#include "ppu.hpp"
 #include "opcode.hpp"
 #include "debug.hpp"
+#include "stats.hpp"
+#include "scheduler.hpp"
+#include "serial.hpp"
+#include "timer.hpp"
+#include "dma.hpp"
 
 #define ROM_SIZE 0x8000
+#define CYCLES_PER_FRAME 70224
+// battery RAM writeback period, dirty save files only
+#define SAVE_SYNC_FRAMES 60
+#define FNV_OFFSET 0xCBF29CE484222325ULL
+#define FNV_PRIME 0x100000001B3ULL
+
+uint64_t fnv1a(const uint8_t *data, size_t size, uint64_t hash = FNV_OFFSET);
 
 class Gameboy {
     private:
@@ -40,14 +56,106 @@ class Gameboy {
         };
         Cpu *cpu;
         Mmu *mmu;
+        Ppu ppu;
+        Scheduler scheduler;
+        SerialPort serial;
+        Timer timer;
+        Dma dma;
         bool halt;
-        bool ime;
+        // elapsed t-cycles since reset, the clock of every device
+        uint64_t cycles;
+        // test automation
+        SerialTestResult testResult;
+        uint16_t lastPc;
+        uint8_t lastInstruction;
+        // counters owned here, memory and frames are filled in by getCounters
+        PerfCounters counters;
+        // opcode histograms are only kept while a debugger or stats reads them
+        bool countOpcodes;
+        bool debugging;
+        StatsWriter stats;
+        uint64_t statsInterval;
+        uint64_t statsStartNs;
+        // host time in event dispatch, line rendering it causes excluded
+        uint64_t schedulerNs;
+        void writeStats();
+        void runEvents();
+        void idle(uint32_t stall);
+        void switchSpeed();
+        uint8_t serviceInterrupts();
+        bool isLooping();
+        void testAutomation();
+        template <class Policy> void run(Debug *debug);
 
     public:
         Gameboy(Cpu *cpu, Mmu *mmu);
         ~Gameboy();
-        void handleInterrupt(uint16_t pc);
-        void start();
+        void reset();
+        uint8_t step();
+        // accounts for instructions executed outside of step(): none CB
+        // prefixed, none touching memory beyond fetches from ROM, and only
+        // the last one reaching getQuietCycles. ticks are cpu cycles.
+        void advance(uint32_t instructions, uint32_t fetches, uint32_t ticks);
+        // clock cycles until the ppu does something the cpu can notice
+        // without a read, or an event is due
+        uint64_t getQuietCycles();
+        bool isCountingOpcodes();
+        void countOpcode(uint8_t opcode);
+        bool isDoubleSpeed();
+        // debugPath is the reference trace for DEBUG_COMPARE
+        void start(int debugMode = DEBUG_NONE, const std::string &debugPath = "");
+        // runs until the clock reaches target
+        template <class Policy = DebugNone>
+        void runUntil(uint64_t target, Debug *debug = nullptr) {
+            while (!halt && cycles < target) {
+                Policy::before(debug);
+                Policy::after(debug, step());
+            }
+        }
+        // steps at least once, then until the clock reaches target or
+        // leave() holds before an instruction, returns the steps taken
+        template <class Leave>
+        uint64_t stepUntil(uint64_t target, Leave leave) {
+            uint64_t steps = 0;
+            do {
+                step();
+                steps++;
+            } while (!halt && cycles < target && !leave());
+            return steps;
+        }
+        // runs until the next frame boundary
+        template <class Policy = DebugNone>
+        void runFrame(Debug *debug = nullptr) {
+            runUntil<Policy>((cycles / CYCLES_PER_FRAME + 1) * CYCLES_PER_FRAME, debug);
+        }
+        bool isHalted();
+        Ppu *getPpu();
+        SerialPort *getSerial();
+        uint64_t getCycles();
+        void setJoypad(uint8_t buttons);
+        // replaces the test result detector installed by start()
+        void setSerialSink(SerialSink *sink);
+        void forkFrom(Gameboy *parent);
+        void saveState(std::vector<uint8_t> &state);
+        bool loadState(const std::vector<uint8_t> &state);
+        uint64_t hashState();
+        // appends a JSON line every intervalFrames frames
+        bool openStats(const std::string &filePath, uint32_t intervalFrames = STATS_INTERVAL_FRAMES);
+        void closeStats();
+        // backs battery RAM with filePath, synced every SAVE_SYNC_FRAMES
+        bool openSaveFile(const std::string &filePath);
+        PerfCounters getCounters();
+};
+
+// cpu, mmu and system state of one instance in a single allocation,
+// memory pages may be placed right behind it by the owner
+struct Machine {
+    Cpu cpu;
+    Mmu mmu;
+    Gameboy gameboy;
+    explicit Machine(uint8_t *romData, MemoryPage *storage = nullptr);
+    explicit Machine(Machine *parent);
+    Machine *fork();
 };
 
 #endif // SRC_INCLUDE_GAMEBOY_HPP_
@@ -0,0 +1,76 @@
+/*
+ * gym.hpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_INCLUDE_GYM_HPP_
+#define SRC_INCLUDE_GYM_HPP_
+
+#include <stdint.h>
+#include <vector>
+#include "gameboy.hpp"
+#include "farm.hpp"
+
+// views into the instance's own buffers, valid until the next step
+struct GymObservation {
+    // SCREEN_WIDTH * SCREEN_HEIGHT shades
+    const uint8_t *framebuffer;
+    // same size in RGB555, nullptr unless the cartridge is CGB
+    const uint16_t *colorFramebuffer;
+    // 0xC000 and the bank SVBK maps at 0xD000
+    const uint8_t *wram[2];
+    // 0xFF80-0xFFFE
+    const uint8_t *hram;
+    uint64_t frame;
+    bool done;
+};
+
+// Reinforcement learning style wrapper, step() holds the action for the
+// given frames and only renders the last one.
+class GymEnv {
+    private:
+        Machine machine;
+        std::vector<uint8_t> initialState;
+        uint64_t frame;
+        uint64_t maxFrames;
+
+    public:
+        GymEnv(uint8_t *romData, uint64_t maxFrames = 0, MemoryPage *storage = nullptr);
+        GymObservation reset();
+        GymObservation step(uint8_t action, uint32_t frames = 1);
+        Machine *getMachine();
+};
+
+// Steps many environments of the same ROM at once on a Farm, every
+// instance keeping its own frame count. The lockstep interpreter only
+// pays off on register-only code, the farm runs any ROM at scalar speed.
+class GymBatch {
+    private:
+        Farm farm;
+        std::vector<uint8_t> initialState;
+        std::vector<uint64_t> frame;
+        uint64_t maxFrames;
+        void run(uint32_t frames, bool rendering);
+
+    public:
+        GymBatch(uint8_t *romData, int count, uint64_t maxFrames = 0);
+        int getCount();
+        void reset(GymObservation *observations);
+        void step(const uint8_t *actions, uint32_t frames, GymObservation *observations);
+        Machine *getMachine(int index);
+};
+
+#endif  // SRC_INCLUDE_GYM_HPP_
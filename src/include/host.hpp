@@ -22,6 +22,7 @@
 #include <stdint.h>
 #include <fstream>
 #include <iostream>
+#include <vector>
 #include "gameboy.hpp"
 
 using namespace std;
@@ -32,7 +33,8 @@ private:
   int fileSize;
   int getFileSize(string);
   void readFileContents(string);
-  uint8_t romData[ROM_SIZE];
+  // whole file, padded to at least ROM_SIZE and the header's ROM size
+  vector<uint8_t> romData;
   string filePath;
 
 public:
@@ -41,6 +43,7 @@ public:
   bool loadFile(string);
   bool loadFileOnArgument();
   uint8_t *getRomData();
+  int getRomSize();
 };
 
 #endif // SRC_INCLUDE_HOST_HPP_
@@ -0,0 +1,80 @@
+/*
+ * interrupt.hpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_INCLUDE_INTERRUPT_HPP_
+#define SRC_INCLUDE_INTERRUPT_HPP_
+
+#include <stdint.h>
+#include <vector>
+
+#define IF_ADDR 0xFF0F
+#define IE_ADDR 0xFFFF
+#define INTERRUPT_DISPATCH_CYCLES 20
+
+// IF and IE bits, lower bits have priority
+enum INTERRUPT_SOURCE {
+  INTERRUPT_VBLANK = 0x01,
+  INTERRUPT_LCDSTAT = 0x02,
+  INTERRUPT_TIMER = 0x04,
+  INTERRUPT_SERIAL = 0x08,
+  INTERRUPT_JOYPAD = 0x10,
+};
+
+// IME, the EI delay and HALT. IF and IE stay in IO memory, the Mmu
+// passes them in whenever either is written so pending is always
+// IE & IF & 0x1F. active is recomputed on every change and is the only
+// thing the run loop tests per instruction.
+class InterruptController {
+ private:
+  uint8_t pending;
+  bool ime;
+  // instruction boundaries left until EI sets IME
+  uint8_t eiDelay;
+  bool halted;
+  bool active;
+  void refresh() { active = halted || eiDelay || (ime && pending); }
+
+ public:
+  InterruptController();
+  void reset();
+  bool isActive() const { return active; }
+  void setRegisters(uint8_t flags, uint8_t enable) {
+    pending = flags & enable & 0x1F;
+    refresh();
+  }
+  uint8_t getPending() const { return pending; }
+  bool isMasterEnabled() const { return ime; }
+  bool isHalted() const { return halted; }
+  bool isEiPending() const { return eiDelay != 0; }
+  // EI, takes effect after the following instruction
+  void enableDelayed();
+  // RETI
+  void enable();
+  // DI and interrupt dispatch
+  void disable();
+  // HALT falls through when an interrupt is already pending, the HALT
+  // bug is not modelled
+  void halt();
+  // at an instruction boundary while active: runs the EI delay and
+  // HALT wake-up, returns the source bit to dispatch or -1
+  int poll();
+  void saveState(std::vector<uint8_t> &state);
+  const uint8_t *loadState(const uint8_t *state);
+};
+
+#endif  // SRC_INCLUDE_INTERRUPT_HPP_
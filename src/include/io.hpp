@@ -0,0 +1,39 @@
+/*
+ * io.hpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_INCLUDE_IO_HPP_
+#define SRC_INCLUDE_IO_HPP_
+
+#include <stdint.h>
+
+enum IO_ACCESS {
+  IO_READ = 0x01,
+  IO_WRITE = 0x02,
+};
+
+// Hardware behind registers in 0xFF00-0xFF7F, mapped per register and
+// direction with Mmu::mapIo. Unmapped registers are plain memory. A
+// device keeps the IO byte up to date itself through Mmu::writeIo.
+class IoDevice {
+ public:
+  virtual ~IoDevice() {}
+  virtual uint8_t readRegister(uint16_t /*addr*/) { return 0xFF; }
+  virtual void writeRegister(uint16_t /*addr*/, uint8_t /*value*/) {}
+};
+
+#endif  // SRC_INCLUDE_IO_HPP_
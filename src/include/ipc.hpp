@@ -0,0 +1,127 @@
+/*
+ * ipc.hpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_INCLUDE_IPC_HPP_
+#define SRC_INCLUDE_IPC_HPP_
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include "gym.hpp"
+#include "ppu.hpp"
+
+#define IPC_MAGIC 0x43504247
+#define IPC_VERSION 3
+// power of two
+#define IPC_RING_SIZE 64
+#define IPC_SPIN_COUNT 1024
+
+enum IPC_COMMAND {
+    IPC_STEP = 1,
+    IPC_INPUT,
+    IPC_RESET,
+    IPC_HASH,
+    IPC_READ,
+    IPC_QUIT,
+};
+
+enum IPC_STATUS {
+    IPC_OK = 0,
+    IPC_UNKNOWN_COMMAND,
+};
+
+// same layout for requests and responses. argument is the frame count
+// of IPC_STEP or the address of IPC_READ.
+struct IpcMessage {
+    uint32_t id;
+    uint8_t command;
+    uint8_t action;
+    uint8_t status;
+    uint8_t done;
+    uint32_t argument;
+    uint64_t frame;
+    uint64_t value;
+};
+
+// single producer, single consumer. A side only sleeps on the futex after
+// raising its waiting flag, so the other side skips the wake syscall
+// while nobody waits.
+struct IpcRing {
+    alignas(64) std::atomic<uint32_t> head;
+    std::atomic<uint32_t> headWaiting;
+    alignas(64) std::atomic<uint32_t> tail;
+    std::atomic<uint32_t> tailWaiting;
+    alignas(64) IpcMessage slots[IPC_RING_SIZE];
+};
+
+// everything the controller maps. pages and cartRam are the emulator's
+// own RAM and the ppu renders straight into the framebuffers, so nothing
+// is copied per step.
+struct IpcRegion {
+    uint32_t magic;
+    uint32_t version;
+    IpcRing requests;
+    IpcRing responses;
+    MemoryPage pages[MMU_PAGE_COUNT];
+    // first cartRamSize bytes, all banks in order
+    uint8_t cartRam[CART_RAM_MAX_SIZE];
+    uint32_t cartRamSize;
+    uint8_t framebuffer[SCREEN_WIDTH * SCREEN_HEIGHT];
+    // RGB555, only written for CGB cartridges
+    uint16_t colorFramebuffer[SCREEN_WIDTH * SCREEN_HEIGHT];
+};
+
+void ipcPush(IpcRing *ring, const IpcMessage &message);
+void ipcPop(IpcRing *ring, IpcMessage &message);
+
+// emulator side, owns the shared memory object
+class IpcServer {
+    private:
+        std::string name;
+        IpcRegion *region;
+        GymEnv *env;
+        void handle(IpcMessage &message);
+
+    public:
+        explicit IpcServer(const std::string &name);
+        ~IpcServer();
+        bool open(uint8_t *romData, uint64_t maxFrames = 0);
+        void serve();
+};
+
+// controller side
+class IpcClient {
+    private:
+        IpcRegion *region;
+        uint32_t nextId;
+
+    public:
+        IpcClient();
+        ~IpcClient();
+        bool connect(const std::string &name);
+        uint32_t send(uint8_t command, uint8_t action = 0, uint32_t argument = 0);
+        void receive(IpcMessage &response);
+        IpcMessage call(uint8_t command, uint8_t action = 0, uint32_t argument = 0);
+        const uint8_t *getFramebuffer();
+        const uint16_t *getColorFramebuffer();
+        const uint8_t *getPage(int index);
+        const uint8_t *getCartRam();
+        uint32_t getCartRamSize();
+};
+
+#endif  // SRC_INCLUDE_IPC_HPP_
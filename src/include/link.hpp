@@ -0,0 +1,94 @@
+/*
+ * link.hpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_INCLUDE_LINK_HPP_
+#define SRC_INCLUDE_LINK_HPP_
+
+#include <stdint.h>
+#include <atomic>
+#include "gameboy.hpp"
+#include "serial.hpp"
+
+// power of two
+#define LINK_QUEUE_SIZE 256
+
+enum LINK_MESSAGE {
+    // the sender armed a transfer on the external clock with this byte
+    LINK_READY = 0x100,
+    // the sender clocked a transfer, the byte completes ours
+    LINK_DATA = 0x200,
+};
+
+// single producer, single consumer ring of LINK_MESSAGE | byte. With
+// at most two slices of drift only a handful of messages are ever in
+// flight, a full ring drops the message instead of blocking.
+struct LinkQueue {
+    alignas(64) std::atomic<uint32_t> head;
+    alignas(64) std::atomic<uint32_t> tail;
+    uint16_t slots[LINK_QUEUE_SIZE];
+};
+
+// one end of the cable. Messages from the other end are only looked at
+// by poll() at slice boundaries and by exchange(), never per instruction.
+class LinkPort : public SerialSink {
+    private:
+        SerialPort *serial;
+        LinkQueue *in;
+        LinkQueue *out;
+        // byte armed by the peer, -1 while it is not listening
+        int ready;
+        uint64_t transfers;
+        void push(uint16_t message);
+
+    public:
+        LinkPort();
+        void connect(SerialPort *serial, LinkQueue *in, LinkQueue *out);
+        uint8_t exchange(uint8_t out) override;
+        void listen(uint8_t out) override;
+        // delivers queued messages, completes transfers clocked by the peer
+        void poll();
+        uint64_t getTransfers();
+};
+
+// Two instances joined by a link cable. They run in alternating slices
+// of one serial transfer, so a byte clocked by either side reaches the
+// other within a slice and there is no per-cycle synchronization.
+class LinkCable {
+    private:
+        Gameboy *gameboys[2];
+        LinkQueue queues[2];
+        LinkPort ports[2];
+        // end of the last finished slice per side, for the threaded mode
+        alignas(64) std::atomic<uint64_t> progress[2];
+        uint64_t slice;
+        double seconds;
+        uint64_t cycles;
+        void runSide(int side, uint64_t base, uint64_t end, uint64_t step, bool threaded);
+
+    public:
+        LinkCable(Gameboy *first, Gameboy *second, uint64_t slice = SERIAL_TRANSFER_CYCLES);
+        ~LinkCable();
+        // both sides share the clock of the first
+        void run(uint64_t cycles);
+        // one thread per side in half slices, a side never starts one
+        // while the other has not finished the previous one
+        void runThreaded(uint64_t cycles);
+        void printStats();
+};
+
+#endif  // SRC_INCLUDE_LINK_HPP_
@@ -0,0 +1,106 @@
+/*
+ * lockstep.hpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_INCLUDE_LOCKSTEP_HPP_
+#define SRC_INCLUDE_LOCKSTEP_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "gameboy.hpp"
+
+// instances per block, one AVX2 register of 8-bit lanes
+#define LOCKSTEP_WIDTH 32
+#define LOCKSTEP_REG_F 6
+// most clock cycles of vector steps a lane holds back, keeps the counts
+// within 16 bits
+#define LOCKSTEP_MAX_PENDING 0x4000
+// vector opcodes in a row a scalar lane needs ahead before it rejoins,
+// shorter runs cost more in the switch than they save
+#define LOCKSTEP_MIN_RUN 82
+
+typedef uint8_t lane8_t __attribute__((vector_size(LOCKSTEP_WIDTH)));
+typedef int8_t lane8s_t __attribute__((vector_size(LOCKSTEP_WIDTH)));
+typedef uint16_t lane16_t __attribute__((vector_size(LOCKSTEP_WIDTH * 2)));
+typedef int16_t lane16s_t __attribute__((vector_size(LOCKSTEP_WIDTH * 2)));
+
+// registers of LOCKSTEP_WIDTH instances in SoA layout, reg is indexed
+// like CpuRegister::reg with F kept in the unused (HL) slot
+struct LaneBlock {
+    lane8_t reg[8];
+    lane16_t sp;
+    lane16_t pc;
+    lane8_t active;
+    // no interrupt pending, bus not locked and no watcher attached
+    lane8_t vectored;
+    // the instance keeps an opcode histogram
+    lane8_t counting;
+    // banks mapped at 0x0000 and 0x4000
+    lane16_t romBank0;
+    lane16_t romBank;
+    // vector steps not yet applied to the instance: cpu cycles,
+    // instructions and ROM fetches. A lane is flushed once pending
+    // reaches budget, the cycles until its next ppu change, event or
+    // target, as nothing else can observe them before.
+    lane16_t pending;
+    lane16_t budget;
+    lane16_t instructions;
+    lane16_t fetches;
+};
+
+// Steps many instances of the same ROM together. Lanes sharing the
+// leader's PC execute common register-only opcodes as one masked vector
+// operation; every other lane and opcode falls back to Cpu::decode, and
+// stays there until LOCKSTEP_MIN_RUN vector opcodes lie ahead.
+class Lockstep {
+    private:
+        int laneCount;
+        int blockCount;
+        size_t machineStride;
+        uint8_t *arena;
+        LaneBlock *blocks;
+        uint64_t vectorSteps;
+        uint64_t scalarSteps;
+        std::vector<uint64_t> targets;
+        void loadLane(int lane);
+        void storeLane(int lane);
+        void refreshLane(int lane);
+        void flushLane(int lane);
+        // opcodes stepVector takes
+        bool vectorOpcodes[0x100];
+        bool stepVector(LaneBlock &block, const lane8_t &mask, uint8_t opcode, uint16_t address, lane8_t &tick);
+        // vector opcodes from a ROM address up to the first branch, plus
+        // one, 0 until scanned
+        std::vector<uint8_t> vectorRuns;
+        int getVectorRun(Mmu &mmu, uint16_t pc);
+        void runScalar(int lane);
+        void stepBlock(int index);
+        void run();
+
+    public:
+        Lockstep(uint8_t *romData, int laneCount);
+        ~Lockstep();
+        int getLaneCount();
+        Machine *getMachine(int lane);
+        void runCycles(uint64_t cycles);
+        void runFrame();
+        uint64_t getVectorSteps();
+        uint64_t getScalarSteps();
+};
+
+#endif  // SRC_INCLUDE_LOCKSTEP_HPP_
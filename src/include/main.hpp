@@ -20,9 +20,15 @@
 #define SRC_INCLUDE_MAIN_HPP_
 
 #include "cpu.hpp"
+#include "farm.hpp"
 #include "gameboy.hpp"
 #include "host.hpp"
+#include "ipc.hpp"
+#include "link.hpp"
+#include "lockstep.hpp"
 #include "mmu.hpp"
+#include "movie.hpp"
+#include "timeline.hpp"
 
 using namespace std;
 
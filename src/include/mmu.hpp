@@ -20,34 +20,211 @@
 #define SRC_INCLUDE_MMU_HPP_
 
 #define ROM_SIZE 0x8000
+#define ROM_BANK_SIZE 0x4000
+// cartridge header
+#define CART_TYPE_ADDR 0x0147
+#define CART_CGB_ADDR 0x0143
+#define CART_ROM_SIZE_ADDR 0x0148
+#define CART_RAM_SIZE_ADDR 0x0149
 #define VRAM_SIZE 0x2000
 #define ERAM_SIZE 0x2000
+// 16 banks, the largest size code
+#define CART_RAM_MAX_SIZE (16 * ERAM_SIZE)
 #define WRAM_SIZE 0x2000
 #define OAM_SIZE 0x00A0
 #define IOMAP_SIZE 0x0080
+#define P1_ADDR 0xFF00
+// CGB only
+#define KEY1_ADDR 0xFF4D
+#define KEY1_PREPARE 0x01
+#define KEY1_DOUBLE_SPEED 0x80
+#define VBK_ADDR 0xFF4F
+#define SVBK_ADDR 0xFF70
 #define HRAM_SIZE 0x007F
+#define MMU_PAGE_SIZE 0x1000
+// 0xFE00-0xFFFF (OAM, IO, HRAM and IE) share one page
+#define HIGH_AREA_SIZE 0x0200
 
 #include <stdint.h>
+#include <atomic>
+#include <vector>
+#include "breakpoint.hpp"
+#include "stats.hpp"
+#include "interrupt.hpp"
+#include "io.hpp"
 
-class Mmu {
+enum MMU_PAGE {
+  PAGE_VRAM0,
+  PAGE_VRAM1,
+  PAGE_WRAM0,
+  PAGE_WRAM1,
+  PAGE_HIGH,
+  // CGB VRAM bank 1 and WRAM banks 2-7
+  PAGE_VRAM2,
+  PAGE_VRAM3,
+  PAGE_WRAM2,
+  PAGE_WRAM7 = PAGE_WRAM2 + 5,
+  MMU_PAGE_COUNT,
+};
+
+// Writable memory is split into refcounted pages so forked instances
+// can share them until one side writes.
+struct MemoryPage {
+  std::atomic<uint32_t> refs;
+  // pages placed in an arena by the owner are never deleted
+  bool external;
+  uint8_t data[MMU_PAGE_SIZE];
+};
+
+// Cartridge RAM, sized from the header and shared copy-on-write by
+// forks like MemoryPage. Battery RAM can be a MAP_SHARED mapping of the
+// save file, so writes land in the page cache with no copy.
+struct CartRam {
+  std::atomic<uint32_t> refs;
+  uint8_t *data;
+  uint32_t size;
+  bool mapped;
+  // data placed by the owner, never freed
+  bool external;
+  // written since the last sync
+  bool dirty;
+};
+
+enum MBC_TYPE {
+  MBC_NONE,
+  MBC_1,
+  MBC_3,
+  MBC_5,
+};
+
+enum JOYPAD_BUTTON {
+  JOYPAD_RIGHT = 0x01,
+  JOYPAD_LEFT = 0x02,
+  JOYPAD_UP = 0x04,
+  JOYPAD_DOWN = 0x08,
+  JOYPAD_A = 0x10,
+  JOYPAD_B = 0x20,
+  JOYPAD_SELECT = 0x40,
+  JOYPAD_START = 0x80,
+};
+
+// P1 and IF are served by the Mmu itself, as are KEY1, VBK and SVBK
+// on CGB carts
+class Mmu : public IoDevice {
  private:
   uint32_t *currentTCycle;
   uint8_t *romData;
-  uint8_t vram[VRAM_SIZE] = {};
-  uint8_t eram[ERAM_SIZE] = {};
-  uint8_t wram[WRAM_SIZE] = {};
-  uint8_t oam[OAM_SIZE] = {};
-  uint8_t iomap[IOMAP_SIZE] = {};
-  uint8_t hram[HRAM_SIZE] = {};
+  // power of two, from the header
+  uint32_t romBanks;
+  uint8_t mbc;
+  bool cgb;
+  // bank registers as written, MBC1 keeps its upper bits in bankHigh
+  uint16_t bankLow;
+  uint8_t bankHigh;
+  bool bankMode;
+  bool ramEnabled;
+  bool battery;
+  CartRam *cartRam;
+  // resolved banks, kept in sync by mapBanks
+  uint16_t romBank;
+  uint16_t romBank0;
+  const uint8_t *romBankData;
+  const uint8_t *romBank0Data;
+  // RAM bank at 0xA000, reads 0xFF and drops writes while unmapped
+  bool eramMapped;
+  uint32_t eramOffset;
+  MemoryPage *pages[MMU_PAGE_COUNT];
+  // pages mapped at 0x8000 (first of two) and 0xD000, from VBK and SVBK
+  uint8_t vramPage;
+  uint8_t wramPage;
+  // pressed buttons, see JOYPAD_BUTTON
+  uint8_t joypad = 0;
+  // debugger or tracer, only consulted for flagged pages
+  MemoryWatcher *watcher;
+  const uint8_t *watchedPages;
+  // watcher flags plus WATCH_BUS below HRAM, used while the bus is locked
+  uint8_t lockedPages[WATCH_PAGE_COUNT];
+  bool busLocked;
+  MemoryCounters counters;
+  InterruptController interrupts;
+  // per IO register, nullptr is plain memory
+  IoDevice *ioReaders[IOMAP_SIZE];
+  IoDevice *ioWriters[IOMAP_SIZE];
+  // cpu writes to 0xFE00-0xFE9F, nullptr is plain memory
+  IoDevice *oamWriter;
+  uint8_t readJoypad();
+  void clearIo();
+  void updateWatchedPages();
+  const uint8_t *readPointer(uint16_t addr);
+  uint8_t *writablePointer(uint16_t addr);
+  void updateInterrupts();
+  uint8_t *writablePage(int index);
+  static void releasePage(MemoryPage *page);
+  uint8_t *writableCartRam();
+  static void releaseCartRam(CartRam *ram);
+  void writeMbc(uint16_t addr, uint8_t value);
+  void mapBanks();
+  void mapCgbBanks();
 
  public:
-  Mmu(uint8_t *romData);
+  explicit Mmu(uint8_t *romData, MemoryPage *storage = nullptr);
+  explicit Mmu(Mmu *parent);
   ~Mmu();
   void writeByte(uint16_t addr, uint8_t value);
   uint8_t readByte(uint16_t addr);
+  // readByte without triggering watchpoints, for the debugger
+  uint8_t peekByte(uint16_t addr);
   uint16_t readShort(uint16_t addr);
-  void writeDiv(uint8_t value);
-  void setRom(uint8_t romData[ROM_SIZE]);
+  // direct io register access without side effects, for devices
+  uint8_t readIo(uint16_t addr);
+  void writeIo(uint16_t addr, uint8_t value);
+  // sets bits of IF, see INTERRUPT_SOURCE
+  void requestInterrupt(uint8_t sources);
+  InterruptController &getInterrupts();
+  // routes accesses to addr (0xFF00-0xFF7F) to device, see IO_ACCESS.
+  // Devices are not carried over to forks.
+  void mapIo(uint16_t addr, IoDevice *device, int access);
+  // routes cpu writes to OAM to device, same rules as mapIo
+  void mapOam(IoDevice *device);
+  uint8_t readRegister(uint16_t addr) override;
+  void writeRegister(uint16_t addr, uint8_t value) override;
+  const uint8_t *getPage(int index);
+  // page mapped at 0xD000-0xDFFF, PAGE_WRAM1 unless SVBK selects another
+  int getWramPage();
+  // romData holds at least the size given in its header
+  void setRom(uint8_t *romData);
+  void setJoypad(uint8_t buttons);
+  void setWatcher(MemoryWatcher *watcher);
+  // while locked, cpu accesses below 0xFF00 read 0xFF and drop writes
+  void lockBus(bool locked);
+  bool isBusLocked();
+  bool hasWatcher();
+  // counts ROM opcode and operand fetches made outside of readByte, they
+  // bypass the watcher
+  void countFetches(uint32_t count);
+  // memcpy between the mapped banks, bypassing watchers and counters
+  void copyBlock(uint16_t dest, uint16_t source, uint16_t length);
+  // bank mapped at 0x4000-0x7FFF
+  int getRomBank();
+  // bank mapped at 0x0000-0x3FFF, nonzero only in MBC1 mode 1
+  int getRomBank0();
+  // from the cartridge header
+  int getRomBankCount();
+  int getMbc();
+  // CGB flag in the cartridge header
+  bool isCgb();
+  // maps battery RAM onto path, created or grown to the RAM size. Forks
+  // start from a copy, loadState detaches the file.
+  bool openSaveFile(const char *path);
+  bool hasSaveFile();
+  // moves cart RAM into storage owned by the caller, e.g. shared memory
+  bool attachCartRam(uint8_t *storage, uint32_t capacity);
+  uint32_t getCartRamSize();
+  // schedules writeback of a dirty save file, wait blocks until done
+  void syncSaveFile(bool wait);
+  const MemoryCounters &getCounters();
+  void saveState(std::vector<uint8_t> &state);
+  const uint8_t *loadState(const uint8_t *state);
 };
 
 #endif  // SRC_INCLUDE_MMU_HPP_
@@ -0,0 +1,74 @@
+/*
+ * movie.hpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_INCLUDE_MOVIE_HPP_
+#define SRC_INCLUDE_MOVIE_HPP_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "gameboy.hpp"
+
+#define MOVIE_MAGIC 0x564D4247 // GBMV
+#define MOVIE_VERSION 9
+#define MOVIE_CHECKPOINT_FRAMES 60
+
+enum MOVIE_EVENT {
+    MOVIE_EVENT_INPUT = 0x01,
+    MOVIE_EVENT_CHECKPOINT = 0x02,
+    MOVIE_EVENT_END = 0x03,
+};
+
+struct MovieEvent {
+    uint8_t type;
+    // absolute t-cycle count the event happens at
+    uint64_t cycle;
+    // buttons on input, state hash on checkpoint and end
+    uint64_t value;
+};
+
+// Input movie: joypad changes timestamped by emulated cycles, on top of
+// an initial state. Events are stored as varint cycle deltas.
+class Movie {
+    private:
+        Gameboy *gameboy;
+        uint64_t romHash;
+        uint64_t checkpointCycles;
+        uint64_t nextCheckpoint;
+        std::vector<uint8_t> initialState;
+        std::vector<MovieEvent> events;
+        bool recording;
+        // coverage collected during playback, optional
+        Debug *debug;
+        template <class Policy> void advanceTo(uint64_t cycle);
+        void runUntil(uint64_t cycle);
+
+    public:
+        explicit Movie(Gameboy *gameboy);
+        void startRecording(uint64_t romHash, uint32_t checkpointFrames = MOVIE_CHECKPOINT_FRAMES);
+        void setInput(uint8_t buttons);
+        void run(uint64_t cycles);
+        void stopRecording();
+        bool save(const std::string &filePath);
+        bool load(const std::string &filePath);
+        bool replay(uint64_t romHash);
+        uint64_t getLength();
+        void setDebug(Debug *debug);
+};
+
+#endif  // SRC_INCLUDE_MOVIE_HPP_
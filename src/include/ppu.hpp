@@ -0,0 +1,129 @@
+/*
+ * ppu.hpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_INCLUDE_PPU_HPP_
+#define SRC_INCLUDE_PPU_HPP_
+
+#include <stdint.h>
+#include <vector>
+#include "mmu.hpp"
+#include "dma.hpp"
+
+#define SCREEN_WIDTH 160
+#define SCREEN_HEIGHT 144
+#define CYCLES_PER_LINE 456
+#define LINES_PER_FRAME 154
+#define OAM_SPRITES 40
+#define SPRITES_PER_LINE 10
+
+enum PPU_MODE {
+    PPU_MODE_HBLANK = 0,
+    PPU_MODE_VBLANK = 1,
+    PPU_MODE_OAM = 2,
+    PPU_MODE_TRANSFER = 3,
+};
+
+// Scanline renderer, draws a whole line when mode 3 ends. The
+// framebuffer holds shades 0-3 after palette mapping. CGB carts also
+// fill a framebuffer of RGB555 colors, their shades are the luminance
+// of the color.
+class Ppu : public IoDevice {
+    private:
+        Mmu *mmu;
+        bool cgb;
+        // told about every visible HBlank for HDMA
+        Dma *dma;
+        uint16_t lineCycles;
+        uint8_t mode;
+        uint8_t ly;
+        uint8_t windowLine;
+        bool statLine;
+        bool rendering;
+        // counters, not part of the saved state
+        uint64_t frames;
+        uint64_t renderNs;
+        bool timed;
+        // timeline ticks at the last vblank
+        uint64_t frameMark;
+        // ownFramebuffer unless setFramebuffer moved it
+        uint8_t *framebuffer;
+        uint8_t ownFramebuffer[SCREEN_WIDTH * SCREEN_HEIGHT] = {};
+        // sprites covering each visible line, bit n is oam entry n.
+        // Kept in step with OAM writes instead of scanning per line.
+        uint64_t lineSprites[SCREEN_HEIGHT];
+        // first SPRITES_PER_LINE of lineSprites by drawing priority,
+        // rebuilt on demand once a line is dirty
+        uint8_t lineOrder[SCREEN_HEIGHT][SPRITES_PER_LINE];
+        uint8_t lineCount[SCREEN_HEIGHT];
+        bool lineDirty[SCREEN_HEIGHT];
+        // oam y and x each entry is placed with
+        uint8_t spriteY[OAM_SPRITES];
+        uint8_t spriteX[OAM_SPRITES];
+        uint8_t spriteHeight;
+        // CGB palette memory for BG and OBJ, 8 palettes of 4 colors each,
+        // with the resolved color and shade of every entry
+        uint8_t paletteRam[2][64];
+        uint16_t paletteColors[2][32];
+        uint8_t paletteShades[2][32];
+        // empty unless cgb
+        std::vector<uint16_t> ownColorFramebuffer;
+        // nullptr unless cgb
+        uint16_t *colorFramebuffer;
+        void setMode(uint8_t mode);
+        void setLy(uint8_t ly);
+        void updateStat();
+        void renderLine();
+        void renderLineCgb();
+        void writePalette(int palette, uint16_t indexAddr, uint8_t value);
+        void resolveColor(int palette, int entry);
+        void placeSprite(int index, bool add);
+        void touchSprite(int index);
+        void resetSprites();
+        const uint8_t *getLineSprites(int &count);
+
+    public:
+        explicit Ppu(Mmu *mmu);
+        void reset();
+        void tick(uint16_t cycles);
+        // clock cycles until tick() requests one of the interrupts in
+        // enabled or, with hblank set, enters HBlank. Any other change is
+        // only seen by reads, so tick() may skip past it in one call.
+        uint32_t getQuietCycles(uint8_t enabled, bool hblank);
+        void setRendering(bool rendering);
+        void setDma(Dma *dma);
+        // picks up OAM changes made behind the cpu's back, i.e. by DMA
+        void syncSprites();
+        // measures host time spent rendering lines
+        void setTimed(bool timed);
+        uint64_t getFrames();
+        uint64_t getRenderNs();
+        const uint8_t *getFramebuffer();
+        // RGB555, nullptr for DMG carts
+        const uint16_t *getColorFramebuffer();
+        // renders into caller storage of the same size from now on, colors
+        // is only used for CGB carts. The current frame is carried over.
+        void setFramebuffer(uint8_t *shades, uint16_t *colors);
+        // LCDC, STAT, LY, LYC, OAM and the CGB palettes
+        uint8_t readRegister(uint16_t addr) override;
+        void writeRegister(uint16_t addr, uint8_t value) override;
+        void forkFrom(Ppu *parent);
+        void saveState(std::vector<uint8_t> &state);
+        const uint8_t *loadState(const uint8_t *state);
+};
+
+#endif  // SRC_INCLUDE_PPU_HPP_
@@ -0,0 +1,82 @@
+/*
+ * profiler.hpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_INCLUDE_PROFILER_HPP_
+#define SRC_INCLUDE_PROFILER_HPP_
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "cpu.hpp"
+#include "mmu.hpp"
+
+// deeper stacks are folded into their deepest frame
+#define PROFILER_MAX_DEPTH 256
+#define PROFILER_TABLE_ROWS 20
+
+// one node per distinct call stack, node 0 is the root
+struct ProfileNode {
+  uint32_t parent;
+  // bank << 16 | address
+  uint32_t function;
+  uint64_t cycles;
+  uint64_t calls;
+};
+
+// Follows the guest call stack through CALL, RST, RET, RETI and
+// interrupt entries and attributes the cycles of every instruction to
+// its (bank, PC) and to the current stack. Frames remember the stack
+// pointer, so code that drops return addresses does not leave stale
+// frames behind.
+class Profiler {
+ private:
+  struct Frame {
+    uint32_t node;
+    uint16_t sp;
+  };
+  Cpu *cpu;
+  Mmu *mmu;
+  std::vector<ProfileNode> nodes;
+  std::unordered_map<uint64_t, uint32_t> children;
+  std::vector<Frame> stack;
+  // per bank, allocated on first use
+  std::vector<std::vector<uint64_t>> pcCycles;
+  uint32_t current;
+  uint16_t lastPc;
+  uint16_t lastSp;
+  uint8_t lastOpcode;
+  // bank << 16 | address of the instruction being executed
+  uint32_t lastKey;
+  uint32_t functionKey(uint16_t addr);
+  void enter(uint16_t addr, uint16_t sp);
+  void leave(uint16_t sp);
+  std::string functionName(uint32_t function);
+
+ public:
+  Profiler(Cpu *cpu, Mmu *mmu);
+  void reset();
+  void before();
+  void after(uint8_t tick);
+  uint64_t getCycles(uint16_t addr, int bank = 0);
+  // Brendan Gregg's folded format, one "frame;frame;... cycles" per stack
+  bool writeFolded(const std::string &path);
+  void printTable(int rows = PROFILER_TABLE_ROWS);
+};
+
+#endif  // SRC_INCLUDE_PROFILER_HPP_
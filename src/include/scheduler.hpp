@@ -0,0 +1,79 @@
+/*
+ * scheduler.hpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_INCLUDE_SCHEDULER_HPP_
+#define SRC_INCLUDE_SCHEDULER_HPP_
+
+#include <stdint.h>
+
+// one slot per event, an event is either scheduled once or not at all
+enum SCHEDULER_EVENT {
+  EVENT_STATS,
+  EVENT_SERIAL,
+  EVENT_TIMER,
+  EVENT_OAM_DMA,
+  EVENT_HDMA,
+  EVENT_SPEED_SWITCH,
+  EVENT_SAVE_SYNC,
+  EVENT_COUNT,
+};
+
+// Deadlines in t-cycles of the owning instance. The run loop compares
+// the clock against next once per instruction and only looks at the
+// slots when something is due.
+//
+// The clock runs at the single speed rate the PPU sees. In CGB double
+// speed the cpu, timer, serial and OAM DMA run twice as fast, so their
+// cycles are converted here: cpu cycles are clock cycles << speedShift.
+class Scheduler {
+ private:
+  const uint64_t *clock;
+  uint64_t due[EVENT_COUNT];
+  uint64_t next;
+  uint8_t speedShift;
+  // cpu clock at clockBase, set on every speed change
+  uint64_t cpuBase;
+  uint64_t clockBase;
+  void refresh();
+
+ public:
+  Scheduler();
+  void setClock(const uint64_t *clock) { this->clock = clock; }
+  uint64_t now() const { return *clock; }
+  void schedule(int event, uint64_t delay) { scheduleAt(event, *clock + delay); }
+  void scheduleAt(int event, uint64_t at);
+  void cancel(int event);
+  bool isScheduled(int event) const { return due[event] != UINT64_MAX; }
+  uint64_t getDue(int event) const { return due[event]; }
+  uint64_t getNext() const { return next; }
+  // unschedules and returns the earliest event due at now, or -1
+  int pop(uint64_t now);
+  // switches speed from now on, keeping the cpu clock continuous
+  void setDoubleSpeed(bool doubleSpeed);
+  // starts a fresh cpu clock mapping at now, after reset or state load
+  void resetSpeed(bool doubleSpeed);
+  void forkFrom(const Scheduler *parent);
+  bool isDoubleSpeed() const { return speedShift != 0; }
+  // cpu cycles to clock cycles
+  uint64_t toClock(uint64_t cycles) const { return cycles >> speedShift; }
+  uint64_t cpuNow() const { return cpuBase + ((*clock - clockBase) << speedShift); }
+  // first clock cycle at or after the given cpu cycle
+  void scheduleCpuAt(int event, uint64_t cpuAt);
+};
+
+#endif  // SRC_INCLUDE_SCHEDULER_HPP_
@@ -0,0 +1,106 @@
+/*
+ * serial.hpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_INCLUDE_SERIAL_HPP_
+#define SRC_INCLUDE_SERIAL_HPP_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "scheduler.hpp"
+#include "io.hpp"
+
+#define SB_ADDR 0xFF01
+#define SC_ADDR 0xFF02
+#define SC_START 0x80
+#define SC_INTERNAL_CLOCK 0x01
+// 8192 Hz shift clock
+#define SERIAL_CYCLES_PER_BIT 512
+#define SERIAL_TRANSFER_CYCLES (8 * SERIAL_CYCLES_PER_BIT)
+
+class Mmu;
+
+// receives every completed transfer
+class SerialSink {
+ public:
+  virtual ~SerialSink() {}
+  // returns the byte shifted in from the other side
+  virtual uint8_t exchange(uint8_t out) = 0;
+  // a transfer was armed on the external clock and waits for a peer
+  virtual void listen(uint8_t /*out*/) {}
+};
+
+// buffers output per line, optionally echoed to out
+class SerialLog : public SerialSink {
+ private:
+  FILE *out;
+  std::string line;
+
+ protected:
+  virtual void onLine(const std::string &/*line*/) {}
+
+ public:
+  explicit SerialLog(FILE *out = nullptr) : out(out) {}
+  uint8_t exchange(uint8_t byte) override;
+  void reset() { line.clear(); }
+};
+
+// blargg test output: prints the first line and watches for "Passed"
+class SerialTestResult : public SerialLog {
+ private:
+  bool titled;
+  bool passed;
+
+ protected:
+  void onLine(const std::string &line) override;
+
+ public:
+  SerialTestResult() { reset(); }
+  void reset();
+  bool isPassed() const { return passed; }
+};
+
+// SB/SC. A transfer starts on the SC write and completes as
+// EVENT_SERIAL, nothing is polled per instruction.
+class SerialPort : public IoDevice {
+ private:
+  Mmu *mmu;
+  Scheduler *scheduler;
+  SerialSink *sink;
+  void finish(uint8_t in);
+
+ public:
+  SerialPort(Mmu *mmu, Scheduler *scheduler);
+  void reset();
+  // not copied by forkFrom
+  void setSink(SerialSink *sink);
+  void writeControl(uint8_t value);
+  void writeRegister(uint16_t addr, uint8_t value) override;
+  // EVENT_SERIAL
+  void complete();
+  // completes a transfer clocked by a peer, false if none was armed
+  bool receive(uint8_t in);
+  bool isTransferring() const;
+  void forkFrom(SerialPort *parent);
+  // relative to the scheduler clock, which must be restored first
+  void saveState(std::vector<uint8_t> &state);
+  const uint8_t *loadState(const uint8_t *state);
+};
+
+#endif  // SRC_INCLUDE_SERIAL_HPP_
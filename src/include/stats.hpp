@@ -0,0 +1,98 @@
+/*
+ * stats.hpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_INCLUDE_STATS_HPP_
+#define SRC_INCLUDE_STATS_HPP_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+#define STATS_PATH "stats.jsonl"
+#define STATS_INTERVAL_FRAMES 60
+
+enum STATS_REGION {
+  STATS_ROM,
+  STATS_VRAM,
+  STATS_SRAM,
+  STATS_WRAM,
+  STATS_OAM,
+  STATS_IO,
+  STATS_HRAM,
+  STATS_REGION_COUNT,
+};
+
+enum STATS_HOST {
+  STATS_HOST_CPU,
+  STATS_HOST_PPU,
+  STATS_HOST_APU,
+  STATS_HOST_SCHEDULER,
+  STATS_HOST_COUNT,
+};
+
+// echo RAM counts as WRAM, the unusable area as OAM and IE as IO
+inline uint8_t statsRegion(uint16_t addr) {
+  static const uint8_t regions[16] = {
+    STATS_ROM, STATS_ROM, STATS_ROM, STATS_ROM, STATS_ROM, STATS_ROM, STATS_ROM, STATS_ROM,
+    STATS_VRAM, STATS_VRAM, STATS_SRAM, STATS_SRAM, STATS_WRAM, STATS_WRAM, STATS_WRAM, STATS_WRAM,
+  };
+  if (addr < 0xFE00) return regions[addr >> 12];
+  if (addr < 0xFF00) return STATS_OAM;
+  if (addr < 0xFF80 || addr == 0xFFFF) return STATS_IO;
+  return STATS_HRAM;
+}
+
+// guest accesses seen by the Mmu, debugger and device accesses are not
+// counted
+struct MemoryCounters {
+  uint64_t reads[STATS_REGION_COUNT];
+  uint64_t writes[STATS_REGION_COUNT];
+  uint64_t bankSwitches;
+};
+
+// Per instance and not atomic, read them from the thread running the
+// instance. Host time is only measured while a StatsWriter is attached.
+struct PerfCounters {
+  uint64_t instructions;
+  uint64_t cycles;
+  uint64_t frames;
+  MemoryCounters memory;
+  uint64_t interrupts;
+  uint64_t haltedCycles;
+  uint64_t hostNs[STATS_HOST_COUNT];
+  uint64_t opcodes[0x100];
+  uint64_t opcodesCb[0x100];
+};
+
+// One JSON object per line, counters are totals since the instance was
+// created. The last line written by close() adds the opcode histograms.
+class StatsWriter {
+ private:
+  FILE *file;
+  void writeCounters(const PerfCounters &counters);
+
+ public:
+  StatsWriter();
+  ~StatsWriter();
+  bool open(const std::string &filePath);
+  bool isOpen();
+  void write(const PerfCounters &counters);
+  void close(const PerfCounters &counters);
+};
+
+#endif  // SRC_INCLUDE_STATS_HPP_
@@ -0,0 +1,98 @@
+/*
+ * timeline.hpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_INCLUDE_TIMELINE_HPP_
+#define SRC_INCLUDE_TIMELINE_HPP_
+
+#include <stdint.h>
+#include <string>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+// spans per chunk, a thread allocates a new chunk when one fills up
+#define TIMELINE_CHUNK_SPANS 65536
+// per thread, later spans are dropped
+#define TIMELINE_MAX_CHUNKS 256
+
+// Host-time spans written as Chrome trace events, for Perfetto or
+// chrome://tracing. Every thread records into its own buffer without
+// locking, the file is written once recording threads are done. Built
+// only with GBEMU_TIMELINE, otherwise the macros below are empty.
+class Timeline {
+ public:
+  // set before any emulation thread starts
+  static bool active;
+  static void start();
+  // names the calling thread in the output
+  static void setThreadName(const std::string &name);
+  static void record(const char *name, uint64_t start, uint64_t end, uint64_t arg = 0);
+  static bool write(const std::string &filePath);
+  // raw ticks, converted when written
+  static uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+  }
+};
+
+// records from construction to the end of the scope
+class TimelineScope {
+ private:
+  const char *name;
+  uint64_t arg;
+  uint64_t start;
+
+ public:
+  explicit TimelineScope(const char *name, uint64_t arg = 0)
+      : name(name), arg(arg), start(Timeline::active ? Timeline::now() : 0) {}
+  ~TimelineScope() {
+    if (start) Timeline::record(name, start, Timeline::now(), arg);
+  }
+};
+
+#define TIMELINE_CONCAT_(a, b) a##b
+#define TIMELINE_CONCAT(a, b) TIMELINE_CONCAT_(a, b)
+#ifdef GBEMU_TIMELINE
+#define TIMELINE_SCOPE(name) TimelineScope TIMELINE_CONCAT(timelineScope, __LINE__)(name)
+#define TIMELINE_SCOPE_ARG(name, arg) TimelineScope TIMELINE_CONCAT(timelineScope, __LINE__)(name, arg)
+// records a span from mark to now and moves mark to now
+#define TIMELINE_MARK(name, mark, arg) \
+  do { \
+    if (Timeline::active) { \
+      uint64_t timelineNow = Timeline::now(); \
+      if (mark) Timeline::record(name, mark, timelineNow, arg); \
+      mark = timelineNow; \
+    } \
+  } while (0)
+#define TIMELINE_THREAD(name) \
+  do { \
+    if (Timeline::active) Timeline::setThreadName(name); \
+  } while (0)
+#else
+#define TIMELINE_SCOPE(name)
+#define TIMELINE_SCOPE_ARG(name, arg)
+#define TIMELINE_MARK(name, mark, arg)
+#define TIMELINE_THREAD(name)
+#endif
+
+#endif  // SRC_INCLUDE_TIMELINE_HPP_
@@ -0,0 +1,75 @@
+/*
+ * timer.hpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_INCLUDE_TIMER_HPP_
+#define SRC_INCLUDE_TIMER_HPP_
+
+#include <stdint.h>
+#include <vector>
+#include "scheduler.hpp"
+#include "io.hpp"
+
+#define DIV_ADDR 0xFF04
+#define TIMA_ADDR 0xFF05
+#define TMA_ADDR 0xFF06
+#define TAC_ADDR 0xFF07
+#define TAC_ENABLE 0x04
+
+class Mmu;
+
+// DIV and TIMA are derived from the cpu clock when read. Only the
+// counter and TIMA at the last rebase are stored, the next TIMA overflow
+// is the one scheduled event.
+class Timer : public IoDevice {
+ private:
+  Mmu *mmu;
+  Scheduler *scheduler;
+  // cpu clock at the last DIV reset, the internal divider is
+  // cpuNow - divBase
+  uint64_t divBase;
+  // TIMA as of timaBase
+  uint8_t tima;
+  uint64_t timaBase;
+  // cpu cycle of the scheduled TIMA wrap, the event fires after it
+  uint64_t overflowAt;
+  uint8_t tac;
+  uint32_t period() const;
+  uint8_t timaAt(uint64_t now) const;
+
+ public:
+  Timer(Mmu *mmu, Scheduler *scheduler);
+  void reset();
+  // folds elapsed increments into tima and schedules its overflow,
+  // also needed after a speed switch
+  void rebase();
+  uint8_t readDiv() const;
+  uint8_t readTima() const;
+  void writeDiv();
+  void writeTima(uint8_t value);
+  void writeTac(uint8_t value);
+  uint8_t readRegister(uint16_t addr) override;
+  void writeRegister(uint16_t addr, uint8_t value) override;
+  // EVENT_TIMER
+  void overflow();
+  void forkFrom(Timer *parent);
+  // relative to the scheduler clock, which must be restored first
+  void saveState(std::vector<uint8_t> &state);
+  const uint8_t *loadState(const uint8_t *state);
+};
+
+#endif  // SRC_INCLUDE_TIMER_HPP_
@@ -0,0 +1,133 @@
+/*
+ * trace.hpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_INCLUDE_TRACE_HPP_
+#define SRC_INCLUDE_TRACE_HPP_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "cpu.hpp"
+#include "mmu.hpp"
+
+// "GBTR"
+#define TRACE_MAGIC 0x52544247
+#define TRACE_VERSION 1
+#define TRACE_BUFFER_SIZE (4 << 20)
+#define TRACE_BUFFER_COUNT 4
+#define TRACE_MAX_WRITES 255
+// flags, mask, pc, sp, registers, code, write count, writes, tick
+#define TRACE_MAX_RECORD (2 + 2 + 2 + 8 + 4 + 1 + TRACE_MAX_WRITES * 3 + 1)
+#define TRACE_PATH "trace.gbt"
+
+// File layout: magic (4 bytes), version (2 bytes), then one record per
+// instruction, little endian:
+//   flags, register mask
+//   [pc]           TRACE_PC, pc differs from the previous pc + length
+//   [sp]           TRACE_SP
+//   [registers]    one byte per mask bit, in TRACE_REGISTER order
+//   [code]         TRACE_CODE, the 4 bytes at pc, when they differ from
+//                  what was last recorded for that address
+//   [write count]  when the flags count is TRACE_WRITES_EXTENDED
+//   [writes]       addr (2 bytes) and value per write
+//   tick           t-cycles of the instruction
+// Registers are the state before the instruction executes, the writes
+// and tick belong to its execution.
+enum TRACE_FLAG {
+  TRACE_PC = 0x01,
+  TRACE_SP = 0x02,
+  TRACE_CODE = 0x04,
+};
+#define TRACE_WRITES_SHIFT 3
+#define TRACE_WRITES_MASK 0x03
+#define TRACE_WRITES_EXTENDED 3
+
+enum TRACE_REGISTER {
+  TRACE_A,
+  TRACE_F,
+  TRACE_B,
+  TRACE_C,
+  TRACE_D,
+  TRACE_E,
+  TRACE_H,
+  TRACE_L,
+  TRACE_REGISTER_COUNT,
+};
+
+// pc the next record is expected at, shared with the reader
+inline uint16_t tracePredictPc(uint16_t pc, uint8_t opcode) {
+  return pc + (opcode == 0xCB ? 2 : OP_BYTES[opcode]);
+}
+
+// Delta-encodes every executed instruction into large buffers, a
+// background thread writes full buffers out sequentially. The recorder
+// also watches every page for CPU writes.
+class TraceRecorder : public MemoryWatcher {
+ private:
+  Cpu *cpu;
+  Mmu *mmu;
+  FILE *file;
+  uint8_t watchedPages[WATCH_PAGE_COUNT];
+  // last recorded state, as the reader will reconstruct it
+  uint8_t regs[TRACE_REGISTER_COUNT];
+  uint16_t sp;
+  uint16_t predictedPc;
+  std::vector<uint8_t> code;
+  // state before the current instruction
+  uint8_t nextRegs[TRACE_REGISTER_COUNT];
+  uint16_t nextPc;
+  uint16_t nextSp;
+  uint8_t nextCode[4];
+  uint16_t writeAddr[TRACE_MAX_WRITES];
+  uint8_t writeValue[TRACE_MAX_WRITES];
+  int writeCount;
+  // buffer being filled and buffers owned by the flush thread
+  uint8_t *buffer;
+  size_t position;
+  std::deque<std::pair<uint8_t*, size_t>> full;
+  std::vector<uint8_t*> spare;
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::thread flusher;
+  bool closing;
+  uint64_t records;
+  uint64_t bytes;
+  void flushLoop();
+  void submit();
+
+ public:
+  TraceRecorder(Cpu *cpu, Mmu *mmu);
+  ~TraceRecorder();
+  bool open(const std::string &filePath);
+  void close();
+  bool isOpen();
+  void before();
+  void after(uint8_t tick);
+  uint64_t getRecords();
+  uint64_t getBytes();
+  const uint8_t *getWatchedPages() override;
+  void onRead(uint16_t addr, uint8_t value) override;
+  void onWrite(uint16_t addr, uint8_t value) override;
+};
+
+#endif  // SRC_INCLUDE_TRACE_HPP_
@@ -0,0 +1,90 @@
+/*
+ * tracefile.hpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_INCLUDE_TRACEFILE_HPP_
+#define SRC_INCLUDE_TRACEFILE_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "trace.hpp"
+
+// one decoded record
+struct TraceEntry {
+  uint64_t index;
+  // t-cycles before this instruction
+  uint64_t cycles;
+  uint8_t regs[TRACE_REGISTER_COUNT];
+  uint16_t sp;
+  uint16_t pc;
+  uint8_t code[4];
+  // Gameboy Doctor logs may leave out PCMEM
+  bool hasCode;
+  uint8_t tick;
+  int writeCount;
+  uint16_t writeAddr[TRACE_MAX_WRITES];
+  uint8_t writeValue[TRACE_MAX_WRITES];
+};
+
+// A read-only mapping of a trace file. Pages are only touched as the
+// reader advances, so traces larger than RAM can be streamed.
+class TraceSource {
+ protected:
+  const uint8_t *data;
+  size_t size;
+  size_t position;
+  TraceEntry state;
+  bool map(const std::string &filePath);
+
+ public:
+  TraceSource();
+  virtual ~TraceSource();
+  virtual bool open(const std::string &filePath) = 0;
+  void close();
+  // nullptr at the end of the trace or on a truncated record, the entry
+  // stays valid until the next call
+  virtual const TraceEntry *next() = 0;
+  // true if filePath starts with the TraceRecorder header
+  static bool isBinary(const std::string &filePath);
+};
+
+// TraceRecorder files
+class TraceReader : public TraceSource {
+ private:
+  std::vector<uint8_t> code;
+  uint16_t predictedPc;
+
+ public:
+  bool open(const std::string &filePath) override;
+  const TraceEntry *next() override;
+};
+
+// Gameboy Doctor logs, one "A:01 F:B0 ... PC:0100 PCMEM:00,C3,13,02"
+// line per instruction
+class DoctorReader : public TraceSource {
+ public:
+  bool open(const std::string &filePath) override;
+  const TraceEntry *next() override;
+};
+
+// Gameboy Doctor log line, without the newline
+int formatDoctor(const TraceEntry &entry, char *out, size_t size);
+int formatReadable(const TraceEntry &entry, char *out, size_t size);
+
+#endif  // SRC_INCLUDE_TRACEFILE_HPP_
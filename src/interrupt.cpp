@@ -0,0 +1,72 @@
+/*
+ * interrupt.cpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdint>
+#include "include/interrupt.hpp"
+
+InterruptController::InterruptController() { reset(); }
+
+void InterruptController::reset() {
+  pending = 0;
+  ime = false;
+  eiDelay = 0;
+  halted = false;
+  refresh();
+}
+
+void InterruptController::enableDelayed() {
+  // the boundary right after EI itself does not count
+  if (!ime) eiDelay = 2;
+  refresh();
+}
+void InterruptController::enable() {
+  ime = true;
+  eiDelay = 0;
+  refresh();
+}
+void InterruptController::disable() {
+  ime = false;
+  eiDelay = 0;
+  refresh();
+}
+void InterruptController::halt() {
+  if (!pending) halted = true;
+  refresh();
+}
+
+int InterruptController::poll() {
+  if (eiDelay && --eiDelay == 0) ime = true;
+  // any pending source ends HALT, even with IME off
+  if (halted && pending) halted = false;
+  int source = (ime && pending) ? __builtin_ctz(pending) : -1;
+  refresh();
+  return source;
+}
+
+void InterruptController::saveState(std::vector<uint8_t> &state) {
+  uint8_t data[] = {ime, eiDelay, halted};
+  state.insert(state.end(), data, data + sizeof(data));
+}
+// pending is restored by the Mmu from IF and IE
+const uint8_t *InterruptController::loadState(const uint8_t *state) {
+  ime = state[0];
+  eiDelay = state[1];
+  halted = state[2];
+  refresh();
+  return state + 3;
+}
@@ -0,0 +1,196 @@
+/*
+ * ipc.cpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <new>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "include/ipc.hpp"
+
+// futexes are shared between processes, so no FUTEX_PRIVATE_FLAG
+static void futexWait(std::atomic<uint32_t> *word, uint32_t value) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, value, nullptr, nullptr, 0);
+}
+static void futexWake(std::atomic<uint32_t> *word) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+}
+// spins a little first, a controller usually answers within microseconds
+static void waitChange(std::atomic<uint32_t> *word, uint32_t seen, std::atomic<uint32_t> *waiting) {
+  for (int i = 0; i < IPC_SPIN_COUNT; i++) {
+    if (word->load(std::memory_order_acquire) != seen) return;
+  }
+  while (word->load(std::memory_order_acquire) == seen) {
+    waiting->store(1);
+    if (word->load() == seen) futexWait(word, seen);
+    waiting->store(0);
+  }
+}
+static void publish(std::atomic<uint32_t> *word, uint32_t value, std::atomic<uint32_t> *waiting) {
+  word->store(value);
+  if (waiting->load()) futexWake(word);
+}
+
+void ipcPush(IpcRing *ring, const IpcMessage &message) {
+  uint32_t head = ring->head.load(std::memory_order_relaxed);
+  uint32_t tail;
+  while (head - (tail = ring->tail.load(std::memory_order_acquire)) == IPC_RING_SIZE) {
+    waitChange(&ring->tail, tail, &ring->tailWaiting);
+  }
+  ring->slots[head & (IPC_RING_SIZE - 1)] = message;
+  publish(&ring->head, head + 1, &ring->headWaiting);
+}
+void ipcPop(IpcRing *ring, IpcMessage &message) {
+  uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+  waitChange(&ring->head, tail, &ring->headWaiting);
+  message = ring->slots[tail & (IPC_RING_SIZE - 1)];
+  publish(&ring->tail, tail + 1, &ring->tailWaiting);
+}
+
+static std::string shmName(const std::string &name) {
+  return name[0] == '/' ? name : "/" + name;
+}
+static void *mapRegion(const std::string &name, int flags) {
+  int fd = shm_open(shmName(name).c_str(), flags, 0600);
+  if (fd < 0) return nullptr;
+  if ((flags & O_CREAT) && ftruncate(fd, sizeof(IpcRegion)) != 0) {
+    close(fd);
+    return nullptr;
+  }
+  void *memory = mmap(nullptr, sizeof(IpcRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  return memory == MAP_FAILED ? nullptr : memory;
+}
+
+IpcServer::IpcServer(const std::string &name) {
+  this->name = name;
+  region = nullptr;
+  env = nullptr;
+}
+IpcServer::~IpcServer() {
+  delete env;
+  if (region) {
+    munmap(region, sizeof(IpcRegion));
+    shm_unlink(shmName(name).c_str());
+  }
+}
+bool IpcServer::open(uint8_t *romData, uint64_t maxFrames) {
+  void *memory = mapRegion(name, O_CREAT | O_RDWR | O_TRUNC);
+  if (!memory) {
+    printf("%s: Could not create shared memory\n", name.c_str());
+    return false;
+  }
+  region = new (memory) IpcRegion();
+  env = new GymEnv(romData, maxFrames, region->pages);
+  Mmu &mmu = env->getMachine()->mmu;
+  if (!mmu.attachCartRam(region->cartRam, sizeof(region->cartRam))) return false;
+  region->cartRamSize = mmu.getCartRamSize();
+  env->getMachine()->gameboy.getPpu()->setFramebuffer(region->framebuffer, region->colorFramebuffer);
+  region->version = IPC_VERSION;
+  std::atomic_thread_fence(std::memory_order_release);
+  region->magic = IPC_MAGIC;
+  return true;
+}
+void IpcServer::handle(IpcMessage &message) {
+  Machine *machine = env->getMachine();
+  GymObservation observation = {};
+  message.status = IPC_OK;
+  switch (message.command) {
+    case IPC_STEP:
+      observation = env->step(message.action, message.argument ? message.argument : 1);
+      message.frame = observation.frame;
+      message.done = observation.done;
+      break;
+    case IPC_RESET:
+      observation = env->reset();
+      message.frame = observation.frame;
+      message.done = observation.done;
+      break;
+    case IPC_INPUT:
+      machine->gameboy.setJoypad(message.action);
+      break;
+    case IPC_HASH:
+      message.value = machine->gameboy.hashState();
+      break;
+    case IPC_READ:
+      message.value = machine->mmu.peekByte(message.argument);
+      break;
+    case IPC_QUIT:
+      break;
+    default:
+      message.status = IPC_UNKNOWN_COMMAND;
+  }
+}
+// answers requests in order until IPC_QUIT
+void IpcServer::serve() {
+  IpcMessage message;
+  do {
+    ipcPop(&region->requests, message);
+    handle(message);
+    ipcPush(&region->responses, message);
+  } while (message.command != IPC_QUIT);
+}
+
+IpcClient::IpcClient() {
+  region = nullptr;
+  nextId = 0;
+}
+IpcClient::~IpcClient() {
+  if (region) munmap(region, sizeof(IpcRegion));
+}
+bool IpcClient::connect(const std::string &name) {
+  void *memory = mapRegion(name, O_RDWR);
+  if (!memory) {
+    printf("%s: Shared memory could not be found\n", name.c_str());
+    return false;
+  }
+  region = static_cast<IpcRegion*>(memory);
+  if (region->magic != IPC_MAGIC || region->version != IPC_VERSION) {
+    printf("%s: Not an emulator control region!\n", name.c_str());
+    munmap(region, sizeof(IpcRegion));
+    region = nullptr;
+    return false;
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return true;
+}
+// requests may be pipelined up to IPC_RING_SIZE deep before receiving
+uint32_t IpcClient::send(uint8_t command, uint8_t action, uint32_t argument) {
+  IpcMessage message = {};
+  message.id = nextId++;
+  message.command = command;
+  message.action = action;
+  message.argument = argument;
+  ipcPush(&region->requests, message);
+  return message.id;
+}
+void IpcClient::receive(IpcMessage &response) { ipcPop(&region->responses, response); }
+IpcMessage IpcClient::call(uint8_t command, uint8_t action, uint32_t argument) {
+  IpcMessage response;
+  send(command, action, argument);
+  receive(response);
+  return response;
+}
+const uint8_t *IpcClient::getFramebuffer() { return region->framebuffer; }
+const uint16_t *IpcClient::getColorFramebuffer() { return region->colorFramebuffer; }
+const uint8_t *IpcClient::getPage(int index) { return region->pages[index].data; }
+const uint8_t *IpcClient::getCartRam() { return region->cartRam; }
+uint32_t IpcClient::getCartRamSize() { return region->cartRamSize; }
@@ -0,0 +1,157 @@
+/*
+ * link.cpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdint>
+#include <chrono>
+#include <thread>
+#include "include/link.hpp"
+#include "include/farm.hpp"
+#include "include/timeline.hpp"
+
+static uint64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+LinkPort::LinkPort() {
+    serial = nullptr;
+    in = nullptr;
+    out = nullptr;
+    ready = -1;
+    transfers = 0;
+}
+
+void LinkPort::connect(SerialPort *serial, LinkQueue *in, LinkQueue *out) {
+    this->serial = serial;
+    this->in = in;
+    this->out = out;
+    serial->setSink(this);
+}
+
+void LinkPort::push(uint16_t message) {
+    uint32_t head = out->head.load(std::memory_order_relaxed);
+    if (head - out->tail.load(std::memory_order_acquire) == LINK_QUEUE_SIZE) return;
+    out->slots[head & (LINK_QUEUE_SIZE - 1)] = message;
+    out->head.store(head + 1, std::memory_order_release);
+}
+
+void LinkPort::poll() {
+    uint32_t tail = in->tail.load(std::memory_order_relaxed);
+    uint32_t head = in->head.load(std::memory_order_acquire);
+    for (; tail != head; tail++) {
+        uint16_t message = in->slots[tail & (LINK_QUEUE_SIZE - 1)];
+        if (message & LINK_READY) {
+            ready = message & 0xFF;
+        } else if (serial->receive(message & 0xFF)) {
+            transfers++;
+        }
+    }
+    in->tail.store(tail, std::memory_order_release);
+}
+
+// we clocked the transfer, the peer only takes part if it is listening
+uint8_t LinkPort::exchange(uint8_t byte) {
+    poll();
+    if (ready < 0) return 0xFF;
+    uint8_t received = ready;
+    ready = -1;
+    push(LINK_DATA | byte);
+    transfers++;
+    return received;
+}
+
+void LinkPort::listen(uint8_t byte) { push(LINK_READY | byte); }
+uint64_t LinkPort::getTransfers() { return transfers; }
+
+LinkCable::LinkCable(Gameboy *first, Gameboy *second, uint64_t slice) {
+    gameboys[0] = first;
+    gameboys[1] = second;
+    for (int side = 0; side < 2; side++) {
+        queues[side].head = 0;
+        queues[side].tail = 0;
+        progress[side] = 0;
+    }
+    // each side reads the queue the other one writes
+    ports[0].connect(first->getSerial(), &queues[1], &queues[0]);
+    ports[1].connect(second->getSerial(), &queues[0], &queues[1]);
+    this->slice = slice ? slice : SERIAL_TRANSFER_CYCLES;
+    seconds = 0;
+    cycles = 0;
+}
+
+LinkCable::~LinkCable() {
+    for (int side = 0; side < 2; side++) {
+        gameboys[side]->getSerial()->setSink(nullptr);
+    }
+}
+
+// runs slices from base on, one slice unless threaded
+void LinkCable::runSide(int side, uint64_t base, uint64_t end, uint64_t step, bool threaded) {
+    Gameboy *gameboy = gameboys[side];
+    for (uint64_t from = base; from < end; from += step) {
+        uint64_t target = from + step < end ? from + step : end;
+        // the other side must have finished the previous slice
+        while (threaded && progress[side ^ 1].load(std::memory_order_acquire) < from) {
+            std::this_thread::yield();
+        }
+        ports[side].poll();
+        gameboy->runUntil(target);
+        progress[side].store(target, std::memory_order_release);
+        if (!threaded || gameboy->isHalted()) break;
+    }
+    // a finished or halted side no longer holds the other one back
+    if (threaded) progress[side].store(UINT64_MAX, std::memory_order_release);
+}
+
+void LinkCable::run(uint64_t cycles) {
+    uint64_t start = nowNs();
+    uint64_t base = gameboys[0]->getCycles();
+    uint64_t end = base + cycles;
+    for (uint64_t target = base; target < end; target += slice) {
+        for (int side = 0; side < 2; side++) {
+            runSide(side, target, end, slice, false);
+        }
+    }
+    seconds += (nowNs() - start) / 1e9;
+    this->cycles += cycles;
+}
+
+void LinkCable::runThreaded(uint64_t cycles) {
+    uint64_t start = nowNs();
+    uint64_t base = gameboys[0]->getCycles();
+    uint64_t end = base + cycles;
+    // both sides run at once, so a byte clocked in one slice is only seen
+    // by the other side in its next one. Half slices keep the reply to
+    // it within one transfer.
+    uint64_t step = slice / 2 ? slice / 2 : 1;
+    for (int side = 0; side < 2; side++) progress[side] = base;
+    std::thread peer([&] {
+        TIMELINE_THREAD("link 1");
+        runSide(1, base, end, step, true);
+    });
+    runSide(0, base, end, step, true);
+    peer.join();
+    seconds += (nowNs() - start) / 1e9;
+    this->cycles += cycles;
+}
+
+void LinkCable::printStats() {
+    double speed = seconds > 0 ? cycles / seconds / GAMEBOY_CLOCK : 0;
+    printf("Link: %lu transfers, slice %lu cycles\n", ports[0].getTransfers(), slice);
+    printf("Cycles: %lu per side in %.3fs (%.1fx realtime)\n", cycles, seconds, speed);
+}
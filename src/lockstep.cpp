@@ -0,0 +1,467 @@
+/*
+ * lockstep.cpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "include/lockstep.hpp"
+
+// lane helpers are internal and always inlined
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+static inline lane8_t select(lane8_t mask, lane8_t x, lane8_t y) {
+    return (x & mask) | (y & ~mask);
+}
+static inline lane16_t select16(lane8_t mask, lane16_t x, lane16_t y) {
+    lane16_t wide = (lane16_t)__builtin_convertvector((lane8s_t)mask, lane16s_t);
+    return (x & wide) | (y & ~wide);
+}
+static inline lane8_t narrow(lane16s_t mask) {
+    return (lane8_t)__builtin_convertvector(mask, lane8s_t);
+}
+static inline lane16_t widen(lane8_t value) {
+    return __builtin_convertvector(value, lane16_t);
+}
+// bit n set for every lane n with the top bit set
+static inline uint32_t laneBits(lane8_t mask) {
+#if defined(__AVX2__)
+    return uint32_t(_mm256_movemask_epi8((__m256i)mask));
+#elif defined(__SSE2__)
+    __m128i low, high;
+    memcpy(&low, &mask, sizeof(low));
+    memcpy(&high, reinterpret_cast<uint8_t*>(&mask) + sizeof(low), sizeof(high));
+    return uint32_t(_mm_movemask_epi8(low)) | (uint32_t(_mm_movemask_epi8(high)) << 16);
+#else
+    uint32_t bits = 0;
+    for (int slot = 0; slot < LOCKSTEP_WIDTH; slot++) {
+        bits |= uint32_t(mask[slot] >> 7) << slot;
+    }
+    return bits;
+#endif
+}
+static inline lane8_t flags(lane8_t z, lane8_t n, lane8_t h, lane8_t c) {
+    return (z & 0x80) | (n & 0x40) | (h & 0x20) | (c & 0x10);
+}
+
+// ADD, ADC, SUB, SBC, AND, XOR, OR, CP in opcode order
+static void vectorAlu(LaneBlock &block, const lane8_t &mask, uint8_t operation, const lane8_t &value) {
+    const lane8_t zero = {};
+    lane8_t a = block.reg[7];
+    lane8_t f = block.reg[LOCKSTEP_REG_F];
+    lane8_t carry = (lane8_t)((f & 0x10) != 0) & 1;
+    lane8_t result = zero, n = zero, h = zero, c = zero;
+    switch (operation) {
+        case 0:
+            result = a + value;
+            h = (lane8_t)(((a & 0x0F) + (value & 0x0F)) > 0x0F);
+            c = (lane8_t)(result < a);
+            break;
+        case 1: {
+            lane16_t sum = widen(a) + widen(value) + widen(carry);
+            result = __builtin_convertvector(sum, lane8_t);
+            h = (lane8_t)(((a & 0x0F) + (value & 0x0F) + carry) > 0x0F);
+            c = narrow(sum > 0xFF);
+        } break;
+        case 2:
+        case 7:
+            result = a - value;
+            n = ~zero;
+            h = (lane8_t)((a & 0x0F) < (value & 0x0F));
+            c = (lane8_t)(value > a);
+            break;
+        case 3:
+            result = a - value - carry;
+            n = ~zero;
+            h = (lane8_t)((a & 0x0F) < ((value & 0x0F) + carry));
+            c = narrow((widen(value) + widen(carry)) > widen(a));
+            break;
+        case 4:
+            result = a & value;
+            h = ~zero;
+            break;
+        case 5:
+            result = a ^ value;
+            break;
+        case 6:
+            result = a | value;
+            break;
+    }
+    if (operation != 7) {
+        block.reg[7] = select(mask, result, a);
+    }
+    block.reg[LOCKSTEP_REG_F] = select(mask, flags((lane8_t)(result == 0), n, h, c), f);
+}
+
+static inline lane16_t readPair(LaneBlock &block, uint8_t pair) {
+    if (pair == 3) return block.sp;
+    return (widen(block.reg[pair * 2]) << 8) | widen(block.reg[pair * 2 + 1]);
+}
+
+static inline void writePair(LaneBlock &block, lane8_t mask, uint8_t pair, lane16_t value) {
+    if (pair == 3) {
+        block.sp = select16(mask, value, block.sp);
+        return;
+    }
+    block.reg[pair * 2] = select(mask, __builtin_convertvector(value >> 8, lane8_t), block.reg[pair * 2]);
+    block.reg[pair * 2 + 1] = select(mask, __builtin_convertvector(value, lane8_t), block.reg[pair * 2 + 1]);
+}
+
+// the jumps stepVector takes: JR, JP and their conditional forms
+static inline bool isBranch(uint8_t opcode) {
+    return opcode == op_jr_r8 || opcode == op_jp_a16 || (opcode & 0xE7) == 0x20 || (opcode & 0xE7) == 0xC2;
+}
+
+Lockstep::Lockstep(uint8_t *romData, int laneCount) {
+    this->laneCount = laneCount;
+    blockCount = (laneCount + LOCKSTEP_WIDTH - 1) / LOCKSTEP_WIDTH;
+    machineStride = (sizeof(Machine) + sizeof(MemoryPage) * MMU_PAGE_COUNT + 63) & ~size_t(63);
+    arena = static_cast<uint8_t*>(std::aligned_alloc(64, machineStride * laneCount));
+    blocks = static_cast<LaneBlock*>(std::aligned_alloc(64, sizeof(LaneBlock) * blockCount));
+    if (arena == NULL || blocks == NULL) throw std::bad_alloc();
+    for (int i = 0; i < laneCount; i++) {
+        uint8_t *slot = arena + machineStride * i;
+        new (slot) Machine(romData, reinterpret_cast<MemoryPage*>(slot + sizeof(Machine)));
+    }
+    memset(blocks, 0, sizeof(LaneBlock) * blockCount);
+    // an empty mask leaves the block as it is
+    LaneBlock scratch = {};
+    lane8_t tick;
+    for (int opcode = 0; opcode < 0x100; opcode++) {
+        vectorOpcodes[opcode] = stepVector(scratch, (lane8_t){}, uint8_t(opcode), 0, tick);
+    }
+    targets.assign(laneCount, 0);
+    vectorRuns.assign(0x8000, 0);
+    vectorSteps = scalarSteps = 0;
+}
+
+Lockstep::~Lockstep() {
+    for (int i = 0; i < laneCount; i++) {
+        getMachine(i)->~Machine();
+    }
+    std::free(arena);
+    std::free(blocks);
+}
+
+int Lockstep::getLaneCount() { return laneCount; }
+uint64_t Lockstep::getVectorSteps() { return vectorSteps; }
+uint64_t Lockstep::getScalarSteps() { return scalarSteps; }
+
+Machine *Lockstep::getMachine(int lane) {
+    return reinterpret_cast<Machine*>(arena + machineStride * lane);
+}
+
+// lane cpu -> SoA
+void Lockstep::loadLane(int lane) {
+    LaneBlock &block = blocks[lane / LOCKSTEP_WIDTH];
+    int slot = lane % LOCKSTEP_WIDTH;
+    CpuRegister &cpuRegister = getMachine(lane)->cpu.cpuRegister;
+    for (int i = 0; i < 8; i++) {
+        block.reg[i][slot] = (i == LOCKSTEP_REG_F) ? cpuRegister.reg_f : *cpuRegister.reg[i];
+    }
+    block.sp[slot] = cpuRegister.sp;
+    block.pc[slot] = cpuRegister.pc;
+    refreshLane(lane);
+}
+
+// everything but the registers, for a lane with nothing pending
+void Lockstep::refreshLane(int lane) {
+    LaneBlock &block = blocks[lane / LOCKSTEP_WIDTH];
+    int slot = lane % LOCKSTEP_WIDTH;
+    Machine *machine = getMachine(lane);
+    Gameboy &gameboy = machine->gameboy;
+    Mmu &mmu = machine->mmu;
+    uint64_t cycles = gameboy.getCycles();
+    bool active = !gameboy.isHalted() && cycles < targets[lane];
+    block.active[slot] = active ? 0xFF : 0;
+    // interrupt dispatch, ei delay and halt are handled by the scalar
+    // path, as are fetches during OAM DMA, which read 0xFF
+    block.vectored[slot] = (!mmu.getInterrupts().isActive() && !mmu.isBusLocked() && !mmu.hasWatcher()) ? 0xFF : 0;
+    block.counting[slot] = gameboy.isCountingOpcodes() ? 0xFF : 0;
+    block.romBank0[slot] = uint16_t(mmu.getRomBank0());
+    block.romBank[slot] = uint16_t(mmu.getRomBank());
+    uint64_t budget = active ? targets[lane] - cycles : 0;
+    uint64_t quiet = gameboy.getQuietCycles();
+    if (quiet < budget) budget = quiet;
+    if (budget > LOCKSTEP_MAX_PENDING) budget = LOCKSTEP_MAX_PENDING;
+    // pending counts cpu cycles, twice the clock in double speed
+    block.budget[slot] = uint16_t(gameboy.isDoubleSpeed() ? budget * 2 : budget);
+}
+
+// applies the lane's pending vector steps to its instance, the caller
+// refreshes the lane
+void Lockstep::flushLane(int lane) {
+    LaneBlock &block = blocks[lane / LOCKSTEP_WIDTH];
+    int slot = lane % LOCKSTEP_WIDTH;
+    if (block.instructions[slot] == 0) return;
+    getMachine(lane)->gameboy.advance(block.instructions[slot], block.fetches[slot], block.pending[slot]);
+    block.instructions[slot] = 0;
+    block.fetches[slot] = 0;
+    block.pending[slot] = 0;
+}
+
+// SoA -> lane cpu
+void Lockstep::storeLane(int lane) {
+    LaneBlock &block = blocks[lane / LOCKSTEP_WIDTH];
+    int slot = lane % LOCKSTEP_WIDTH;
+    CpuRegister &cpuRegister = getMachine(lane)->cpu.cpuRegister;
+    for (int i = 0; i < 8; i++) {
+        if (i == LOCKSTEP_REG_F) {
+            cpuRegister.reg_f = block.reg[i][slot] & 0xF0;
+        } else {
+            *cpuRegister.reg[i] = block.reg[i][slot];
+        }
+    }
+    cpuRegister.sp = block.sp[slot];
+    cpuRegister.pc = block.pc[slot];
+}
+
+// executes opcode with its operand bytes on every lane in mask, false if
+// it has no vector form. Semantics mirror Cpu::decode.
+bool Lockstep::stepVector(LaneBlock &block, const lane8_t &mask, uint8_t opcode, uint16_t address,
+        lane8_t &tick) {
+    const lane8_t zero = {};
+    uint8_t immediate = uint8_t(address);
+    lane8_t f = block.reg[LOCKSTEP_REG_F];
+    lane16_t nextPc = block.pc + uint16_t(OP_BYTES[opcode]);
+    tick = zero + uint8_t(OP_CYCLE[opcode]);
+
+    uint8_t dst = (opcode & 0x38) >> 3;
+    uint8_t src = (opcode & 0x07);
+    if (opcode >= 0x40 && opcode < 0x80) {
+        // LD r, r
+        if (dst == 6 || src == 6) return false;
+        block.reg[dst] = select(mask, block.reg[src], block.reg[dst]);
+    } else if (opcode >= 0x80 && opcode < 0xC0) {
+        // ALU A, r
+        if (src == 6) return false;
+        vectorAlu(block, mask, dst, block.reg[src]);
+    } else if ((opcode & 0xC7) == 0xC6) {
+        // ALU A, d8
+        vectorAlu(block, mask, dst, zero + immediate);
+    } else if ((opcode & 0xC7) == 0x06 && dst != 6) {
+        // LD r, d8
+        block.reg[dst] = select(mask, zero + immediate, block.reg[dst]);
+    } else if ((opcode & 0xC7) == 0x04 && dst != 6) {
+        // INC r
+        lane8_t value = block.reg[dst] + 1;
+        lane8_t h = (lane8_t)((value & 0x0F) == 0);
+        block.reg[dst] = select(mask, value, block.reg[dst]);
+        block.reg[LOCKSTEP_REG_F] = select(mask, flags((lane8_t)(value == 0), zero, h, zero) | (f & 0x10), f);
+    } else if ((opcode & 0xC7) == 0x05 && dst != 6) {
+        // DEC r
+        lane8_t value = block.reg[dst] - 1;
+        lane8_t h = (lane8_t)((value & 0x0F) == 0x0F);
+        block.reg[dst] = select(mask, value, block.reg[dst]);
+        block.reg[LOCKSTEP_REG_F] = select(mask, flags((lane8_t)(value == 0), ~zero, h, zero) | (f & 0x10), f);
+    } else if ((opcode & 0xCF) == 0x01) {
+        // LD rr, d16
+        writePair(block, mask, (opcode & 0x30) >> 4, (lane16_t){} + address);
+    } else if ((opcode & 0xCF) == 0x09) {
+        // ADD HL, rr
+        lane16_t hl = readPair(block, 2);
+        lane16_t value = readPair(block, (opcode & 0x30) >> 4);
+        lane16_t sum = hl + value;
+        lane8_t h = narrow((lane16s_t)(((hl & 0x0FFF) + (value & 0x0FFF)) > 0x0FFF));
+        lane8_t c = narrow((lane16s_t)(sum < hl));
+        writePair(block, mask, 2, sum);
+        block.reg[LOCKSTEP_REG_F] = select(mask, (f & 0x80) | flags(zero, zero, h, c), f);
+    } else if ((opcode & 0xE7) == 0x07) {
+        // RLCA, RRCA, RLA, RRA
+        lane8_t a = block.reg[7];
+        lane8_t carry = (lane8_t)((f & 0x10) != 0) & 1;
+        bool right = opcode & 0x08;
+        bool through = opcode & 0x10;
+        lane8_t out = right ? (a & 1) : (a >> 7);
+        lane8_t in = through ? carry : out;
+        lane8_t value = right ? (a >> 1) | (in << 7) : (a << 1) | in;
+        block.reg[7] = select(mask, value, a);
+        block.reg[LOCKSTEP_REG_F] = select(mask, flags(zero, zero, zero, (lane8_t)(out != 0)), f);
+    } else if ((opcode & 0xCF) == 0x03) {
+        // INC rr
+        uint8_t pair = (opcode & 0x30) >> 4;
+        writePair(block, mask, pair, readPair(block, pair) + 1);
+    } else if ((opcode & 0xCF) == 0x0B) {
+        // DEC rr
+        uint8_t pair = (opcode & 0x30) >> 4;
+        writePair(block, mask, pair, readPair(block, pair) - 1);
+    } else {
+        switch (opcode) {
+            case op_nop:
+                break;
+            case op_cpl:
+                block.reg[7] = select(mask, ~block.reg[7], block.reg[7]);
+                block.reg[LOCKSTEP_REG_F] = select(mask, f | 0x60, f);
+                break;
+            case op_scf:
+                block.reg[LOCKSTEP_REG_F] = select(mask, (f & 0x80) | 0x10, f);
+                break;
+            case op_ccf:
+                block.reg[LOCKSTEP_REG_F] = select(mask, (f & 0x80) | (~f & 0x10), f);
+                break;
+            case op_jr_r8:
+                nextPc += uint16_t(int8_t(immediate));
+                break;
+            case op_jp_a16:
+                nextPc = (lane16_t){} + address;
+                break;
+            case op_jr_nz_r8:
+            case op_jr_z_r8:
+            case op_jr_nc_r8:
+            case op_jr_c_r8:
+            case op_jp_nz_a16:
+            case op_jp_z_a16:
+            case op_jp_nc_a16:
+            case op_jp_c_a16: {
+                // lanes split on their own flags
+                uint8_t flag = (opcode & 0x10) ? 0x10 : 0x80;
+                lane8_t taken = (lane8_t)((f & flag) != 0);
+                if (!(opcode & 0x08)) taken = ~taken;
+                bool relative = opcode < 0x40;
+                lane16_t target = relative ? nextPc + uint16_t(int8_t(immediate))
+                    : (lane16_t){} + address;
+                nextPc = select16(taken, target, nextPc);
+                tick = relative ? select(taken, zero + 12, zero + 8) : select(taken, zero + 16, zero + 12);
+            } break;
+            default:
+                return false;
+        }
+    }
+    block.pc = select16(mask, nextPc, block.pc);
+    return true;
+}
+
+void Lockstep::stepBlock(int index) {
+    LaneBlock &block = blocks[index];
+    int first = index * LOCKSTEP_WIDTH;
+    uint32_t active = laneBits(block.active);
+    if (active == 0) return;
+
+    // leader is the first active lane, followers share its pc. Same pc is
+    // only the same code on the same banks, MBC1 mode 1 switches
+    // 0x0000-0x3FFF too and operands may cross into 0x4000.
+    int leader = __builtin_ctz(active);
+    uint16_t pc = block.pc[leader];
+    lane16s_t same = (block.pc == pc) & (block.romBank0 == block.romBank0[leader]) &
+        (block.romBank == block.romBank[leader]);
+    lane8_t mask = narrow(same) & block.active & block.vectored;
+    Mmu &leaderMmu = getMachine(first + leader)->mmu;
+
+    // only ROM is shared between lanes, RAM code may differ per lane.
+    // Operands are peeked, each lane counts its own fetches.
+    uint32_t vector = 0;
+    uint8_t opcode = leaderMmu.peekByte(pc);
+    lane8_t tick;
+    if (pc < 0x8000 - 2 && vectorOpcodes[opcode] && laneBits(mask)) {
+        uint16_t address = uint16_t(leaderMmu.peekByte(pc + 1) | (leaderMmu.peekByte(pc + 2) << 8));
+        stepVector(block, mask, opcode, address, tick);
+        vector = laneBits(mask);
+        lane16_t wide = (lane16_t)__builtin_convertvector((lane8s_t)mask, lane16s_t);
+        block.pending += widen(tick) & wide;
+        block.instructions += wide & 1;
+        block.fetches += wide & uint16_t(OP_BYTES[opcode]);
+        for (uint32_t bits = vector & laneBits(block.counting); bits; bits &= bits - 1) {
+            getMachine(first + __builtin_ctz(bits))->gameboy.countOpcode(opcode);
+        }
+        uint32_t due = vector & laneBits(narrow((lane16s_t)(block.pending >= block.budget)));
+        for (; due; due &= due - 1) {
+            flushLane(first + __builtin_ctz(due));
+            refreshLane(first + __builtin_ctz(due));
+        }
+        vectorSteps += __builtin_popcount(vector);
+    }
+    // everyone else runs on its own
+    for (uint32_t bits = active & ~vector; bits; bits &= bits - 1) {
+        runScalar(first + __builtin_ctz(bits));
+    }
+}
+
+// scanned on whatever bank is mapped first, which only costs speed
+// when another bank runs there
+int Lockstep::getVectorRun(Mmu &mmu, uint16_t pc) {
+    uint8_t &run = vectorRuns[pc];
+    if (run == 0) {
+        int count = 0;
+        uint16_t address = pc;
+        while (address < 0x8000 - 2 && count < LOCKSTEP_MIN_RUN) {
+            uint8_t opcode = mmu.peekByte(address);
+            if (!vectorOpcodes[opcode]) break;
+            count++;
+            if (isBranch(opcode)) break;
+            address += OP_BYTES[opcode];
+        }
+        run = uint8_t(count + 1);
+    }
+    return run - 1;
+}
+
+// steps the lane on Cpu::decode at least once and on to the next opcode
+// a vector step could take, so registers are copied once per run
+void Lockstep::runScalar(int lane) {
+    flushLane(lane);
+    storeLane(lane);
+    Machine *machine = getMachine(lane);
+    Gameboy &gameboy = machine->gameboy;
+    Mmu &mmu = machine->mmu;
+    InterruptController &interrupts = mmu.getInterrupts();
+    Cpu &cpu = machine->cpu;
+    scalarSteps += gameboy.stepUntil(targets[lane], [&] {
+        // halted lanes stay here until the interrupt
+        if (interrupts.isActive()) return false;
+        uint16_t pc = cpu.cpuRegister.pc;
+        return pc < 0x8000 - 2 && getVectorRun(mmu, pc) >= LOCKSTEP_MIN_RUN && !mmu.isBusLocked();
+    });
+    loadLane(lane);
+}
+
+void Lockstep::run() {
+    for (int lane = 0; lane < laneCount; lane++) {
+        loadLane(lane);
+    }
+    bool running = true;
+    while (running) {
+        running = false;
+        for (int i = 0; i < blockCount; i++) {
+            if (laneBits(blocks[i].active) == 0) continue;
+            stepBlock(i);
+            running = true;
+        }
+    }
+    for (int lane = 0; lane < laneCount; lane++) {
+        flushLane(lane);
+        storeLane(lane);
+    }
+}
+
+void Lockstep::runCycles(uint64_t cycles) {
+    for (int lane = 0; lane < laneCount; lane++) {
+        targets[lane] = getMachine(lane)->gameboy.getCycles() + cycles;
+    }
+    run();
+}
+
+void Lockstep::runFrame() {
+    for (int lane = 0; lane < laneCount; lane++) {
+        uint64_t cycles = getMachine(lane)->gameboy.getCycles();
+        targets[lane] = (cycles / CYCLES_PER_FRAME + 1) * CYCLES_PER_FRAME;
+    }
+    run();
+}
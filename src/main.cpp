@@ -18,8 +18,13 @@
 
 #include "include/main.hpp"
 #include "include/host.hpp"
+#include <chrono>
+#include <csignal>
+#include <cstring>
 #include <filesystem>
 #include <set>
+#include <sys/wait.h>
+#include <unistd.h>
 
 namespace fs = std::filesystem;
 
@@ -37,20 +42,312 @@ void runCpuIndividualTests(Host* host, uint8_t* romData) {
     if (!host->loadFile(testRomFilePath)) continue;
     romData = host->getRomData();
 
-    // init modules
-    Cpu *cpu = new Cpu();
-    Mmu *mmu = new Mmu(romData);
-
     // init system
-    Gameboy *gameboy = new Gameboy(cpu, mmu);
-    gameboy->start();
+    Machine *machine = new Machine(romData);
+    machine->gameboy.start();
+    delete machine;
   }
 
+  delete host;
   exit(0);
 }
+// records frames of scripted input that changes every few frames, so a
+// movie can be made and checked without anyone at the keys
+bool recordMovie(Machine *machine, uint64_t romHash, const string &moviePath, uint32_t frames) {
+  Movie movie(&machine->gameboy);
+  uint32_t seed = 0x2545F491;
+  movie.startRecording(romHash);
+  for (uint32_t frame = 0; frame < frames && !machine->gameboy.isHalted(); frame++) {
+    if (frame % 8 == 0) {
+      seed ^= seed << 13;
+      seed ^= seed >> 17;
+      seed ^= seed << 5;
+      movie.setInput(uint8_t(seed));
+    }
+    movie.run(CYCLES_PER_FRAME);
+  }
+  movie.stopRecording();
+  printf("Movie recorded: %lu cycles, final state %016lX\n", machine->gameboy.getCycles(),
+      machine->gameboy.hashState());
+  return movie.save(moviePath);
+}
+static uint64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// lockstep time over scalar time allowed where lanes mostly fall back
+// to the scalar interpreter, and where they mostly step as vectors.
+// Unoptimized builds leave the vector code too slow to tell.
+#define LOCKSTEP_SCALAR_SLACK 1.25
+#ifdef __OPTIMIZE__
+#define LOCKSTEP_VECTOR_SLACK 1.0
+#else
+#define LOCKSTEP_VECTOR_SLACK LOCKSTEP_SCALAR_SLACK
+#endif
+
+// runs lanes instances on the lockstep interpreter next to as many
+// scalar ones with the same input, lane i holding its own buttons, and
+// compares state hashes and counters frame by frame, then the times
+bool verifyLockstep(uint8_t *romData, int lanes, uint32_t frames) {
+  Lockstep lockstep(romData, lanes);
+  vector<Machine*> scalar;
+  // lines cost the same on either side and are not part of the state, so
+  // neither renders and the times compare the interpreters
+  for (int lane = 0; lane < lanes; lane++) {
+    scalar.push_back(new Machine(romData));
+    scalar[lane]->gameboy.getPpu()->setRendering(false);
+    lockstep.getMachine(lane)->gameboy.getPpu()->setRendering(false);
+  }
+  int mismatches = 0;
+  uint64_t scalarNs = 0, lockstepNs = 0;
+  for (uint32_t frame = 0; frame < frames && mismatches == 0; frame++) {
+    for (int lane = 0; lane < lanes; lane++) {
+      uint8_t buttons = uint8_t(lane * 0x9E + (frame / 8) * 0x35);
+      lockstep.getMachine(lane)->gameboy.setJoypad(buttons);
+      scalar[lane]->gameboy.setJoypad(buttons);
+    }
+    uint64_t start = nowNs();
+    for (int lane = 0; lane < lanes; lane++) {
+      scalar[lane]->gameboy.runFrame();
+    }
+    uint64_t middle = nowNs();
+    lockstep.runFrame();
+    lockstepNs += nowNs() - middle;
+    scalarNs += middle - start;
+    for (int lane = 0; lane < lanes; lane++) {
+      Gameboy &expected = scalar[lane]->gameboy;
+      Gameboy &actual = lockstep.getMachine(lane)->gameboy;
+      PerfCounters expectedCounters = expected.getCounters();
+      PerfCounters actualCounters = actual.getCounters();
+      if (expected.hashState() != actual.hashState()) {
+        printf("Lane %d, frame %u: state hash %016lX, expected %016lX\n", lane, frame,
+            actual.hashState(), expected.hashState());
+        mismatches++;
+      } else if (expectedCounters.instructions != actualCounters.instructions ||
+          memcmp(&expectedCounters.memory, &actualCounters.memory, sizeof(MemoryCounters)) != 0) {
+        printf("Lane %d, frame %u: counters differ (%lu instructions, expected %lu)\n", lane, frame,
+            actualCounters.instructions, expectedCounters.instructions);
+        mismatches++;
+      }
+    }
+  }
+  printf("Lockstep: %d lanes, %lu vector and %lu scalar steps, %d mismatches\n", lanes,
+      lockstep.getVectorSteps(), lockstep.getScalarSteps(), mismatches);
+  printf("Time: %.3fs lockstep, %.3fs scalar\n", lockstepNs / 1e9, scalarNs / 1e9);
+  bool vectored = lockstep.getVectorSteps() >= lockstep.getScalarSteps();
+  double slack = vectored ? LOCKSTEP_VECTOR_SLACK : LOCKSTEP_SCALAR_SLACK;
+  bool fast = lockstepNs <= scalarNs * slack;
+  if (!fast) {
+    printf("Lockstep slower than %.2fx scalar\n", slack);
+  }
+  for (auto machine : scalar) {
+    delete machine;
+  }
+  return mismatches == 0 && fast;
+}
+// true if both show the same frame, memory and progress
+static bool sameObservation(const GymObservation &a, const GymObservation &b) {
+  if (a.frame != b.frame || a.done != b.done) return false;
+  if (memcmp(a.framebuffer, b.framebuffer, SCREEN_WIDTH * SCREEN_HEIGHT) != 0) return false;
+  if ((a.colorFramebuffer == NULL) != (b.colorFramebuffer == NULL)) return false;
+  if (a.colorFramebuffer && memcmp(a.colorFramebuffer, b.colorFramebuffer,
+      SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(uint16_t)) != 0) {
+    return false;
+  }
+  return memcmp(a.wram[0], b.wram[0], MMU_PAGE_SIZE) == 0 && memcmp(a.wram[1], b.wram[1], MMU_PAGE_SIZE) == 0 &&
+      memcmp(a.hram, b.hram, 0xFFFF - 0xFF80) == 0;
+}
+
+// steps a GymBatch of count instances and as many GymEnvs with the same
+// actions, 1 to 4 frames at a time with a reset halfway, and compares
+// every observation
+bool verifyGym(uint8_t *romData, int count, uint32_t frames) {
+  GymBatch batch(romData, count);
+  vector<GymEnv*> envs;
+  for (int i = 0; i < count; i++) {
+    envs.push_back(new GymEnv(romData));
+  }
+  vector<GymObservation> observations(count);
+  vector<uint8_t> actions(count);
+  batch.reset(observations.data());
+  int mismatches = 0;
+  uint32_t frame = 0;
+  for (uint32_t step = 0; frame < frames && mismatches == 0; step++) {
+    uint32_t skip = 1 + step % 4;
+    bool reset = step > 0 && frame < frames / 2 && frame + skip >= frames / 2;
+    for (int i = 0; i < count; i++) {
+      actions[i] = uint8_t(i * 0x9E + step * 0x35);
+    }
+    if (reset) {
+      batch.reset(observations.data());
+    } else {
+      batch.step(actions.data(), skip, observations.data());
+    }
+    for (int i = 0; i < count; i++) {
+      GymObservation expected = reset ? envs[i]->reset() : envs[i]->step(actions[i], skip);
+      if (!sameObservation(observations[i], expected)) {
+        printf("Instance %d, step %u: observation differs (frame %lu, expected %lu)\n", i, step,
+            observations[i].frame, expected.frame);
+        mismatches++;
+      } else if (batch.getMachine(i)->gameboy.hashState() != envs[i]->getMachine()->gameboy.hashState()) {
+        printf("Instance %d, step %u: state hash differs\n", i, step);
+        mismatches++;
+      }
+    }
+    frame += skip;
+  }
+  printf("Gym: %d instances, %u frames, %d mismatches\n", count, frames, mismatches);
+  for (auto env : envs) {
+    delete env;
+  }
+  return mismatches == 0;
+}
+
+// WRAM none of the gbromgen scenarios touches
+#define FORK_POKE_ADDR 0xDF00
+
+// joypad and a poke into WRAM, distinct per side and frame
+static void forkInput(Machine *machine, int side, uint32_t frame) {
+  machine->gameboy.setJoypad(uint8_t(side * 0x9E + frame * 0x35));
+  machine->mmu.writeByte(FORK_POKE_ADDR, uint8_t(side * 0x80 + frame));
+}
+
+// forks an instance halfway through the frames and drives parent and
+// child with different input from there. Each must match a fresh run
+// with its own input, so neither leaks into the other through the pages
+// they share.
+bool verifyFork(uint8_t *romData, uint32_t frames) {
+  uint32_t split = frames / 2;
+  Machine *parent = new Machine(romData);
+  Machine *parentReplay = new Machine(romData);
+  Machine *childReplay = new Machine(romData);
+  for (uint32_t frame = 0; frame < split; frame++) {
+    for (Machine *machine : {parent, parentReplay, childReplay}) {
+      forkInput(machine, 0, frame);
+      machine->gameboy.runFrame();
+    }
+  }
+  Machine *child = parent->fork();
+  int mismatches = 0;
+  if (child->gameboy.hashState() != parent->gameboy.hashState()) {
+    printf("Frame %u: fork differs from its parent\n", split);
+    mismatches++;
+  }
+  for (uint32_t frame = split; frame < frames && mismatches == 0; frame++) {
+    forkInput(parent, 0, frame);
+    forkInput(parentReplay, 0, frame);
+    forkInput(child, 1, frame);
+    forkInput(childReplay, 1, frame);
+    for (Machine *machine : {parent, parentReplay, child, childReplay}) {
+      machine->gameboy.runFrame();
+    }
+    if (parent->gameboy.hashState() != parentReplay->gameboy.hashState()) {
+      printf("Frame %u: parent state hash %016lX, expected %016lX\n", frame,
+          parent->gameboy.hashState(), parentReplay->gameboy.hashState());
+      mismatches++;
+    }
+    if (child->gameboy.hashState() != childReplay->gameboy.hashState()) {
+      printf("Frame %u: child state hash %016lX, expected %016lX\n", frame,
+          child->gameboy.hashState(), childReplay->gameboy.hashState());
+      mismatches++;
+    }
+  }
+  // otherwise the input never told them apart
+  if (mismatches == 0 && split < frames && child->gameboy.hashState() == parent->gameboy.hashState()) {
+    printf("Frame %u: parent and child did not diverge\n", frames);
+    mismatches++;
+  }
+  printf("Fork: at frame %u of %u, %d mismatches\n", split, frames, mismatches);
+  for (Machine *machine : {parent, parentReplay, child, childReplay}) {
+    delete machine;
+  }
+  return mismatches == 0;
+}
+
+// serves an instance from a child process and drives it through
+// IpcClient: step, input and queries, each checked against a GymEnv
+// here, then IPC_QUIT
+bool verifyIpc(uint8_t *romData, const string &name, uint32_t frames) {
+  IpcServer server(name);
+  if (!server.open(romData)) return false;
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    server.serve();
+    _exit(0);
+  }
+  if (pid < 0) {
+    printf("%s: Could not start the server\n", name.c_str());
+    return false;
+  }
+  IpcClient client;
+  if (!client.connect(name)) {
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return false;
+  }
+  GymEnv reference(romData);
+  int mismatches = 0;
+  IpcMessage response = client.call(IPC_RESET);
+  GymObservation expected = reference.reset();
+  for (uint32_t frame = 0; frame < frames && mismatches == 0; frame += 2) {
+    uint8_t action = uint8_t(frame * 0x35);
+    response = client.call(IPC_STEP, action, 2);
+    expected = reference.step(action, 2);
+    Machine *machine = reference.getMachine();
+    if (response.status != IPC_OK || response.frame != expected.frame || response.done != expected.done) {
+      printf("Frame %u: step answered frame %lu, expected %lu\n", frame, response.frame, expected.frame);
+      mismatches++;
+    } else if (memcmp(client.getFramebuffer(), expected.framebuffer, SCREEN_WIDTH * SCREEN_HEIGHT) != 0 ||
+        (expected.colorFramebuffer && memcmp(client.getColorFramebuffer(), expected.colorFramebuffer,
+            SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(uint16_t)) != 0)) {
+      printf("Frame %u: framebuffer differs\n", frame);
+      mismatches++;
+    } else if (client.call(IPC_READ, 0, 0xFF80).value != machine->mmu.peekByte(0xFF80)) {
+      printf("Frame %u: HRAM differs\n", frame);
+      mismatches++;
+    }
+    // input alone, seen by the next hash
+    client.call(IPC_INPUT, uint8_t(~action));
+    machine->gameboy.setJoypad(uint8_t(~action));
+    response = client.call(IPC_HASH);
+    if (mismatches == 0 && response.value != machine->gameboy.hashState()) {
+      printf("Frame %u: state hash %016lX, expected %016lX\n", frame, response.value,
+          machine->gameboy.hashState());
+      mismatches++;
+    }
+  }
+  client.call(IPC_QUIT);
+  int status = 1;
+  waitpid(pid, &status, 0);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    printf("%s: Server did not quit cleanly\n", name.c_str());
+    mismatches++;
+  }
+  printf("IPC: %u frames, %d mismatches\n", frames, mismatches);
+  return mismatches == 0;
+}
+
 int main(int argc, char **argv) {
   Host *host = NULL;
   uint8_t *romData = NULL;
+  string moviePath;
+  string recordPath;
+  int farmInstances = 0;
+  int lockstepLanes = 0;
+  int gymInstances = 0;
+  uint32_t farmFrames = 60;
+  string ipcName;
+  int debugMode = DEBUG_NONE;
+  string referencePath;
+  string statsPath;
+  string savePath;
+  string timelinePath;
+  Host *peerHost = NULL;
+  bool linkThreaded = false;
+  bool forkCheck = false;
+  bool ipcCheck = false;
 
   // user input
   if (argc == 1) {
@@ -73,6 +370,135 @@ int main(int argc, char **argv) {
           }
           break;
 
+        case 'r':
+          if (argument.empty()) {
+            printf("-%c: No movie path provided.\n", option);
+            exit(1);
+          }
+          moviePath = argument;
+          break;
+
+        case 'm':
+          if (argument.empty()) {
+            printf("-%c: No movie path provided.\n", option);
+            exit(1);
+          }
+          recordPath = argument;
+          break;
+
+        case 'f':
+          farmInstances = atoi(argument.c_str());
+          if (farmInstances <= 0) {
+            printf("-%c: Invalid instance count.\n", option);
+            exit(1);
+          }
+          break;
+
+        case 'v':
+          lockstepLanes = atoi(argument.c_str());
+          if (lockstepLanes <= 0) {
+            printf("-%c: Invalid lane count.\n", option);
+            exit(1);
+          }
+          break;
+
+        case 'g':
+          gymInstances = atoi(argument.c_str());
+          if (gymInstances <= 0) {
+            printf("-%c: Invalid instance count.\n", option);
+            exit(1);
+          }
+          break;
+
+        case 's':
+          if (argument.empty()) {
+            printf("-%c: No shared memory name provided.\n", option);
+            exit(1);
+          }
+          ipcName = argument;
+          break;
+
+        case 'd':
+          if (argument == "tally") {
+            debugMode = DEBUG_TALLY;
+          } else if (argument == "break") {
+            debugMode = DEBUG_BREAK;
+          } else if (argument == "trace") {
+            debugMode = DEBUG_TRACE;
+          } else if (argument == "profile") {
+            debugMode = DEBUG_PROFILE;
+          } else if (argument == "record") {
+            debugMode = DEBUG_RECORD;
+          } else if (argument == "coverage") {
+            debugMode = DEBUG_COVERAGE;
+          } else {
+            printf("-%c: Expected tally, break, trace, profile, record or coverage.\n", option);
+            exit(1);
+          }
+          break;
+
+        case 'c':
+          if (argument.empty()) {
+            printf("-%c: No reference trace provided.\n", option);
+            exit(1);
+          }
+          debugMode = DEBUG_COMPARE;
+          referencePath = argument;
+          break;
+
+        case 'b':
+          if (argument.empty()) {
+            printf("-%c: No save file path provided.\n", option);
+            exit(1);
+          }
+          savePath = argument;
+          break;
+
+        case 'j':
+          if (argument.empty()) {
+            printf("-%c: No stats path provided.\n", option);
+            exit(1);
+          }
+          statsPath = argument;
+          break;
+
+        case 'l':
+#ifdef GBEMU_TIMELINE
+          if (argument.empty()) {
+            printf("-%c: No timeline path provided.\n", option);
+            exit(1);
+          }
+          timelinePath = argument;
+          break;
+#else
+          printf("-%c: Built without GBEMU_TIMELINE.\n", option);
+          exit(1);
+#endif
+
+        case 'k':
+          if (argument.empty()) {
+            printf("-%c: No peer ROM path provided.\n", option);
+            exit(1);
+          }
+          peerHost = new Host(argument);
+          break;
+
+        case 'p':
+          linkThreaded = true;
+          break;
+
+        case 'o':
+          forkCheck = true;
+          break;
+
+        case 'x':
+          ipcCheck = true;
+          break;
+
+        case 'n':
+          farmFrames = atoi(argument.c_str());
+          break;
+
         case 't':
           runCpuIndividualTests
         (host, romData);
@@ -86,16 +512,126 @@ int main(int argc, char **argv) {
       }
     }
   }
+  // a movie starts from its own snapshot, which would overwrite the save
+  if (!moviePath.empty() && !savePath.empty()) {
+    printf("-b: Can not be combined with a movie replay.\n");
+    exit(1);
+  }
+  if (!moviePath.empty() && !recordPath.empty()) {
+    printf("-m: Can not be combined with a movie replay.\n");
+    exit(1);
+  }
 
+  if (!timelinePath.empty()) {
+    Timeline::start();
+    TIMELINE_THREAD("main");
+  }
   if (host->loadFileOnArgument()) {
     romData = host->getRomData();
-    // init modules
-    Cpu *cpu = new Cpu();
-    Mmu *mmu = new Mmu(romData);
-    // // init system
-    Gameboy *gameboy = new Gameboy(cpu, mmu);
-    gameboy->start();
+    if (farmInstances > 0) {
+      Farm farm(romData, farmInstances);
+      if (debugMode == DEBUG_COVERAGE) farm.enableCoverage();
+      if (!savePath.empty()) farm.openSaveFiles(savePath);
+      farm.runFrames(farmFrames);
+      farm.printStats();
+      if (debugMode == DEBUG_COVERAGE) {
+        Coverage coverage;
+        farm.mergeCoverage(coverage);
+        coverage.mergeFile(COVERAGE_PATH);
+        coverage.save(COVERAGE_PATH);
+        coverage.printSummary();
+      }
+      if (!timelinePath.empty()) Timeline::write(timelinePath);
+      delete host;
+      return 0;
+    }
+    if (lockstepLanes > 0) {
+      int status = verifyLockstep(romData, lockstepLanes, farmFrames) ? 0 : 1;
+      delete host;
+      return status;
+    }
+    if (gymInstances > 0) {
+      int status = verifyGym(romData, gymInstances, farmFrames) ? 0 : 1;
+      delete host;
+      return status;
+    }
+    if (forkCheck) {
+      int status = verifyFork(romData, farmFrames) ? 0 : 1;
+      delete host;
+      return status;
+    }
+    if (peerHost != NULL) {
+      // two instances on a link cable, -n frames each
+      int status = 1;
+      if (peerHost->loadFileOnArgument()) {
+        Machine *first = new Machine(romData);
+        Machine *second = new Machine(peerHost->getRomData());
+        LinkCable *cable = new LinkCable(&first->gameboy, &second->gameboy);
+        uint64_t cycles = uint64_t(farmFrames) * CYCLES_PER_FRAME;
+        if (linkThreaded) {
+          cable->runThreaded(cycles);
+        } else {
+          cable->run(cycles);
+        }
+        cable->printStats();
+        // gbromgen ROMs leave their result in HRAM
+        printf("Results: %02X %02X\n", first->mmu.readByte(0xFF80), second->mmu.readByte(0xFF80));
+        delete cable;
+        delete first;
+        delete second;
+        status = 0;
+      }
+      if (!timelinePath.empty()) Timeline::write(timelinePath);
+      delete peerHost;
+      delete host;
+      return status;
+    }
+    if (!ipcName.empty() && ipcCheck) {
+      int status = verifyIpc(romData, ipcName, farmFrames) ? 0 : 1;
+      delete host;
+      return status;
+    }
+    if (!ipcName.empty()) {
+      // driven by an external controller until it sends IPC_QUIT
+      IpcServer server(ipcName);
+      int status = server.open(romData) ? 0 : 1;
+      if (status == 0) server.serve();
+      delete host;
+      return status;
+    }
+    // init system
+    Machine *machine = new Machine(romData);
+    int status = 0;
+    if (!statsPath.empty()) machine->gameboy.openStats(statsPath);
+    if (!savePath.empty()) machine->gameboy.openSaveFile(savePath);
+    if (!recordPath.empty()) {
+      // headless recording of -n frames
+      if (!recordMovie(machine, fnv1a(romData, host->getRomSize()), recordPath, farmFrames)) status = 1;
+    } else if (!moviePath.empty()) {
+      // headless replay, runs unthrottled
+      Movie movie(&machine->gameboy);
+      Debug *debug = NULL;
+      if (debugMode == DEBUG_COVERAGE) {
+        debug = new Debug(&machine->cpu, &machine->mmu);
+        debug->coverage.start();
+        movie.setDebug(debug);
+      }
+      if (!movie.load(moviePath) || !movie.replay(fnv1a(romData, host->getRomSize()))) {
+        status = 1;
+      }
+      if (debug != NULL) {
+        debug->endDebug(machine->gameboy.getCounters());
+        delete debug;
+      }
+    } else {
+      machine->gameboy.start(debugMode, referencePath);
+    }
+    delete machine;
+    if (!timelinePath.empty()) Timeline::write(timelinePath);
+    delete host;
+    return status;
   }
 
+  delete host;
   return 0;
 }
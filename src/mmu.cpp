@@ -17,47 +17,181 @@
  */
 
 #include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <cstdio>
+#include <new>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "include/mmu.hpp"
 
-Mmu::Mmu(uint8_t *romData) {
-  this->romData = romData;
+static const uint8_t noWatchedPages[WATCH_PAGE_COUNT] = {};
+// by the header's RAM size code, 2KB parts get a full bank
+static const uint32_t CART_RAM_SIZES[] = {0, ERAM_SIZE, ERAM_SIZE, 4 * ERAM_SIZE, 16 * ERAM_SIZE, 8 * ERAM_SIZE};
+
+static CartRam *newCartRam(uint32_t size) {
+  CartRam *ram = new CartRam();
+  ram->refs = 1;
+  ram->data = size ? new uint8_t[size]() : nullptr;
+  ram->size = size;
+  ram->mapped = false;
+  ram->external = false;
+  ram->dirty = false;
+  return ram;
+}
+
+// storage, if given, holds MMU_PAGE_COUNT pages owned by the caller
+Mmu::Mmu(uint8_t *romData, MemoryPage *storage) {
+  currentTCycle = nullptr;
+  cartRam = nullptr;
+  setRom(romData);
+  clearIo();
+  watcher = nullptr;
+  busLocked = false;
+  watchedPages = noWatchedPages;
+  memset(&counters, 0, sizeof(counters));
+  for (int i = 0; i < MMU_PAGE_COUNT; i++) {
+    MemoryPage *page = storage ? new (&storage[i]) MemoryPage() : new MemoryPage();
+    page->refs = 1;
+    page->external = (storage != nullptr);
+    memset(page->data, 0, MMU_PAGE_SIZE);
+    pages[i] = page;
+  }
+  mapCgbBanks();
+}
+// shares every page of parent copy-on-write
+Mmu::Mmu(Mmu *parent) {
+  currentTCycle = parent->currentTCycle;
+  this->romData = parent->romData;
+  this->joypad = parent->joypad;
+  interrupts = parent->interrupts;
+  romBanks = parent->romBanks;
+  mbc = parent->mbc;
+  cgb = parent->cgb;
+  bankLow = parent->bankLow;
+  bankHigh = parent->bankHigh;
+  bankMode = parent->bankMode;
+  ramEnabled = parent->ramEnabled;
+  battery = parent->battery;
+  // a save file stays with its owner, the fork starts from a copy
+  if (parent->cartRam->mapped) {
+    cartRam = newCartRam(parent->cartRam->size);
+    memcpy(cartRam->data, parent->cartRam->data, cartRam->size);
+  } else {
+    cartRam = parent->cartRam;
+    cartRam->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+  mapBanks();
+  clearIo();
+  watcher = nullptr;
+  busLocked = false;
+  watchedPages = noWatchedPages;
+  memset(&counters, 0, sizeof(counters));
+  for (int i = 0; i < MMU_PAGE_COUNT; i++) {
+    pages[i] = parent->pages[i];
+    pages[i]->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+  vramPage = parent->vramPage;
+  wramPage = parent->wramPage;
+}
+Mmu::~Mmu() {
+  for (int i = 0; i < MMU_PAGE_COUNT; i++) {
+    releasePage(pages[i]);
+  }
+  releaseCartRam(cartRam);
+}
+void Mmu::releasePage(MemoryPage *page) {
+  if (page->refs.fetch_sub(1, std::memory_order_acq_rel) == 1 && !page->external) {
+    delete page;
+  }
+}
+// a page only we reference can not become shared behind our back, since
+// sharing requires a reference
+uint8_t *Mmu::writablePage(int index) {
+  MemoryPage *page = pages[index];
+  if (page->refs.load(std::memory_order_acquire) != 1) {
+    MemoryPage *copy = new MemoryPage();
+    copy->refs = 1;
+    copy->external = false;
+    memcpy(copy->data, page->data, MMU_PAGE_SIZE);
+    releasePage(page);
+    pages[index] = page = copy;
+  }
+  return page->data;
+}
+// the last reference to a save file flushes it
+void Mmu::releaseCartRam(CartRam *ram) {
+  if (ram->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+  if (ram->mapped) {
+    msync(ram->data, ram->size, MS_SYNC);
+    munmap(ram->data, ram->size);
+  } else if (!ram->external) {
+    delete[] ram->data;
+  }
+  delete ram;
+}
+// mapped RAM is never shared, see the fork constructor
+uint8_t *Mmu::writableCartRam() {
+  CartRam *ram = cartRam;
+  if (ram->refs.load(std::memory_order_acquire) != 1) {
+    CartRam *copy = newCartRam(ram->size);
+    memcpy(copy->data, ram->data, ram->size);
+    releaseCartRam(ram);
+    cartRam = ram = copy;
+  }
+  ram->dirty = true;
+  return ram->data;
 }
 
 uint8_t Mmu::readByte(uint16_t addr) {
+  uint8_t memoryByte = peekByte(addr);
+  counters.reads[statsRegion(addr)]++;
+  uint8_t watch = watchedPages[addr >> WATCH_PAGE_SHIFT];
+  if (watch & (WATCH_READ | WATCH_BUS)) {
+    if (watch & WATCH_BUS) memoryByte = 0xFF;
+    if (watch & WATCH_READ) watcher->onRead(addr, memoryByte);
+  }
+  return memoryByte;
+}
+uint8_t Mmu::peekByte(uint16_t addr) {
   uint8_t memoryByte = 0;
   uint16_t addrSection = (addr & 0xF000);
+  uint16_t pageAddr = (addr & (MMU_PAGE_SIZE - 1));
+  int bank = (addr >> 12) & 1;
   switch (addrSection) {
     //  ROM Bank 00 (16kB)
     case 0x0000:
     case 0x1000:
     case 0x2000:
     case 0x3000:
-      memoryByte = romData[addr & 0x7FFF];
+      memoryByte = romBank0Data[addr];
       break;
     //  ROM Bank 01-NN (16kB)
     case 0x4000:
     case 0x5000:
     case 0x6000:
     case 0x7000:
-      memoryByte = romData[addr & 0x7FFF];
+      memoryByte = romBankData[addr - ROM_BANK_SIZE];
       break;
-      //  Video RAM (8kB)
+      //  Video RAM (8kB), banked on CGB
     case 0x8000:
     case 0x9000:
-      memoryByte = vram[addr & (VRAM_SIZE - 1)];
+      memoryByte = pages[vramPage + bank]->data[pageAddr];
       break;
       //  External RAM (8kB)
     case 0xA000:
     case 0xB000:
-      memoryByte = eram[addr & (ERAM_SIZE - 1)];
+      memoryByte = eramMapped ? cartRam->data[eramOffset + (addr - 0xA000)] : 0xFF;
       break;
       //  Work RAM (4kB)
     case 0xC000:
-      memoryByte = wram[addr & (WRAM_SIZE - 1)];
+      memoryByte = pages[PAGE_WRAM0]->data[pageAddr];
       break;
-      //  Work RAM (4kB)
+      //  Work RAM (4kB), banked on CGB
     case 0xD000:
-      memoryByte = wram[addr & (WRAM_SIZE - 1)];
+      memoryByte = pages[wramPage]->data[pageAddr];
       break;
     case 0xE000:
     case 0xF000: {
@@ -78,12 +212,12 @@ uint8_t Mmu::readByte(uint16_t addr) {
         case 0x0B00:
         case 0x0C00:
         case 0x0D00:
-          memoryByte = wram[addr & (WRAM_SIZE - 1)];
+          memoryByte = pages[bank ? wramPage : PAGE_WRAM0]->data[pageAddr];
           break;
         // Sprite Attribute (OAM)
         case 0x0E00:
           if (addr < 0xFEA0) {
-            memoryByte = oam[addr & (OAM_SIZE - 1)];
+            memoryByte = pages[PAGE_HIGH]->data[addr & (HIGH_AREA_SIZE - 1)];
           } else {
             // Unusable map
             memoryByte = 0;
@@ -91,11 +225,15 @@ uint8_t Mmu::readByte(uint16_t addr) {
           break;
         case 0x0F00:
           if (addr < 0xFF80) {
-            // IO todo
-            memoryByte = iomap[addr & (IOMAP_SIZE - 1)];
+            IoDevice *device = ioReaders[addr & (IOMAP_SIZE - 1)];
+            if (device) {
+              memoryByte = device->readRegister(addr);
+            } else {
+              memoryByte = pages[PAGE_HIGH]->data[addr & (HIGH_AREA_SIZE - 1)];
+            }
           } else {
-            uint8_t hramAddr = (addr & 0xFF) - 0x80;
-            memoryByte = hram[hramAddr];
+            // HRAM and IE
+            memoryByte = pages[PAGE_HIGH]->data[addr & (HIGH_AREA_SIZE - 1)];
           }
           break;
       }
@@ -104,37 +242,45 @@ uint8_t Mmu::readByte(uint16_t addr) {
   return memoryByte;
 }
 void Mmu::writeByte(uint16_t addr, uint8_t value) {
+  counters.writes[statsRegion(addr)]++;
+  uint8_t watch = watchedPages[addr >> WATCH_PAGE_SHIFT];
+  if (watch & (WATCH_WRITE | WATCH_BUS)) {
+    if (watch & WATCH_BUS) return;
+    watcher->onWrite(addr, value);
+  }
   uint16_t addrSection = (addr & 0xF000);
+  uint16_t pageAddr = (addr & (MMU_PAGE_SIZE - 1));
+  int bank = (addr >> 12) & 1;
   switch (addrSection) {
     //  ROM Bank 00 (16kB)
     case 0x0000:
     case 0x1000:
     case 0x2000:
     case 0x3000:
-      break;
     //  ROM Bank 01-NN (16kB)
     case 0x4000:
     case 0x5000:
     case 0x6000:
     case 0x7000:
+      writeMbc(addr, value);
       break;
-      //  Video RAM (8kB)
+      //  Video RAM (8kB), banked on CGB
     case 0x8000:
     case 0x9000:
-      vram[addr & (VRAM_SIZE - 1)] = value;
+      writablePage(vramPage + bank)[pageAddr] = value;
       break;
       //  External RAM (8kB)
     case 0xA000:
     case 0xB000:
-      eram[addr & (ERAM_SIZE - 1)] = value;
+      if (eramMapped) writableCartRam()[eramOffset + (addr - 0xA000)] = value;
       break;
       //  Work RAM (4kB)
     case 0xC000:
-      wram[addr & (WRAM_SIZE - 1)] = value;
+      writablePage(PAGE_WRAM0)[pageAddr] = value;
       break;
-      //  Work RAM (4kB)
+      //  Work RAM (4kB), banked on CGB
     case 0xD000:
-      wram[addr & (WRAM_SIZE - 1)] = value;
+      writablePage(wramPage)[pageAddr] = value;
       break;
     case 0xE000:
     case 0xF000: {
@@ -155,42 +301,431 @@ void Mmu::writeByte(uint16_t addr, uint8_t value) {
         case 0x0B00:
         case 0x0C00:
         case 0x0D00:
-          wram[addr & (WRAM_SIZE - 1)] = value;
+          writablePage(bank ? wramPage : PAGE_WRAM0)[pageAddr] = value;
           break;
         // Sprite Attribute (OAM)
         case 0x0E00:
           if (addr < 0xFEA0) {
-            oam[addr & (OAM_SIZE - 1)] = value;
+            if (oamWriter) {
+              oamWriter->writeRegister(addr, value);
+            } else {
+              writablePage(PAGE_HIGH)[addr & (HIGH_AREA_SIZE - 1)] = value;
+            }
           } else {
             // Unusable map
           }
           break;
         case 0x0F00:
           if (addr < 0xFF80) {
-            switch(addr) {
-                // todo: stop execution
-                case 0xFF04:
-                    iomap[addr & (IOMAP_SIZE - 1)] = 0;
-                    break;
-                default:
-                    iomap[addr & (IOMAP_SIZE - 1)] = value;
+            IoDevice *device = ioWriters[addr & (IOMAP_SIZE - 1)];
+            if (device) {
+              device->writeRegister(addr, value);
+            } else {
+              writablePage(PAGE_HIGH)[addr & (HIGH_AREA_SIZE - 1)] = value;
             }
           } else {
-            uint8_t hramAddr = (addr & 0xFF) - 0x80;
-            hram[hramAddr] = value;
+            // HRAM and IE
+            writablePage(PAGE_HIGH)[addr & (HIGH_AREA_SIZE - 1)] = value;
+            if (addr == IE_ADDR) updateInterrupts();
           }
           break;
       }
     } break;
   }
 }
-void Mmu::writeDiv(uint8_t value) {
-    iomap[0xFF04 & (IOMAP_SIZE - 1)] = value;
+uint8_t Mmu::readIo(uint16_t addr) {
+  return pages[PAGE_HIGH]->data[addr & (HIGH_AREA_SIZE - 1)];
+}
+void Mmu::writeIo(uint16_t addr, uint8_t value) {
+  writablePage(PAGE_HIGH)[addr & (HIGH_AREA_SIZE - 1)] = value;
+  if (addr == IF_ADDR || addr == IE_ADDR) updateInterrupts();
+}
+void Mmu::requestInterrupt(uint8_t sources) {
+  writeIo(IF_ADDR, readIo(IF_ADDR) | sources);
+}
+InterruptController &Mmu::getInterrupts() { return interrupts; }
+void Mmu::clearIo() {
+  for (int i = 0; i < IOMAP_SIZE; i++) {
+    ioReaders[i] = nullptr;
+    ioWriters[i] = nullptr;
+  }
+  oamWriter = nullptr;
+  mapIo(P1_ADDR, this, IO_READ | IO_WRITE);
+  mapIo(IF_ADDR, this, IO_WRITE);
+  if (cgb) {
+    mapIo(KEY1_ADDR, this, IO_WRITE);
+    mapIo(VBK_ADDR, this, IO_WRITE);
+    mapIo(SVBK_ADDR, this, IO_WRITE);
+  }
+}
+void Mmu::mapIo(uint16_t addr, IoDevice *device, int access) {
+  if (access & IO_READ) ioReaders[addr & (IOMAP_SIZE - 1)] = device;
+  if (access & IO_WRITE) ioWriters[addr & (IOMAP_SIZE - 1)] = device;
+}
+void Mmu::mapOam(IoDevice *device) { oamWriter = device; }
+uint8_t Mmu::readRegister(uint16_t addr) {
+  return addr == P1_ADDR ? readJoypad() : readIo(addr);
+}
+void Mmu::writeRegister(uint16_t addr, uint8_t value) {
+  switch (addr) {
+    // only select lines are writable
+    case P1_ADDR:
+      writeIo(addr, value & 0x30);
+      break;
+    // upper bits are unused and read back set
+    case IF_ADDR:
+      writeIo(addr, value | 0xE0);
+      break;
+    // the current speed only changes on STOP
+    case KEY1_ADDR:
+      writeIo(addr, (readIo(addr) & KEY1_DOUBLE_SPEED) | 0x7E | (value & KEY1_PREPARE));
+      break;
+    case VBK_ADDR:
+      writeIo(addr, value | 0xFE);
+      mapCgbBanks();
+      break;
+    case SVBK_ADDR:
+      writeIo(addr, value | 0xF8);
+      mapCgbBanks();
+      break;
+  }
+}
+// the bank registers as stored in IO memory select the pages, bank 0
+// of SVBK maps bank 1
+void Mmu::mapCgbBanks() {
+  if (!cgb) {
+    vramPage = PAGE_VRAM0;
+    wramPage = PAGE_WRAM1;
+    return;
+  }
+  vramPage = (readIo(VBK_ADDR) & 0x01) ? PAGE_VRAM2 : PAGE_VRAM0;
+  int bank = readIo(SVBK_ADDR) & 0x07;
+  wramPage = bank <= 1 ? PAGE_WRAM1 : PAGE_WRAM2 + bank - 2;
+}
+void Mmu::updateInterrupts() {
+  interrupts.setRegisters(readIo(IF_ADDR), readIo(IE_ADDR));
+}
+// valid until the next write to the page
+const uint8_t *Mmu::getPage(int index) {
+  return pages[index]->data;
 }
 uint16_t Mmu::readShort(uint16_t addr) {
   return (readByte(addr + 1) << 8) + readByte(addr);
 }
 void Mmu::setRom(uint8_t *romData) {
-    //std::copy(romData, romData + ROM_SIZE, this->romData);
-    this->romData = romData;
+  this->romData = romData;
+  cgb = romData[CART_CGB_ADDR] & 0x80;
+  uint8_t type = romData[CART_TYPE_ADDR];
+  if (type >= 0x01 && type <= 0x03) {
+    mbc = MBC_1;
+  } else if (type >= 0x0F && type <= 0x13) {
+    mbc = MBC_3;
+  } else if (type >= 0x19 && type <= 0x1E) {
+    mbc = MBC_5;
+  } else {
+    mbc = MBC_NONE;
+  }
+  uint8_t sizeCode = romData[CART_ROM_SIZE_ADDR];
+  romBanks = sizeCode <= 8 ? 2 << sizeCode : 2;
+  bankLow = 1;
+  bankHigh = 0;
+  bankMode = false;
+  ramEnabled = false;
+  battery = (type == 0x03 || type == 0x06 || type == 0x09 || type == 0x0D || type == 0x0F ||
+      type == 0x10 || type == 0x13 || type == 0x1B || type == 0x1E || type == 0xFF);
+  uint8_t ramCode = romData[CART_RAM_SIZE_ADDR];
+  if (cartRam) releaseCartRam(cartRam);
+  cartRam = newCartRam(ramCode < 6 ? CART_RAM_SIZES[ramCode] : 0);
+  mapBanks();
+}
+// ROM writes are bank register writes, 0x0000-0x1FFF enables RAM
+void Mmu::writeMbc(uint16_t addr, uint8_t value) {
+  uint16_t oldBank = romBank;
+  if (addr < 0x2000) {
+    if (mbc == MBC_NONE) return;
+    ramEnabled = (value & 0x0F) == 0x0A;
+    mapBanks();
+    return;
+  }
+  switch (mbc) {
+    case MBC_1:
+      if (addr >= 0x2000 && addr < 0x4000) {
+        bankLow = value & 0x1F;
+      } else if (addr >= 0x4000 && addr < 0x6000) {
+        bankHigh = value & 0x03;
+      } else if (addr >= 0x6000) {
+        bankMode = value & 0x01;
+      }
+      break;
+    case MBC_3:
+      if (addr >= 0x2000 && addr < 0x4000) {
+        bankLow = value & 0x7F;
+      } else if (addr >= 0x4000 && addr < 0x6000) {
+        // ram bank or rtc register select
+        bankHigh = value;
+      }
+      break;
+    case MBC_5:
+      if (addr >= 0x2000 && addr < 0x3000) {
+        bankLow = (bankLow & 0x100) | value;
+      } else if (addr >= 0x3000 && addr < 0x4000) {
+        bankLow = (bankLow & 0xFF) | ((value & 0x01) << 8);
+      } else if (addr >= 0x4000 && addr < 0x6000) {
+        bankHigh = value & 0x0F;
+      }
+      break;
+    default:
+      return;
+  }
+  mapBanks();
+  if (romBank != oldBank) counters.bankSwitches++;
+}
+void Mmu::mapBanks() {
+  uint32_t bank = bankLow;
+  romBank0 = 0;
+  switch (mbc) {
+    case MBC_1:
+      // bank 0 of the low register selects bank 1, upper bits included
+      if ((bank & 0x1F) == 0) bank |= 1;
+      bank |= bankHigh << 5;
+      if (bankMode) romBank0 = (bankHigh << 5) & (romBanks - 1);
+      break;
+    case MBC_3:
+      if (bank == 0) bank = 1;
+      break;
+    case MBC_5:
+      break;
+    default:
+      bank = 1;
+  }
+  romBank = bank & (romBanks - 1);
+  romBankData = romData + size_t(romBank) * ROM_BANK_SIZE;
+  romBank0Data = romData + size_t(romBank0) * ROM_BANK_SIZE;
+  // MBC1 banks RAM in mode 1 only, MBC3 banks 8-C are its clock, which
+  // is not modelled. Carts without an MBC have their RAM always on.
+  uint32_t ramBank = 0;
+  bool enabled = ramEnabled || mbc == MBC_NONE;
+  switch (mbc) {
+    case MBC_1:
+      if (bankMode) ramBank = bankHigh & 0x03;
+      break;
+    case MBC_3:
+      if (bankHigh > 0x03) enabled = false;
+      ramBank = bankHigh & 0x03;
+      break;
+    case MBC_5:
+      ramBank = bankHigh & 0x0F;
+      break;
+  }
+  eramMapped = enabled && cartRam->size > 0;
+  eramOffset = eramMapped ? (ramBank * ERAM_SIZE) & (cartRam->size - 1) : 0;
+}
+void Mmu::setJoypad(uint8_t buttons) {
+  // raised when any button goes down, whatever the select lines
+  if (buttons & ~joypad) requestInterrupt(INTERRUPT_JOYPAD);
+  joypad = buttons;
+}
+// nullptr detaches
+void Mmu::setWatcher(MemoryWatcher *watcher) {
+  this->watcher = watcher;
+  updateWatchedPages();
+}
+// locking swaps the page flags instead of adding a check per access
+void Mmu::lockBus(bool locked) {
+  busLocked = locked;
+  updateWatchedPages();
+}
+bool Mmu::isBusLocked() { return busLocked; }
+bool Mmu::hasWatcher() { return watcher != nullptr; }
+void Mmu::countFetches(uint32_t count) { counters.reads[STATS_ROM] += count; }
+void Mmu::updateWatchedPages() {
+  const uint8_t *flags = watcher ? watcher->getWatchedPages() : noWatchedPages;
+  if (!busLocked) {
+    watchedPages = flags;
+    return;
+  }
+  for (int i = 0; i < WATCH_PAGE_COUNT; i++) {
+    lockedPages[i] = flags[i] | (i < (0xFF00 >> WATCH_PAGE_SHIFT) ? WATCH_BUS : 0);
+  }
+  watchedPages = lockedPages;
+}
+// backing memory of addr, valid up to the end of its 4K page (or of
+// the high area), echo RAM resolves to WRAM and unmapped cartridge RAM
+// to nullptr
+const uint8_t *Mmu::readPointer(uint16_t addr) {
+  if (addr >= 0xE000 && addr < 0xFE00) addr -= 0x2000;
+  uint16_t pageAddr = addr & (MMU_PAGE_SIZE - 1);
+  int bank = (addr >> 12) & 1;
+  switch (addr >> 13) {
+    case 0:
+    case 1:
+      return romBank0Data + addr;
+    case 2:
+    case 3:
+      return romBankData + (addr - ROM_BANK_SIZE);
+    case 4:
+      return pages[vramPage + bank]->data + pageAddr;
+    case 5:
+      return eramMapped ? cartRam->data + eramOffset + (addr - 0xA000) : nullptr;
+    case 6:
+      return pages[bank ? wramPage : PAGE_WRAM0]->data + pageAddr;
+    default:
+      return pages[PAGE_HIGH]->data + (addr & (HIGH_AREA_SIZE - 1));
+  }
+}
+uint8_t *Mmu::writablePointer(uint16_t addr) {
+  if (addr >= 0xE000 && addr < 0xFE00) addr -= 0x2000;
+  uint16_t pageAddr = addr & (MMU_PAGE_SIZE - 1);
+  int bank = (addr >> 12) & 1;
+  switch (addr >> 13) {
+    case 4:
+      return writablePage(vramPage + bank) + pageAddr;
+    case 5:
+      return eramMapped ? writableCartRam() + eramOffset + (addr - 0xA000) : nullptr;
+    case 6:
+      return writablePage(bank ? wramPage : PAGE_WRAM0) + pageAddr;
+    case 7:
+      return writablePage(PAGE_HIGH) + (addr & (HIGH_AREA_SIZE - 1));
+    default:
+      // ROM
+      return nullptr;
+  }
+}
+// one memcpy per run of source and destination within a page
+void Mmu::copyBlock(uint16_t dest, uint16_t source, uint16_t length) {
+  while (length > 0) {
+    uint16_t run = length;
+    uint16_t sourceLeft = MMU_PAGE_SIZE - (source & (MMU_PAGE_SIZE - 1));
+    uint16_t destLeft = MMU_PAGE_SIZE - (dest & (MMU_PAGE_SIZE - 1));
+    if (run > sourceLeft) run = sourceLeft;
+    if (run > destLeft) run = destLeft;
+    uint8_t *to = writablePointer(dest);
+    const uint8_t *from = readPointer(source);
+    if (to && from) {
+      memcpy(to, from, run);
+    } else if (to) {
+      memset(to, 0xFF, run);
+    }
+    dest += run;
+    source += run;
+    length -= run;
+  }
+}
+int Mmu::getRomBank() { return romBank; }
+int Mmu::getWramPage() { return wramPage; }
+int Mmu::getRomBank0() { return romBank0; }
+int Mmu::getRomBankCount() { return romBanks; }
+int Mmu::getMbc() { return mbc; }
+bool Mmu::isCgb() { return cgb; }
+bool Mmu::openSaveFile(const char *path) {
+  uint32_t size = cartRam->size;
+  if (!battery || size == 0) {
+    printf("%s: Cartridge has no battery backed RAM\n", path);
+    return false;
+  }
+  int fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    printf("%s: Could not open save file\n", path);
+    return false;
+  }
+  // a new or short file grows to the RAM size, the tail reads as zero
+  struct stat info;
+  if (fstat(fd, &info) != 0 || (info.st_size < off_t(size) && ftruncate(fd, size) != 0)) {
+    printf("%s: Could not size save file\n", path);
+    close(fd);
+    return false;
+  }
+  void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    printf("%s: Could not map save file\n", path);
+    return false;
+  }
+  releaseCartRam(cartRam);
+  cartRam = newCartRam(0);
+  cartRam->data = static_cast<uint8_t*>(data);
+  cartRam->size = size;
+  cartRam->mapped = true;
+  return true;
+}
+bool Mmu::hasSaveFile() { return cartRam->mapped; }
+bool Mmu::attachCartRam(uint8_t *storage, uint32_t capacity) {
+  uint32_t size = cartRam->size;
+  if (size > capacity) {
+    printf("Cartridge RAM does not fit into %u bytes\n", capacity);
+    return false;
+  }
+  if (size) memcpy(storage, cartRam->data, size);
+  releaseCartRam(cartRam);
+  cartRam = newCartRam(0);
+  cartRam->data = storage;
+  cartRam->size = size;
+  cartRam->external = true;
+  return true;
+}
+uint32_t Mmu::getCartRamSize() { return cartRam->size; }
+void Mmu::syncSaveFile(bool wait) {
+  if (!cartRam->mapped || !cartRam->dirty) return;
+  msync(cartRam->data, cartRam->size, wait ? MS_SYNC : MS_ASYNC);
+  cartRam->dirty = false;
+}
+const MemoryCounters &Mmu::getCounters() { return counters; }
+uint8_t Mmu::readJoypad() {
+  // lines are active low
+  uint8_t select = pages[PAGE_HIGH]->data[P1_ADDR & (HIGH_AREA_SIZE - 1)] & 0x30;
+  uint8_t pressed = 0;
+  if (!(select & 0x10)) pressed |= (joypad & 0x0F);
+  if (!(select & 0x20)) pressed |= (joypad >> 4);
+  return 0xC0 | select | (~pressed & 0x0F);
+}
+void Mmu::saveState(std::vector<uint8_t> &state) {
+  for (int i = 0; i < PAGE_HIGH; i++) {
+    state.insert(state.end(), pages[i]->data, pages[i]->data + MMU_PAGE_SIZE);
+  }
+  state.insert(state.end(), pages[PAGE_HIGH]->data, pages[PAGE_HIGH]->data + HIGH_AREA_SIZE);
+  state.push_back(joypad);
+  uint8_t banks[] = {uint8_t(bankLow), uint8_t(bankLow >> 8), bankHigh, bankMode, ramEnabled};
+  state.insert(state.end(), banks, banks + sizeof(banks));
+  if (cartRam->size) state.insert(state.end(), cartRam->data, cartRam->data + cartRam->size);
+  interrupts.saveState(state);
+  if (cgb) {
+    for (int i = PAGE_HIGH + 1; i < MMU_PAGE_COUNT; i++) {
+      state.insert(state.end(), pages[i]->data, pages[i]->data + MMU_PAGE_SIZE);
+    }
+  }
+}
+const uint8_t *Mmu::loadState(const uint8_t *state) {
+  for (int i = 0; i < PAGE_HIGH; i++) {
+    std::copy(state, state + MMU_PAGE_SIZE, writablePage(i));
+    state += MMU_PAGE_SIZE;
+  }
+  std::copy(state, state + HIGH_AREA_SIZE, writablePage(PAGE_HIGH));
+  state += HIGH_AREA_SIZE;
+  joypad = *state++;
+  bankLow = state[0] | (state[1] << 8);
+  bankHigh = state[2];
+  bankMode = state[3];
+  ramEnabled = state[4];
+  state += 5;
+  if (cartRam->size) {
+    // snapshots never write through to a save file, it is detached
+    if (cartRam->mapped) {
+      uint32_t size = cartRam->size;
+      releaseCartRam(cartRam);
+      cartRam = newCartRam(size);
+    }
+    std::copy(state, state + cartRam->size, writableCartRam());
+    state += cartRam->size;
+  }
+  mapBanks();
+  state = interrupts.loadState(state);
+  updateInterrupts();
+  if (cgb) {
+    for (int i = PAGE_HIGH + 1; i < MMU_PAGE_COUNT; i++) {
+      std::copy(state, state + MMU_PAGE_SIZE, writablePage(i));
+      state += MMU_PAGE_SIZE;
+    }
+  }
+  mapCgbBanks();
+  return state;
 }
@@ -0,0 +1,242 @@
+/*
+ * movie.cpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdint>
+#include <fstream>
+#include "include/movie.hpp"
+
+static void writeInt(std::vector<uint8_t> &out, uint64_t value, int size) {
+    for (int i = 0; i < size; i++) {
+        out.push_back(uint8_t(value >> (i * 8)));
+    }
+}
+
+static void writeVarint(std::vector<uint8_t> &out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(uint8_t(value) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(uint8_t(value));
+}
+
+static bool readInt(const std::vector<uint8_t> &in, size_t &pos, uint64_t &value, int size) {
+    if (pos + size > in.size()) return false;
+    value = 0;
+    for (int i = 0; i < size; i++) {
+        value |= uint64_t(in[pos++]) << (i * 8);
+    }
+    return true;
+}
+
+static bool readVarint(const std::vector<uint8_t> &in, size_t &pos, uint64_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (pos >= in.size()) return false;
+        uint8_t byte = in[pos++];
+        value |= uint64_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+Movie::Movie(Gameboy *gameboy) {
+    this->gameboy = gameboy;
+    romHash = 0;
+    checkpointCycles = uint64_t(MOVIE_CHECKPOINT_FRAMES) * CYCLES_PER_FRAME;
+    nextCheckpoint = 0;
+    recording = false;
+    debug = nullptr;
+}
+
+void Movie::startRecording(uint64_t romHash, uint32_t checkpointFrames) {
+    this->romHash = romHash;
+    checkpointCycles = uint64_t(checkpointFrames) * CYCLES_PER_FRAME;
+    nextCheckpoint = gameboy->getCycles() + checkpointCycles;
+    gameboy->saveState(initialState);
+    events.clear();
+    recording = true;
+}
+
+void Movie::setInput(uint8_t buttons) {
+    gameboy->setJoypad(buttons);
+    if (recording) {
+        events.push_back({MOVIE_EVENT_INPUT, gameboy->getCycles(), buttons});
+    }
+}
+
+template <class Policy>
+void Movie::advanceTo(uint64_t cycle) {
+    while (!gameboy->isHalted() && gameboy->getCycles() < cycle) {
+        Policy::before(debug);
+        Policy::after(debug, gameboy->step());
+        if (recording && gameboy->getCycles() >= nextCheckpoint) {
+            events.push_back({MOVIE_EVENT_CHECKPOINT, gameboy->getCycles(), gameboy->hashState()});
+            nextCheckpoint += checkpointCycles;
+        }
+    }
+}
+
+void Movie::runUntil(uint64_t cycle) {
+    if (debug) {
+        advanceTo<DebugCoverage>(cycle);
+    } else {
+        advanceTo<DebugNone>(cycle);
+    }
+}
+
+void Movie::run(uint64_t cycles) {
+    runUntil(gameboy->getCycles() + cycles);
+}
+
+void Movie::setDebug(Debug *debug) { this->debug = debug; }
+
+void Movie::stopRecording() {
+    if (!recording) return;
+    events.push_back({MOVIE_EVENT_END, gameboy->getCycles(), gameboy->hashState()});
+    recording = false;
+}
+
+bool Movie::save(const std::string &filePath) {
+    std::vector<uint8_t> out;
+    writeInt(out, MOVIE_MAGIC, 4);
+    writeInt(out, MOVIE_VERSION, 4);
+    writeInt(out, romHash, 8);
+    writeInt(out, checkpointCycles, 8);
+    writeInt(out, initialState.size(), 4);
+    out.insert(out.end(), initialState.begin(), initialState.end());
+
+    uint64_t lastCycle = 0;
+    for (auto &event : events) {
+        out.push_back(event.type);
+        writeVarint(out, event.cycle - lastCycle);
+        lastCycle = event.cycle;
+        switch (event.type) {
+            case MOVIE_EVENT_INPUT:
+                out.push_back(uint8_t(event.value));
+                break;
+            case MOVIE_EVENT_CHECKPOINT:
+            case MOVIE_EVENT_END:
+                writeInt(out, event.value, 8);
+                break;
+        }
+    }
+
+    std::ofstream stream(filePath, std::ios::binary | std::ios::out);
+    if (!stream.is_open()) {
+        printf("%s: Could not write movie\n", filePath.c_str());
+        return false;
+    }
+    stream.write(reinterpret_cast<const char*>(out.data()), out.size());
+    stream.close();
+    return true;
+}
+
+bool Movie::load(const std::string &filePath) {
+    std::ifstream stream(filePath, std::ios::binary | std::ios::in);
+    if (!stream.is_open()) {
+        printf("%s: File could not be found\n", filePath.c_str());
+        return false;
+    }
+    std::vector<uint8_t> in((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+    stream.close();
+
+    size_t pos = 0;
+    uint64_t magic, version, stateSize;
+    if (!readInt(in, pos, magic, 4) || magic != MOVIE_MAGIC ||
+            !readInt(in, pos, version, 4) || version != MOVIE_VERSION) {
+        printf("%s: Not a movie file!\n", filePath.c_str());
+        return false;
+    }
+    if (!readInt(in, pos, romHash, 8) || !readInt(in, pos, checkpointCycles, 8) ||
+            !readInt(in, pos, stateSize, 4) || pos + stateSize > in.size()) {
+        printf("%s: Movie header is truncated!\n", filePath.c_str());
+        return false;
+    }
+    initialState.assign(in.begin() + pos, in.begin() + pos + stateSize);
+    pos += stateSize;
+
+    events.clear();
+    uint64_t cycle = 0;
+    while (pos < in.size()) {
+        MovieEvent event = {in[pos++], 0, 0};
+        uint64_t delta;
+        bool valid = readVarint(in, pos, delta);
+        switch (event.type) {
+            case MOVIE_EVENT_INPUT:
+                valid = valid && readInt(in, pos, event.value, 1);
+                break;
+            case MOVIE_EVENT_CHECKPOINT:
+            case MOVIE_EVENT_END:
+                valid = valid && readInt(in, pos, event.value, 8);
+                break;
+            default:
+                valid = false;
+        }
+        if (!valid) {
+            printf("%s: Movie event %zu is invalid!\n", filePath.c_str(), events.size());
+            return false;
+        }
+        cycle += delta;
+        event.cycle = cycle;
+        events.push_back(event);
+    }
+    return true;
+}
+
+// replays the movie as fast as possible and stops at the first checkpoint
+// that does not match, the end event checks the final state
+bool Movie::replay(uint64_t romHash) {
+    if (romHash != this->romHash) {
+        printf("Movie was recorded on a different ROM! (%016lX, expected %016lX)\n",
+                romHash, this->romHash);
+        return false;
+    }
+    if (!gameboy->loadState(initialState)) return false;
+    recording = false;
+    int checkpoints = 0;
+    for (auto &event : events) {
+        runUntil(event.cycle);
+        if (gameboy->getCycles() != event.cycle) {
+            printf("Desync: expected event at cycle %lu, emulation is at %lu\n",
+                    event.cycle, gameboy->getCycles());
+            return false;
+        }
+        switch (event.type) {
+            case MOVIE_EVENT_INPUT:
+                gameboy->setJoypad(event.value);
+                break;
+            case MOVIE_EVENT_CHECKPOINT:
+            case MOVIE_EVENT_END: {
+                uint64_t hash = gameboy->hashState();
+                if (hash != event.value) {
+                    printf("Desync at cycle %lu: state hash %016lX, expected %016lX\n",
+                            event.cycle, hash, event.value);
+                    return false;
+                }
+                if (event.type == MOVIE_EVENT_CHECKPOINT) checkpoints++;
+            } break;
+        }
+    }
+    printf("Movie replayed: %lu cycles, %d checkpoints, final state %016lX\n", gameboy->getCycles(),
+            checkpoints, gameboy->hashState());
+    return true;
+}
+
+uint64_t Movie::getLength() {
+    return events.empty() ? 0 : events.back().cycle;
+}
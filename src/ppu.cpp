@@ -0,0 +1,565 @@
+/*
+ * ppu.cpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdint>
+#include <algorithm>
+#include <chrono>
+#include "include/ppu.hpp"
+#include "include/timeline.hpp"
+
+// mode 2 and mode 3 lengths, mode 0 takes the rest of the line
+#define OAM_SCAN_CYCLES 80
+#define TRANSFER_CYCLES 172
+
+enum PPU_REGISTER {
+    LCDC = 0xFF40,
+    STAT = 0xFF41,
+    SCY = 0xFF42,
+    SCX = 0xFF43,
+    LY = 0xFF44,
+    LYC = 0xFF45,
+    BGP = 0xFF47,
+    OBP0 = 0xFF48,
+    OBP1 = 0xFF49,
+    WY = 0xFF4A,
+    WX = 0xFF4B,
+    BCPS = 0xFF68,
+    BCPD = 0xFF69,
+    OCPS = 0xFF6A,
+    OCPD = 0xFF6B,
+};
+
+Ppu::Ppu(Mmu *mmu) {
+    this->mmu = mmu;
+    cgb = mmu->isCgb();
+    dma = nullptr;
+    rendering = true;
+    frames = renderNs = 0;
+    timed = false;
+    frameMark = 0;
+    framebuffer = ownFramebuffer;
+    colorFramebuffer = nullptr;
+    mmu->mapIo(LCDC, this, IO_WRITE);
+    mmu->mapIo(STAT, this, IO_WRITE);
+    mmu->mapIo(LY, this, IO_WRITE);
+    mmu->mapIo(LYC, this, IO_WRITE);
+    mmu->mapOam(this);
+    if (cgb) {
+        ownColorFramebuffer.resize(SCREEN_WIDTH * SCREEN_HEIGHT);
+        colorFramebuffer = ownColorFramebuffer.data();
+        mmu->mapIo(BCPS, this, IO_WRITE);
+        mmu->mapIo(BCPD, this, IO_READ | IO_WRITE);
+        mmu->mapIo(OCPS, this, IO_WRITE);
+        mmu->mapIo(OCPD, this, IO_READ | IO_WRITE);
+    }
+    reset();
+}
+
+void Ppu::reset() {
+    lineCycles = 0;
+    mode = PPU_MODE_OAM;
+    ly = 0;
+    windowLine = 0;
+    statLine = false;
+    resetSprites();
+    // the boot rom leaves every palette white
+    for (int palette = 0; palette < 2; palette++) {
+        std::fill(paletteRam[palette], paletteRam[palette] + 64, 0xFF);
+        for (int entry = 0; entry < 32; entry++) resolveColor(palette, entry);
+    }
+}
+
+void Ppu::setRendering(bool rendering) { this->rendering = rendering; }
+void Ppu::setDma(Dma *dma) { this->dma = dma; }
+void Ppu::setTimed(bool timed) { this->timed = timed; }
+uint64_t Ppu::getFrames() { return frames; }
+uint64_t Ppu::getRenderNs() { return renderNs; }
+const uint8_t *Ppu::getFramebuffer() { return framebuffer; }
+const uint16_t *Ppu::getColorFramebuffer() { return colorFramebuffer; }
+
+void Ppu::setFramebuffer(uint8_t *shades, uint16_t *colors) {
+    std::copy(framebuffer, framebuffer + SCREEN_WIDTH * SCREEN_HEIGHT, shades);
+    framebuffer = shades;
+    if (cgb) {
+        std::copy(colorFramebuffer, colorFramebuffer + SCREEN_WIDTH * SCREEN_HEIGHT, colors);
+        colorFramebuffer = colors;
+    }
+}
+
+// STAT interrupt fires on the rising edge of any enabled condition
+void Ppu::updateStat() {
+    uint8_t stat = mmu->readIo(STAT);
+    bool coincidence = (ly == mmu->readIo(LYC));
+    stat = (stat & 0xF8) | (coincidence ? 0x04 : 0) | mode;
+    mmu->writeIo(STAT, stat);
+    bool line = (coincidence && (stat & 0x40)) ||
+        (mode == PPU_MODE_HBLANK && (stat & 0x08)) ||
+        (mode == PPU_MODE_VBLANK && (stat & 0x10)) ||
+        (mode == PPU_MODE_OAM && (stat & 0x20));
+    if (line && !statLine) {
+        mmu->requestInterrupt(INTERRUPT_LCDSTAT);
+    }
+    statLine = line;
+}
+
+// entry is a little endian RGB555 color, its shade goes by luminance
+void Ppu::resolveColor(int palette, int entry) {
+    uint16_t color = (paletteRam[palette][entry * 2] | (paletteRam[palette][entry * 2 + 1] << 8)) & 0x7FFF;
+    int r = color & 0x1F;
+    int g = (color >> 5) & 0x1F;
+    int b = (color >> 10) & 0x1F;
+    int luma = (r * 3 + g * 6 + b) / 10;
+    paletteColors[palette][entry] = color;
+    paletteShades[palette][entry] = 3 - (luma >> 3);
+}
+
+// BCPD and OCPD write at the index in BCPS or OCPS, which steps on
+// when its bit 7 is set
+void Ppu::writePalette(int palette, uint16_t indexAddr, uint8_t value) {
+    uint8_t spec = mmu->readIo(indexAddr);
+    int index = spec & 0x3F;
+    paletteRam[palette][index] = value;
+    resolveColor(palette, index / 2);
+    if (spec & 0x80) mmu->writeIo(indexAddr, (spec & 0xC0) | ((index + 1) & 0x3F));
+}
+
+uint8_t Ppu::readRegister(uint16_t addr) {
+    if (addr == BCPD) return paletteRam[0][mmu->readIo(BCPS) & 0x3F];
+    return paletteRam[1][mmu->readIo(OCPS) & 0x3F];
+}
+
+void Ppu::writeRegister(uint16_t addr, uint8_t value) {
+    if (addr < OAM_ADDR + OAM_SIZE) {
+        mmu->writeIo(addr, value);
+        int index = (addr - OAM_ADDR) / 4;
+        if ((addr & 3) == 0 && value != spriteY[index]) {
+            placeSprite(index, false);
+            spriteY[index] = value;
+            placeSprite(index, true);
+        } else if ((addr & 3) == 1 && value != spriteX[index]) {
+            spriteX[index] = value;
+            touchSprite(index);
+        }
+        return;
+    }
+    switch (addr) {
+        // sprite size changes which lines every sprite covers
+        case LCDC:
+            mmu->writeIo(LCDC, value);
+            if (((value & 0x04) ? 16 : 8) != spriteHeight) resetSprites();
+            break;
+        // mode and coincidence bits are read-only
+        case STAT:
+            mmu->writeIo(STAT, (value & 0x78) | (mmu->readIo(STAT) & 0x07));
+            break;
+        // read-only
+        case LY:
+            return;
+        // bit 6 is unused
+        case BCPS:
+        case OCPS:
+            mmu->writeIo(addr, value | 0x40);
+            return;
+        case BCPD:
+            writePalette(0, BCPS, value);
+            return;
+        case OCPD:
+            writePalette(1, OCPS, value);
+            return;
+        default:
+            mmu->writeIo(addr, value);
+    }
+    // a newly enabled or matching condition raises the STAT line
+    if (mmu->readIo(LCDC) & 0x80) updateStat();
+}
+
+void Ppu::setMode(uint8_t mode) {
+    this->mode = mode;
+    updateStat();
+}
+
+void Ppu::setLy(uint8_t ly) {
+    this->ly = ly;
+    mmu->writeIo(LY, ly);
+}
+
+uint32_t Ppu::getQuietCycles(uint8_t enabled, bool hblank) {
+    if (!(mmu->readIo(LCDC) & 0x80)) {
+        return (ly != 0 || mode != PPU_MODE_HBLANK) ? 0 : UINT32_MAX;
+    }
+    if (mode == PPU_MODE_HBLANK && ly == 0 && lineCycles == 0) return 0;
+    // STAT sources are many, take the next change of any kind
+    if ((enabled & INTERRUPT_LCDSTAT) || hblank) {
+        switch (mode) {
+            case PPU_MODE_OAM:
+                return OAM_SCAN_CYCLES - lineCycles;
+            case PPU_MODE_TRANSFER:
+                return OAM_SCAN_CYCLES + TRANSFER_CYCLES - lineCycles;
+            default:
+                return CYCLES_PER_LINE - lineCycles;
+        }
+    }
+    if (enabled & INTERRUPT_VBLANK) {
+        int lines = ly < SCREEN_HEIGHT ? SCREEN_HEIGHT - ly : LINES_PER_FRAME - ly + SCREEN_HEIGHT;
+        return lines * CYCLES_PER_LINE - lineCycles;
+    }
+    return UINT32_MAX;
+}
+
+void Ppu::tick(uint16_t cycles) {
+    if (!(mmu->readIo(LCDC) & 0x80)) {
+        // lcd off, restart from the top once enabled
+        if (ly != 0 || mode != PPU_MODE_HBLANK) {
+            lineCycles = 0;
+            windowLine = 0;
+            setLy(0);
+            setMode(PPU_MODE_HBLANK);
+        }
+        return;
+    }
+    if (mode == PPU_MODE_HBLANK && ly == 0 && lineCycles == 0) {
+        setMode(PPU_MODE_OAM);
+    }
+    lineCycles += cycles;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        switch (mode) {
+            case PPU_MODE_OAM:
+                if (lineCycles >= OAM_SCAN_CYCLES) {
+                    setMode(PPU_MODE_TRANSFER);
+                    changed = true;
+                }
+                break;
+            case PPU_MODE_TRANSFER:
+                if (lineCycles >= OAM_SCAN_CYCLES + TRANSFER_CYCLES) {
+                    if (rendering && timed) {
+                        auto start = std::chrono::steady_clock::now();
+                        renderLine();
+                        renderNs += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                std::chrono::steady_clock::now() - start).count();
+                    } else if (rendering) {
+                        renderLine();
+                    }
+                    setMode(PPU_MODE_HBLANK);
+                    if (dma) dma->hblank();
+                    changed = true;
+                }
+                break;
+            case PPU_MODE_HBLANK:
+                if (lineCycles >= CYCLES_PER_LINE) {
+                    lineCycles -= CYCLES_PER_LINE;
+                    setLy(ly + 1);
+                    if (ly == SCREEN_HEIGHT) {
+                        mmu->requestInterrupt(INTERRUPT_VBLANK);
+                        setMode(PPU_MODE_VBLANK);
+                        frames++;
+                        TIMELINE_MARK("frame", frameMark, frames);
+                    } else {
+                        setMode(PPU_MODE_OAM);
+                    }
+                    changed = true;
+                }
+                break;
+            case PPU_MODE_VBLANK:
+                if (lineCycles >= CYCLES_PER_LINE) {
+                    lineCycles -= CYCLES_PER_LINE;
+                    if (ly + 1 == LINES_PER_FRAME) {
+                        windowLine = 0;
+                        setLy(0);
+                        setMode(PPU_MODE_OAM);
+                    } else {
+                        setLy(ly + 1);
+                        updateStat();
+                    }
+                    changed = true;
+                }
+                break;
+        }
+    }
+}
+
+void Ppu::renderLine() {
+    TIMELINE_SCOPE_ARG("scanline", ly);
+    if (cgb) {
+        renderLineCgb();
+        return;
+    }
+    const uint8_t *vram[2] = {mmu->getPage(PAGE_VRAM0), mmu->getPage(PAGE_VRAM1)};
+    auto vramByte = [&vram](uint16_t addr) {
+        return vram[(addr >> 12) & 1][addr & (MMU_PAGE_SIZE - 1)];
+    };
+    uint8_t lcdc = mmu->readIo(LCDC);
+    uint8_t bgp = mmu->readIo(BGP);
+    uint8_t *line = framebuffer + ly * SCREEN_WIDTH;
+    // color index before palette, sprites need it for priority
+    uint8_t bgIndex[SCREEN_WIDTH] = {};
+
+    if (lcdc & 0x01) {
+        uint8_t scx = mmu->readIo(SCX);
+        uint8_t scy = mmu->readIo(SCY);
+        uint8_t wy = mmu->readIo(WY);
+        int wx = mmu->readIo(WX) - 7;
+        bool window = (lcdc & 0x20) && ly >= wy && wx < SCREEN_WIDTH;
+        for (int x = 0; x < SCREEN_WIDTH; x++) {
+            uint16_t map;
+            uint8_t px, py;
+            if (window && x >= wx) {
+                map = (lcdc & 0x40) ? 0x9C00 : 0x9800;
+                px = x - wx;
+                py = windowLine;
+            } else {
+                map = (lcdc & 0x08) ? 0x9C00 : 0x9800;
+                px = x + scx;
+                py = ly + scy;
+            }
+            uint8_t tile = vramByte(map + (py / 8) * 32 + (px / 8));
+            uint16_t tileAddr = (lcdc & 0x10) ? 0x8000 + tile * 16 : 0x9000 + int8_t(tile) * 16;
+            uint8_t lo = vramByte(tileAddr + (py % 8) * 2);
+            uint8_t hi = vramByte(tileAddr + (py % 8) * 2 + 1);
+            uint8_t bit = 7 - (px % 8);
+            bgIndex[x] = (((hi >> bit) & 1) << 1) | ((lo >> bit) & 1);
+        }
+        if (window) windowLine++;
+    }
+    for (int x = 0; x < SCREEN_WIDTH; x++) {
+        line[x] = (bgp >> (bgIndex[x] * 2)) & 0x03;
+    }
+
+    if (!(lcdc & 0x02)) return;
+    const uint8_t *oam = mmu->getPage(PAGE_HIGH);
+    int height = spriteHeight;
+    int count;
+    const uint8_t *sprites = getLineSprites(count);
+    // draw lowest priority first
+    for (int i = count - 1; i >= 0; i--) {
+        const uint8_t *sprite = oam + sprites[i] * 4;
+        int y = sprite[0] - 16;
+        int x = sprite[1] - 8;
+        uint8_t tile = sprite[2];
+        uint8_t attr = sprite[3];
+        uint8_t palette = mmu->readIo((attr & 0x10) ? OBP1 : OBP0);
+        int row = ly - y;
+        if (attr & 0x40) row = height - 1 - row;
+        if (height == 16) tile &= 0xFE;
+        uint16_t tileAddr = 0x8000 + tile * 16 + row * 2;
+        uint8_t lo = vramByte(tileAddr);
+        uint8_t hi = vramByte(tileAddr + 1);
+        for (int px = 0; px < 8; px++) {
+            int screenX = x + px;
+            if (screenX < 0 || screenX >= SCREEN_WIDTH) continue;
+            uint8_t bit = (attr & 0x20) ? px : 7 - px;
+            uint8_t color = (((hi >> bit) & 1) << 1) | ((lo >> bit) & 1);
+            if (color == 0) continue;
+            if ((attr & 0x80) && bgIndex[screenX] != 0) continue;
+            line[screenX] = (palette >> (color * 2)) & 0x03;
+        }
+    }
+}
+
+// BG map attributes come from VRAM bank 1 and the palettes from palette
+// memory. LCDC bit 0 takes BG priority away instead of hiding the BG.
+void Ppu::renderLineCgb() {
+    const uint8_t *vram[4] = {mmu->getPage(PAGE_VRAM0), mmu->getPage(PAGE_VRAM1), mmu->getPage(PAGE_VRAM2),
+        mmu->getPage(PAGE_VRAM3)};
+    auto vramByte = [&vram](int bank, uint16_t addr) {
+        return vram[bank * 2 + ((addr >> 12) & 1)][addr & (MMU_PAGE_SIZE - 1)];
+    };
+    uint8_t lcdc = mmu->readIo(LCDC);
+    uint8_t *line = framebuffer + ly * SCREEN_WIDTH;
+    uint16_t *colors = colorFramebuffer + ly * SCREEN_WIDTH;
+    uint8_t bgIndex[SCREEN_WIDTH];
+    // attribute bit 7, BG over sprites
+    uint8_t bgPriority[SCREEN_WIDTH];
+
+    uint8_t scx = mmu->readIo(SCX);
+    uint8_t scy = mmu->readIo(SCY);
+    uint8_t wy = mmu->readIo(WY);
+    int wx = mmu->readIo(WX) - 7;
+    bool window = (lcdc & 0x20) && ly >= wy && wx < SCREEN_WIDTH;
+    for (int x = 0; x < SCREEN_WIDTH; x++) {
+        uint16_t map;
+        uint8_t px, py;
+        if (window && x >= wx) {
+            map = (lcdc & 0x40) ? 0x9C00 : 0x9800;
+            px = x - wx;
+            py = windowLine;
+        } else {
+            map = (lcdc & 0x08) ? 0x9C00 : 0x9800;
+            px = x + scx;
+            py = ly + scy;
+        }
+        uint16_t mapAddr = map + (py / 8) * 32 + (px / 8);
+        uint8_t tile = vramByte(0, mapAddr);
+        uint8_t attr = vramByte(1, mapAddr);
+        int row = (attr & 0x40) ? 7 - (py % 8) : py % 8;
+        uint16_t tileAddr = (lcdc & 0x10) ? 0x8000 + tile * 16 : 0x9000 + int8_t(tile) * 16;
+        int bank = (attr >> 3) & 1;
+        uint8_t lo = vramByte(bank, tileAddr + row * 2);
+        uint8_t hi = vramByte(bank, tileAddr + row * 2 + 1);
+        uint8_t bit = (attr & 0x20) ? px % 8 : 7 - (px % 8);
+        uint8_t index = (((hi >> bit) & 1) << 1) | ((lo >> bit) & 1);
+        int entry = (attr & 0x07) * 4 + index;
+        line[x] = paletteShades[0][entry];
+        colors[x] = paletteColors[0][entry];
+        bgIndex[x] = index;
+        bgPriority[x] = attr & 0x80;
+    }
+    if (window) windowLine++;
+
+    if (!(lcdc & 0x02)) return;
+    const uint8_t *oam = mmu->getPage(PAGE_HIGH);
+    int height = spriteHeight;
+    bool bgMaster = lcdc & 0x01;
+    int count;
+    const uint8_t *sprites = getLineSprites(count);
+    // draw lowest priority first
+    for (int i = count - 1; i >= 0; i--) {
+        const uint8_t *sprite = oam + sprites[i] * 4;
+        int y = sprite[0] - 16;
+        int x = sprite[1] - 8;
+        uint8_t tile = sprite[2];
+        uint8_t attr = sprite[3];
+        int row = ly - y;
+        if (attr & 0x40) row = height - 1 - row;
+        if (height == 16) tile &= 0xFE;
+        int bank = (attr >> 3) & 1;
+        uint16_t tileAddr = 0x8000 + tile * 16 + row * 2;
+        uint8_t lo = vramByte(bank, tileAddr);
+        uint8_t hi = vramByte(bank, tileAddr + 1);
+        int palette = (attr & 0x07) * 4;
+        for (int px = 0; px < 8; px++) {
+            int screenX = x + px;
+            if (screenX < 0 || screenX >= SCREEN_WIDTH) continue;
+            uint8_t bit = (attr & 0x20) ? px : 7 - px;
+            uint8_t color = (((hi >> bit) & 1) << 1) | ((lo >> bit) & 1);
+            if (color == 0) continue;
+            if (bgMaster && bgIndex[screenX] != 0 && ((attr & 0x80) || bgPriority[screenX])) continue;
+            line[screenX] = paletteShades[1][palette + color];
+            colors[screenX] = paletteColors[1][palette + color];
+        }
+    }
+}
+
+// adds or removes sprite index on the visible lines it covers
+void Ppu::placeSprite(int index, bool add) {
+    int top = spriteY[index] - 16;
+    int bottom = std::min(top + spriteHeight, SCREEN_HEIGHT);
+    uint64_t bit = uint64_t(1) << index;
+    for (int line = std::max(top, 0); line < bottom; line++) {
+        lineSprites[line] = add ? (lineSprites[line] | bit) : (lineSprites[line] & ~bit);
+        lineDirty[line] = true;
+    }
+}
+
+// the sprite's x moved, its lines need sorting again
+void Ppu::touchSprite(int index) {
+    int top = spriteY[index] - 16;
+    int bottom = std::min(top + spriteHeight, SCREEN_HEIGHT);
+    for (int line = std::max(top, 0); line < bottom; line++) {
+        lineDirty[line] = true;
+    }
+}
+
+void Ppu::resetSprites() {
+    const uint8_t *oam = mmu->getPage(PAGE_HIGH);
+    spriteHeight = (mmu->readIo(LCDC) & 0x04) ? 16 : 8;
+    std::fill(lineSprites, lineSprites + SCREEN_HEIGHT, 0);
+    std::fill(lineDirty, lineDirty + SCREEN_HEIGHT, true);
+    for (int i = 0; i < OAM_SPRITES; i++) {
+        spriteY[i] = oam[i * 4];
+        spriteX[i] = oam[i * 4 + 1];
+        placeSprite(i, true);
+    }
+}
+
+// only entries whose position changed are moved
+void Ppu::syncSprites() {
+    const uint8_t *oam = mmu->getPage(PAGE_HIGH);
+    for (int i = 0; i < OAM_SPRITES; i++) {
+        if (oam[i * 4] != spriteY[i]) {
+            placeSprite(i, false);
+            spriteY[i] = oam[i * 4];
+            placeSprite(i, true);
+        }
+        if (oam[i * 4 + 1] != spriteX[i]) {
+            spriteX[i] = oam[i * 4 + 1];
+            touchSprite(i);
+        }
+    }
+}
+
+// the first ten sprites on ly in oam order, on DMG sorted so smaller x
+// wins and then lower oam index
+const uint8_t *Ppu::getLineSprites(int &count) {
+    uint8_t *order = lineOrder[ly];
+    if (lineDirty[ly]) {
+        uint64_t pending = lineSprites[ly];
+        int n = 0;
+        while (pending && n < SPRITES_PER_LINE) {
+            order[n++] = __builtin_ctzll(pending);
+            pending &= pending - 1;
+        }
+        // CGB goes by oam index alone
+        const uint8_t *x = spriteX;
+        if (!cgb) std::stable_sort(order, order + n, [x](uint8_t a, uint8_t b) { return x[a] < x[b]; });
+        lineCount[ly] = n;
+        lineDirty[ly] = false;
+    }
+    count = lineCount[ly];
+    return order;
+}
+
+void Ppu::forkFrom(Ppu *parent) {
+    lineCycles = parent->lineCycles;
+    mode = parent->mode;
+    ly = parent->ly;
+    windowLine = parent->windowLine;
+    statLine = parent->statLine;
+    rendering = parent->rendering;
+    resetSprites();
+    std::copy(parent->framebuffer, parent->framebuffer + SCREEN_WIDTH * SCREEN_HEIGHT, framebuffer);
+    if (cgb) {
+        std::copy(parent->colorFramebuffer, parent->colorFramebuffer + SCREEN_WIDTH * SCREEN_HEIGHT,
+                colorFramebuffer);
+    }
+    std::copy(&parent->paletteRam[0][0], &parent->paletteRam[0][0] + sizeof(paletteRam), &paletteRam[0][0]);
+    for (int entry = 0; entry < 64; entry++) resolveColor(entry / 32, entry % 32);
+}
+
+void Ppu::saveState(std::vector<uint8_t> &state) {
+    uint8_t data[] = {uint8_t(lineCycles), uint8_t(lineCycles >> 8), mode, ly, windowLine, statLine};
+    state.insert(state.end(), data, data + sizeof(data));
+    if (cgb) state.insert(state.end(), &paletteRam[0][0], &paletteRam[0][0] + sizeof(paletteRam));
+}
+
+const uint8_t *Ppu::loadState(const uint8_t *state) {
+    lineCycles = state[0] | (state[1] << 8);
+    mode = state[2];
+    ly = state[3];
+    windowLine = state[4];
+    statLine = state[5];
+    resetSprites();
+    state += 6;
+    if (cgb) {
+        std::copy(state, state + sizeof(paletteRam), &paletteRam[0][0]);
+        state += sizeof(paletteRam);
+        for (int entry = 0; entry < 64; entry++) resolveColor(entry / 32, entry % 32);
+    }
+    return state;
+}
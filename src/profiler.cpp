@@ -0,0 +1,175 @@
+/*
+ * profiler.cpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include "include/profiler.hpp"
+
+static bool isCall(uint8_t opcode) {
+  // CALL, CALL cc and RST
+  return opcode == 0xCD || (opcode & 0xE7) == 0xC4 || (opcode & 0xC7) == 0xC7;
+}
+static bool isReturn(uint8_t opcode) {
+  // RET, RETI and RET cc
+  return opcode == 0xC9 || opcode == 0xD9 || (opcode & 0xE7) == 0xC0;
+}
+static bool isPush(uint8_t opcode) { return (opcode & 0xCF) == 0xC5; }
+static bool isInterruptVector(uint16_t addr) {
+  return addr >= 0x40 && addr <= 0x60 && (addr & 0x07) == 0;
+}
+
+Profiler::Profiler(Cpu *cpu, Mmu *mmu) {
+  this->cpu = cpu;
+  this->mmu = mmu;
+  reset();
+}
+void Profiler::reset() {
+  nodes.assign(1, ProfileNode{0, 0, 0, 1});
+  children.clear();
+  stack.clear();
+  pcCycles.clear();
+  current = 0;
+  lastPc = lastSp = 0;
+  lastOpcode = 0;
+  lastKey = 0;
+}
+// ROM addresses are keyed by the bank mapped there, MBC1 mode 1 also
+// switches the 0x0000 window
+uint32_t Profiler::functionKey(uint16_t addr) {
+  int bank = 0;
+  if (addr < 0x4000) {
+    bank = mmu->getRomBank0();
+  } else if (addr < 0x8000) {
+    bank = mmu->getRomBank();
+  }
+  return (static_cast<uint32_t>(bank) << 16) | addr;
+}
+void Profiler::enter(uint16_t addr, uint16_t sp) {
+  if (stack.size() >= PROFILER_MAX_DEPTH) return;
+  uint32_t function = functionKey(addr);
+  uint64_t edge = (static_cast<uint64_t>(current) << 32) | function;
+  auto found = children.find(edge);
+  uint32_t node;
+  if (found == children.end()) {
+    node = nodes.size();
+    nodes.push_back(ProfileNode{current, function, 0, 0});
+    children.emplace(edge, node);
+  } else {
+    node = found->second;
+  }
+  nodes[node].calls++;
+  stack.push_back(Frame{current, sp});
+  current = node;
+}
+// unwinds every frame whose return address is now above the stack
+void Profiler::leave(uint16_t sp) {
+  while (!stack.empty() && stack.back().sp < sp) {
+    current = stack.back().node;
+    stack.pop_back();
+  }
+}
+
+void Profiler::before() {
+  lastPc = cpu->cpuRegister.pc;
+  lastSp = cpu->cpuRegister.sp;
+  lastOpcode = mmu->peekByte(lastPc);
+  lastKey = functionKey(lastPc);
+}
+void Profiler::after(uint8_t tick) {
+  uint32_t bank = lastKey >> 16;
+  if (bank >= pcCycles.size()) pcCycles.resize(bank + 1);
+  if (pcCycles[bank].empty()) pcCycles[bank].assign(0x10000, 0);
+  pcCycles[bank][lastPc] += tick;
+  nodes[current].cycles += tick;
+
+  uint16_t pc = cpu->cpuRegister.pc;
+  uint16_t sp = cpu->cpuRegister.sp;
+  if (sp == static_cast<uint16_t>(lastSp - 2)) {
+    if (isCall(lastOpcode) || (isInterruptVector(pc) && !isPush(lastOpcode))) {
+      enter(pc, sp);
+    }
+  } else if (sp == static_cast<uint16_t>(lastSp + 2) && isReturn(lastOpcode)) {
+    leave(sp);
+  }
+}
+uint64_t Profiler::getCycles(uint16_t addr, int bank) {
+  if (bank >= static_cast<int>(pcCycles.size()) || pcCycles[bank].empty()) return 0;
+  return pcCycles[bank][addr];
+}
+
+std::string Profiler::functionName(uint32_t function) {
+  char name[16];
+  snprintf(name, sizeof(name), "%02X:%04X", function >> 16, function & 0xFFFF);
+  return name;
+}
+bool Profiler::writeFolded(const std::string &filePath) {
+  std::ofstream stream(filePath);
+  if (!stream.is_open()) {
+    printf("%s: Could not write profile\n", filePath.c_str());
+    return false;
+  }
+  std::vector<std::string> paths(nodes.size());
+  paths[0] = "root";
+  // parents are always created before their children
+  for (size_t i = 1; i < nodes.size(); i++) {
+    paths[i] = paths[nodes[i].parent] + ";" + functionName(nodes[i].function);
+  }
+  for (size_t i = 0; i < nodes.size(); i++) {
+    if (nodes[i].cycles) stream << paths[i] << " " << nodes[i].cycles << "\n";
+  }
+  return true;
+}
+void Profiler::printTable(int rows) {
+  struct Row {
+    uint64_t self;
+    uint64_t total;
+    uint64_t calls;
+  };
+  std::map<uint32_t, Row> table;
+  uint64_t allCycles = 0;
+  for (size_t i = 0; i < nodes.size(); i++) {
+    const ProfileNode &node = nodes[i];
+    allCycles += node.cycles;
+    if (i == 0) continue;
+    Row &row = table[node.function];
+    row.self += node.cycles;
+    row.calls += node.calls;
+    // recursive functions count once per stack
+    std::vector<uint32_t> seen;
+    for (uint32_t walk = i; walk != 0; walk = nodes[walk].parent) {
+      uint32_t function = nodes[walk].function;
+      if (std::find(seen.begin(), seen.end(), function) != seen.end()) continue;
+      seen.push_back(function);
+      table[function].total += node.cycles;
+    }
+  }
+  std::vector<std::pair<uint32_t, Row>> sorted(table.begin(), table.end());
+  std::sort(sorted.begin(), sorted.end(), [](const std::pair<uint32_t, Row> &a, const std::pair<uint32_t, Row> &b) {
+    return a.second.self > b.second.self;
+  });
+  printf("Root self cycles: %lu of %lu\n", nodes[0].cycles, allCycles);
+  printf("%-9s %14s %7s %14s %10s\n", "FUNCTION", "SELF", "SELF%", "TOTAL", "CALLS");
+  for (int i = 0; i < rows && i < static_cast<int>(sorted.size()); i++) {
+    const Row &row = sorted[i].second;
+    printf("%-9s %14lu %6.2f%% %14lu %10lu\n", functionName(sorted[i].first).c_str(), row.self,
+        allCycles ? 100.0 * row.self / allCycles : 0.0, row.total, row.calls);
+  }
+}
@@ -0,0 +1,75 @@
+/*
+ * scheduler.cpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdint>
+#include "include/scheduler.hpp"
+
+Scheduler::Scheduler() {
+  clock = nullptr;
+  for (int i = 0; i < EVENT_COUNT; i++) due[i] = UINT64_MAX;
+  next = UINT64_MAX;
+  speedShift = 0;
+  cpuBase = 0;
+  clockBase = 0;
+}
+
+void Scheduler::refresh() {
+  next = UINT64_MAX;
+  for (int i = 0; i < EVENT_COUNT; i++) {
+    if (due[i] < next) next = due[i];
+  }
+}
+
+void Scheduler::scheduleAt(int event, uint64_t at) {
+  due[event] = at;
+  refresh();
+}
+void Scheduler::cancel(int event) {
+  due[event] = UINT64_MAX;
+  refresh();
+}
+
+int Scheduler::pop(uint64_t now) {
+  if (now < next) return -1;
+  int event = 0;
+  for (int i = 1; i < EVENT_COUNT; i++) {
+    if (due[i] < due[event]) event = i;
+  }
+  cancel(event);
+  return event;
+}
+
+void Scheduler::setDoubleSpeed(bool doubleSpeed) {
+  cpuBase = cpuNow();
+  clockBase = *clock;
+  speedShift = doubleSpeed ? 1 : 0;
+}
+void Scheduler::resetSpeed(bool doubleSpeed) {
+  cpuBase = clockBase = *clock;
+  speedShift = doubleSpeed ? 1 : 0;
+}
+void Scheduler::forkFrom(const Scheduler *parent) {
+  cpuBase = parent->cpuBase;
+  clockBase = parent->clockBase;
+  speedShift = parent->speedShift;
+}
+
+void Scheduler::scheduleCpuAt(int event, uint64_t cpuAt) {
+  uint64_t const round = (uint64_t(1) << speedShift) - 1;
+  scheduleAt(event, clockBase + ((cpuAt - cpuBase + round) >> speedShift));
+}
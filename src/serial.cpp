@@ -0,0 +1,118 @@
+/*
+ * serial.cpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include "include/serial.hpp"
+#include "include/mmu.hpp"
+
+uint8_t SerialLog::exchange(uint8_t byte) {
+  if (out) fputc(byte, out);
+  if (byte == '\n') {
+    onLine(line);
+    line.clear();
+  } else {
+    line += char(byte);
+  }
+  // nothing connected, the line floats high
+  return 0xFF;
+}
+
+void SerialTestResult::reset() {
+  SerialLog::reset();
+  titled = false;
+  passed = false;
+}
+void SerialTestResult::onLine(const std::string &line) {
+  if (!titled) {
+    printf("TEST: %-40s", line.c_str());
+    titled = true;
+  }
+  size_t const length = strlen("Passed");
+  if (line.size() >= length && line.compare(line.size() - length, length, "Passed") == 0) {
+    passed = true;
+  }
+}
+
+SerialPort::SerialPort(Mmu *mmu, Scheduler *scheduler) {
+  this->mmu = mmu;
+  this->scheduler = scheduler;
+  sink = nullptr;
+  mmu->mapIo(SC_ADDR, this, IO_WRITE);
+}
+
+void SerialPort::reset() { scheduler->cancel(EVENT_SERIAL); }
+void SerialPort::setSink(SerialSink *sink) { this->sink = sink; }
+
+void SerialPort::writeControl(uint8_t value) {
+  if ((value & SC_START) && (value & SC_INTERNAL_CLOCK)) {
+    scheduler->schedule(EVENT_SERIAL, scheduler->toClock(SERIAL_TRANSFER_CYCLES));
+    return;
+  }
+  scheduler->cancel(EVENT_SERIAL);
+  // the external clock is driven by a peer, see receive
+  if ((value & SC_START) && sink) sink->listen(mmu->readIo(SB_ADDR));
+}
+
+void SerialPort::writeRegister(uint16_t addr, uint8_t value) {
+  mmu->writeIo(addr, value);
+  writeControl(value);
+}
+
+void SerialPort::complete() {
+  finish(sink ? sink->exchange(mmu->readIo(SB_ADDR)) : 0xFF);
+}
+
+bool SerialPort::receive(uint8_t in) {
+  uint8_t control = mmu->readIo(SC_ADDR);
+  if (!(control & SC_START) || (control & SC_INTERNAL_CLOCK)) return false;
+  finish(in);
+  return true;
+}
+
+void SerialPort::finish(uint8_t in) {
+  mmu->writeIo(SB_ADDR, in);
+  mmu->writeIo(SC_ADDR, mmu->readIo(SC_ADDR) & ~SC_START);
+  mmu->requestInterrupt(INTERRUPT_SERIAL);
+}
+
+bool SerialPort::isTransferring() const { return scheduler->isScheduled(EVENT_SERIAL); }
+
+void SerialPort::forkFrom(SerialPort *parent) {
+  if (parent->isTransferring()) {
+    scheduler->scheduleAt(EVENT_SERIAL, parent->scheduler->getDue(EVENT_SERIAL));
+  } else {
+    scheduler->cancel(EVENT_SERIAL);
+  }
+}
+
+void SerialPort::saveState(std::vector<uint8_t> &state) {
+  uint16_t remaining = 0;
+  if (isTransferring()) remaining = scheduler->getDue(EVENT_SERIAL) - scheduler->now();
+  state.push_back(uint8_t(remaining));
+  state.push_back(uint8_t(remaining >> 8));
+}
+const uint8_t *SerialPort::loadState(const uint8_t *state) {
+  uint16_t remaining = state[0] | (state[1] << 8);
+  if (remaining) {
+    scheduler->schedule(EVENT_SERIAL, remaining);
+  } else {
+    scheduler->cancel(EVENT_SERIAL);
+  }
+  return state + 2;
+}
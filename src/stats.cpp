@@ -0,0 +1,87 @@
+/*
+ * stats.cpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include "include/stats.hpp"
+#include "include/timeline.hpp"
+
+static const char *REGION_NAMES[STATS_REGION_COUNT] = {"rom", "vram", "sram", "wram", "oam", "io", "hram"};
+static const char *HOST_NAMES[STATS_HOST_COUNT] = {"cpu", "ppu", "apu", "scheduler"};
+
+static void writeGroup(FILE *file, const char *name, const uint64_t *values, const char **names, int count) {
+  fprintf(file, ",\"%s\":{", name);
+  for (int i = 0; i < count; i++) {
+    fprintf(file, "%s\"%s\":%lu", i ? "," : "", names[i], values[i]);
+  }
+  fputc('}', file);
+}
+// nonzero entries only, keyed by opcode in hex
+static void writeHistogram(FILE *file, const char *name, const uint64_t *values) {
+  fprintf(file, ",\"%s\":{", name);
+  bool first = true;
+  for (int i = 0; i < 0x100; i++) {
+    if (!values[i]) continue;
+    fprintf(file, "%s\"%02X\":%lu", first ? "" : ",", i, values[i]);
+    first = false;
+  }
+  fputc('}', file);
+}
+
+StatsWriter::StatsWriter() { file = nullptr; }
+StatsWriter::~StatsWriter() {
+  if (file) fclose(file);
+}
+
+bool StatsWriter::open(const std::string &filePath) {
+  if (file) fclose(file);
+  file = fopen(filePath.c_str(), "w");
+  if (!file) {
+    printf("%s: Could not write stats\n", filePath.c_str());
+    return false;
+  }
+  return true;
+}
+bool StatsWriter::isOpen() { return file != nullptr; }
+
+void StatsWriter::writeCounters(const PerfCounters &counters) {
+  fprintf(file, "{\"frames\":%lu,\"instructions\":%lu,\"cycles\":%lu", counters.frames, counters.instructions,
+      counters.cycles);
+  writeGroup(file, "reads", counters.memory.reads, REGION_NAMES, STATS_REGION_COUNT);
+  writeGroup(file, "writes", counters.memory.writes, REGION_NAMES, STATS_REGION_COUNT);
+  fprintf(file, ",\"bankSwitches\":%lu,\"interrupts\":%lu,\"haltedCycles\":%lu", counters.memory.bankSwitches,
+      counters.interrupts, counters.haltedCycles);
+  writeGroup(file, "hostNs", counters.hostNs, HOST_NAMES, STATS_HOST_COUNT);
+}
+
+void StatsWriter::write(const PerfCounters &counters) {
+  if (!file) return;
+  TIMELINE_SCOPE("stats flush");
+  writeCounters(counters);
+  fputs("}\n", file);
+}
+
+void StatsWriter::close(const PerfCounters &counters) {
+  if (!file) return;
+  writeCounters(counters);
+  writeHistogram(file, "opcodes", counters.opcodes);
+  writeHistogram(file, "opcodesCb", counters.opcodesCb);
+  fputs("}\n", file);
+  fclose(file);
+  file = nullptr;
+}
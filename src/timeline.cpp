@@ -0,0 +1,125 @@
+/*
+ * timeline.cpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include "include/timeline.hpp"
+
+struct TimelineSpan {
+  const char *name;
+  uint64_t start;
+  uint64_t end;
+  uint64_t arg;
+};
+
+// written only by its own thread
+struct TimelineBuffer {
+  std::string name;
+  std::vector<TimelineSpan*> chunks;
+  size_t used;
+  uint64_t dropped;
+};
+
+bool Timeline::active = false;
+
+static std::mutex buffersLock;
+// kept after their threads exit, so short lived workers still show up
+static std::vector<TimelineBuffer*> buffers;
+static thread_local TimelineBuffer *localBuffer = nullptr;
+static uint64_t startTicks;
+static uint64_t startNs;
+
+static uint64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static TimelineBuffer *threadBuffer() {
+  if (localBuffer) return localBuffer;
+  std::lock_guard<std::mutex> guard(buffersLock);
+  localBuffer = new TimelineBuffer();
+  localBuffer->name = "thread " + std::to_string(buffers.size());
+  localBuffer->used = TIMELINE_CHUNK_SPANS;
+  localBuffer->dropped = 0;
+  buffers.push_back(localBuffer);
+  return localBuffer;
+}
+
+void Timeline::start() {
+  startTicks = now();
+  startNs = nowNs();
+  active = true;
+}
+
+void Timeline::setThreadName(const std::string &name) { threadBuffer()->name = name; }
+
+void Timeline::record(const char *name, uint64_t start, uint64_t end, uint64_t arg) {
+  TimelineBuffer *buffer = threadBuffer();
+  if (buffer->used == TIMELINE_CHUNK_SPANS) {
+    if (buffer->chunks.size() == TIMELINE_MAX_CHUNKS) {
+      buffer->dropped++;
+      return;
+    }
+    buffer->chunks.push_back(new TimelineSpan[TIMELINE_CHUNK_SPANS]);
+    buffer->used = 0;
+  }
+  buffer->chunks.back()[buffer->used++] = {name, start, end, arg};
+}
+
+bool Timeline::write(const std::string &filePath) {
+  // ticks per ns, measured over the whole recording
+  double scale = 1.0;
+  uint64_t elapsedNs = nowNs() - startNs;
+  if (elapsedNs > 0) scale = double(now() - startTicks) / elapsedNs;
+  if (scale <= 0) scale = 1.0;
+  FILE *file = fopen(filePath.c_str(), "w");
+  if (!file) {
+    printf("%s: Could not write timeline\n", filePath.c_str());
+    return false;
+  }
+  std::lock_guard<std::mutex> guard(buffersLock);
+  fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  bool first = true;
+  uint64_t spans = 0, dropped = 0;
+  for (size_t tid = 0; tid < buffers.size(); tid++) {
+    TimelineBuffer *buffer = buffers[tid];
+    fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"%s\"}}",
+        first ? "" : ",\n", tid, buffer->name.c_str());
+    first = false;
+    for (size_t chunk = 0; chunk < buffer->chunks.size(); chunk++) {
+      size_t count = chunk + 1 == buffer->chunks.size() ? buffer->used : TIMELINE_CHUNK_SPANS;
+      for (size_t i = 0; i < count; i++) {
+        const TimelineSpan &span = buffer->chunks[chunk][i];
+        // microseconds with ns precision
+        double ts = (span.start - startTicks) / scale / 1e3;
+        double dur = (span.end - span.start) / scale / 1e3;
+        fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f,"
+            "\"args\":{\"arg\":%lu}}", span.name, tid, ts, dur, span.arg);
+      }
+      spans += count;
+    }
+    dropped += buffer->dropped;
+  }
+  fprintf(file, "\n]}\n");
+  fclose(file);
+  printf("Timeline: %lu spans, %lu dropped\n", spans, dropped);
+  return true;
+}
@@ -0,0 +1,137 @@
+/*
+ * timer.cpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdint>
+#include "include/timer.hpp"
+#include "include/mmu.hpp"
+
+// t-cycles per TIMA increment for TAC bits 0-1, TIMA counts falling
+// edges of one bit of the internal divider
+static const uint32_t TIMA_PERIODS[] = {1024, 16, 64, 256};
+
+Timer::Timer(Mmu *mmu, Scheduler *scheduler) {
+  this->mmu = mmu;
+  this->scheduler = scheduler;
+  divBase = 0;
+  tima = 0;
+  timaBase = 0;
+  overflowAt = 0;
+  tac = 0;
+  mmu->mapIo(DIV_ADDR, this, IO_READ | IO_WRITE);
+  mmu->mapIo(TIMA_ADDR, this, IO_READ | IO_WRITE);
+  mmu->mapIo(TAC_ADDR, this, IO_WRITE);
+}
+
+void Timer::reset() {
+  divBase = scheduler->cpuNow();
+  tima = 0;
+  tac = 0;
+  rebase();
+}
+
+uint32_t Timer::period() const { return TIMA_PERIODS[tac & 0x03]; }
+
+uint8_t Timer::timaAt(uint64_t now) const {
+  if (!(tac & TAC_ENABLE)) return tima;
+  uint64_t const edges = (now - divBase) / period() - (timaBase - divBase) / period();
+  return uint8_t(tima + edges);
+}
+
+uint8_t Timer::readDiv() const { return uint8_t((scheduler->cpuNow() - divBase) >> 8); }
+uint8_t Timer::readTima() const { return timaAt(scheduler->cpuNow()); }
+
+void Timer::rebase() {
+  uint64_t const now = scheduler->cpuNow();
+  tima = timaAt(now);
+  timaBase = now;
+  if (!(tac & TAC_ENABLE)) {
+    scheduler->cancel(EVENT_TIMER);
+    return;
+  }
+  // the edge that wraps TIMA, counted on the divider
+  uint64_t const edge = (now - divBase) / period() + (0x100 - tima);
+  overflowAt = divBase + edge * period();
+  scheduler->scheduleCpuAt(EVENT_TIMER, overflowAt);
+}
+
+void Timer::writeDiv() {
+  tima = timaAt(scheduler->cpuNow());
+  divBase = scheduler->cpuNow();
+  timaBase = divBase;
+  rebase();
+}
+void Timer::writeTima(uint8_t value) {
+  tima = value;
+  timaBase = scheduler->cpuNow();
+  rebase();
+}
+void Timer::writeTac(uint8_t value) {
+  rebase();
+  tac = value & 0x07;
+  rebase();
+}
+
+uint8_t Timer::readRegister(uint16_t addr) {
+  return addr == DIV_ADDR ? readDiv() : readTima();
+}
+void Timer::writeRegister(uint16_t addr, uint8_t value) {
+  switch (addr) {
+    case DIV_ADDR:
+      writeDiv();
+      break;
+    case TIMA_ADDR:
+      mmu->writeIo(addr, value);
+      writeTima(value);
+      break;
+    case TAC_ADDR:
+      mmu->writeIo(addr, value | 0xF8);
+      writeTac(value);
+      break;
+  }
+}
+
+void Timer::overflow() {
+  // counting restarts at the wrap, rebase adds the edges since
+  tima = mmu->readIo(TMA_ADDR);
+  timaBase = overflowAt;
+  mmu->requestInterrupt(INTERRUPT_TIMER);
+  rebase();
+}
+
+void Timer::forkFrom(Timer *parent) {
+  divBase = parent->divBase;
+  tima = parent->tima;
+  timaBase = parent->timaBase;
+  tac = parent->tac;
+  rebase();
+}
+
+void Timer::saveState(std::vector<uint8_t> &state) {
+  uint64_t const now = scheduler->cpuNow();
+  uint16_t divider = uint16_t(now - divBase);
+  uint8_t data[] = {uint8_t(divider), uint8_t(divider >> 8), timaAt(now), tac};
+  state.insert(state.end(), data, data + sizeof(data));
+}
+const uint8_t *Timer::loadState(const uint8_t *state) {
+  divBase = scheduler->cpuNow() - (state[0] | (state[1] << 8));
+  tima = state[2];
+  timaBase = scheduler->cpuNow();
+  tac = state[3];
+  rebase();
+  return state + 4;
+}
@@ -0,0 +1,198 @@
+/*
+ * trace.cpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include "include/trace.hpp"
+#include "include/timeline.hpp"
+
+TraceRecorder::TraceRecorder(Cpu *cpu, Mmu *mmu) {
+  this->cpu = cpu;
+  this->mmu = mmu;
+  file = nullptr;
+  buffer = nullptr;
+  position = 0;
+  closing = false;
+  records = bytes = 0;
+  writeCount = 0;
+  memset(watchedPages, WATCH_WRITE, sizeof(watchedPages));
+}
+TraceRecorder::~TraceRecorder() { close(); }
+
+bool TraceRecorder::open(const std::string &filePath) {
+  file = fopen(filePath.c_str(), "wb");
+  if (!file) {
+    printf("%s: Could not write trace\n", filePath.c_str());
+    return false;
+  }
+  uint8_t header[6] = {
+    TRACE_MAGIC & 0xFF, (TRACE_MAGIC >> 8) & 0xFF, (TRACE_MAGIC >> 16) & 0xFF, TRACE_MAGIC >> 24,
+    TRACE_VERSION & 0xFF, TRACE_VERSION >> 8,
+  };
+  fwrite(header, 1, sizeof(header), file);
+  bytes = sizeof(header);
+  // the reader starts from all zero, so does the recorded state
+  memset(regs, 0, sizeof(regs));
+  sp = 0;
+  predictedPc = 0;
+  code.assign(0x10000, 0);
+  records = 0;
+  closing = false;
+  for (int i = 0; i < TRACE_BUFFER_COUNT - 1; i++) {
+    spare.push_back(new uint8_t[TRACE_BUFFER_SIZE]);
+  }
+  buffer = new uint8_t[TRACE_BUFFER_SIZE];
+  position = 0;
+  flusher = std::thread(&TraceRecorder::flushLoop, this);
+  mmu->setWatcher(this);
+  return true;
+}
+void TraceRecorder::close() {
+  if (!file) return;
+  mmu->setWatcher(nullptr);
+  submit();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    closing = true;
+  }
+  changed.notify_all();
+  flusher.join();
+  delete[] buffer;
+  buffer = nullptr;
+  for (auto block : spare) delete[] block;
+  spare.clear();
+  fclose(file);
+  file = nullptr;
+}
+bool TraceRecorder::isOpen() { return file != nullptr; }
+
+// hands the current buffer to the flush thread, waits for a spare one
+// only when all of them are queued
+void TraceRecorder::submit() {
+  std::unique_lock<std::mutex> lock(mutex);
+  full.emplace_back(buffer, position);
+  bytes += position;
+  changed.notify_all();
+  changed.wait(lock, [this] { return !spare.empty(); });
+  buffer = spare.back();
+  spare.pop_back();
+  position = 0;
+}
+void TraceRecorder::flushLoop() {
+  TIMELINE_THREAD("trace flush");
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    changed.wait(lock, [this] { return closing || !full.empty(); });
+    if (full.empty()) break;
+    std::pair<uint8_t*, size_t> block = full.front();
+    full.pop_front();
+    lock.unlock();
+    {
+      TIMELINE_SCOPE_ARG("trace flush", block.second);
+      fwrite(block.first, 1, block.second, file);
+    }
+    lock.lock();
+    spare.push_back(block.first);
+    changed.notify_all();
+  }
+}
+
+void TraceRecorder::before() {
+  CpuRegister &reg = cpu->cpuRegister;
+  nextRegs[TRACE_A] = reg.reg_a;
+  nextRegs[TRACE_F] = reg.reg_f;
+  nextRegs[TRACE_B] = reg.reg_b;
+  nextRegs[TRACE_C] = reg.reg_c;
+  nextRegs[TRACE_D] = reg.reg_d;
+  nextRegs[TRACE_E] = reg.reg_e;
+  nextRegs[TRACE_H] = reg.reg_h;
+  nextRegs[TRACE_L] = reg.reg_l;
+  nextPc = reg.pc;
+  nextSp = reg.sp;
+  for (int i = 0; i < 4; i++) {
+    nextCode[i] = mmu->peekByte(nextPc + i);
+  }
+  writeCount = 0;
+}
+void TraceRecorder::after(uint8_t tick) {
+  uint8_t *out = buffer + position;
+  uint8_t *start = out;
+  uint8_t flags = 0;
+  uint8_t mask = 0;
+  out += 2;
+  if (nextPc != predictedPc) {
+    flags |= TRACE_PC;
+    *out++ = nextPc & 0xFF;
+    *out++ = nextPc >> 8;
+  }
+  if (nextSp != sp) {
+    flags |= TRACE_SP;
+    *out++ = nextSp & 0xFF;
+    *out++ = nextSp >> 8;
+    sp = nextSp;
+  }
+  for (int i = 0; i < TRACE_REGISTER_COUNT; i++) {
+    if (nextRegs[i] != regs[i]) {
+      mask |= 1 << i;
+      *out++ = nextRegs[i];
+      regs[i] = nextRegs[i];
+    }
+  }
+  bool codeChanged = false;
+  for (int i = 0; i < 4; i++) {
+    codeChanged |= code[static_cast<uint16_t>(nextPc + i)] != nextCode[i];
+  }
+  if (codeChanged) {
+    flags |= TRACE_CODE;
+    for (int i = 0; i < 4; i++) {
+      code[static_cast<uint16_t>(nextPc + i)] = nextCode[i];
+      *out++ = nextCode[i];
+    }
+  }
+  if (writeCount >= TRACE_WRITES_EXTENDED) {
+    flags |= TRACE_WRITES_EXTENDED << TRACE_WRITES_SHIFT;
+    *out++ = writeCount;
+  } else {
+    flags |= writeCount << TRACE_WRITES_SHIFT;
+  }
+  for (int i = 0; i < writeCount; i++) {
+    *out++ = writeAddr[i] & 0xFF;
+    *out++ = writeAddr[i] >> 8;
+    *out++ = writeValue[i];
+  }
+  *out++ = tick;
+  start[0] = flags;
+  start[1] = mask;
+  position = out - buffer;
+  predictedPc = tracePredictPc(nextPc, nextCode[0]);
+  records++;
+  if (position > TRACE_BUFFER_SIZE - TRACE_MAX_RECORD) submit();
+}
+uint64_t TraceRecorder::getRecords() { return records; }
+uint64_t TraceRecorder::getBytes() { return bytes + position; }
+
+const uint8_t *TraceRecorder::getWatchedPages() { return watchedPages; }
+void TraceRecorder::onRead(uint16_t addr, uint8_t value) {}
+void TraceRecorder::onWrite(uint16_t addr, uint8_t value) {
+  if (writeCount < TRACE_MAX_WRITES) {
+    writeAddr[writeCount] = addr;
+    writeValue[writeCount] = value;
+    writeCount++;
+  }
+}
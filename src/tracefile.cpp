@@ -0,0 +1,215 @@
+/*
+ * tracefile.cpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "include/tracefile.hpp"
+
+#define TRACE_HEADER_SIZE 6
+
+TraceSource::TraceSource() {
+  data = nullptr;
+  size = position = 0;
+}
+TraceSource::~TraceSource() { close(); }
+
+bool TraceSource::map(const std::string &filePath) {
+  close();
+  int fd = ::open(filePath.c_str(), O_RDONLY);
+  if (fd < 0) {
+    printf("%s: File could not be found\n", filePath.c_str());
+    return false;
+  }
+  struct stat info;
+  fstat(fd, &info);
+  size = info.st_size;
+  void *memory = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+  ::close(fd);
+  if (memory == MAP_FAILED) {
+    printf("%s: Could not map trace\n", filePath.c_str());
+    size = 0;
+    return false;
+  }
+  data = static_cast<const uint8_t*>(memory);
+  madvise(memory, size, MADV_SEQUENTIAL);
+  position = 0;
+  memset(&state, 0, sizeof(state));
+  state.index = static_cast<uint64_t>(-1);
+  return true;
+}
+void TraceSource::close() {
+  if (data) munmap(const_cast<uint8_t*>(data), size);
+  data = nullptr;
+  size = position = 0;
+}
+bool TraceSource::isBinary(const std::string &filePath) {
+  uint8_t header[4] = {};
+  FILE *file = fopen(filePath.c_str(), "rb");
+  if (!file) return false;
+  size_t length = fread(header, 1, sizeof(header), file);
+  fclose(file);
+  return length == sizeof(header) &&
+      static_cast<uint32_t>(header[0] | header[1] << 8 | header[2] << 16 | header[3] << 24) == TRACE_MAGIC;
+}
+
+bool TraceReader::open(const std::string &filePath) {
+  if (!map(filePath)) return false;
+  if (size < TRACE_HEADER_SIZE || (data[0] | data[1] << 8 | data[2] << 16 | data[3] << 24) != TRACE_MAGIC ||
+      (data[4] | data[5] << 8) != TRACE_VERSION) {
+    printf("%s: Not a trace file!\n", filePath.c_str());
+    close();
+    return false;
+  }
+  position = TRACE_HEADER_SIZE;
+  code.assign(0x10000, 0);
+  state.hasCode = true;
+  predictedPc = 0;
+  return true;
+}
+
+const TraceEntry *TraceReader::next() {
+  const uint8_t *in = data + position;
+  const uint8_t *end = data + size;
+  if (!data || end - in < 3) return nullptr;
+  uint8_t flags = *in++;
+  uint8_t mask = *in++;
+  int fixed = __builtin_popcount(mask) + ((flags & TRACE_PC) ? 2 : 0) + ((flags & TRACE_SP) ? 2 : 0) +
+      ((flags & TRACE_CODE) ? 4 : 0);
+  if (end - in < fixed + 1) return nullptr;
+  state.index++;
+  state.cycles += state.tick;
+  state.pc = predictedPc;
+  if (flags & TRACE_PC) {
+    state.pc = in[0] | in[1] << 8;
+    in += 2;
+  }
+  if (flags & TRACE_SP) {
+    state.sp = in[0] | in[1] << 8;
+    in += 2;
+  }
+  for (int i = 0; i < TRACE_REGISTER_COUNT; i++) {
+    if (mask & (1 << i)) state.regs[i] = *in++;
+  }
+  if (flags & TRACE_CODE) {
+    for (int i = 0; i < 4; i++) {
+      code[static_cast<uint16_t>(state.pc + i)] = *in++;
+    }
+  }
+  for (int i = 0; i < 4; i++) {
+    state.code[i] = code[static_cast<uint16_t>(state.pc + i)];
+  }
+  state.writeCount = (flags >> TRACE_WRITES_SHIFT) & TRACE_WRITES_MASK;
+  if (state.writeCount == TRACE_WRITES_EXTENDED) {
+    state.writeCount = *in++;
+  }
+  if (end - in < state.writeCount * 3 + 1) return nullptr;
+  for (int i = 0; i < state.writeCount; i++) {
+    state.writeAddr[i] = in[0] | in[1] << 8;
+    state.writeValue[i] = in[2];
+    in += 3;
+  }
+  state.tick = *in++;
+  position = in - data;
+  predictedPc = tracePredictPc(state.pc, state.code[0]);
+  return &state;
+}
+
+bool DoctorReader::open(const std::string &filePath) { return map(filePath); }
+
+static int hexDigit(uint8_t c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+// parses hex digits at in, advancing it
+static uint16_t parseHex(const uint8_t *&in, const uint8_t *end) {
+  uint16_t value = 0;
+  int digit;
+  while (in < end && (digit = hexDigit(*in)) >= 0) {
+    value = (value << 4) | digit;
+    in++;
+  }
+  return value;
+}
+const TraceEntry *DoctorReader::next() {
+  const uint8_t *in = data + position;
+  const uint8_t *end = data + size;
+  // skip blank lines
+  while (in < end && (*in == '\n' || *in == '\r')) in++;
+  if (!data || in >= end) return nullptr;
+  const uint8_t *lineEnd = static_cast<const uint8_t*>(memchr(in, '\n', end - in));
+  if (!lineEnd) lineEnd = end;
+  static const char REGISTER_KEYS[TRACE_REGISTER_COUNT] = {'A', 'F', 'B', 'C', 'D', 'E', 'H', 'L'};
+  state.index++;
+  state.hasCode = false;
+  while (in < lineEnd) {
+    const uint8_t *key = in;
+    while (in < lineEnd && *in != ':' && *in != ' ') in++;
+    if (in >= lineEnd || *in != ':') {
+      in++;
+      continue;
+    }
+    size_t keyLength = in - key;
+    in++;
+    if (keyLength == 1) {
+      for (int i = 0; i < TRACE_REGISTER_COUNT; i++) {
+        if (key[0] == REGISTER_KEYS[i]) state.regs[i] = parseHex(in, lineEnd);
+      }
+    } else if (keyLength == 2 && key[0] == 'S' && key[1] == 'P') {
+      state.sp = parseHex(in, lineEnd);
+    } else if (keyLength == 2 && key[0] == 'P' && key[1] == 'C') {
+      state.pc = parseHex(in, lineEnd);
+    } else if (keyLength == 5 && memcmp(key, "PCMEM", 5) == 0) {
+      for (int i = 0; i < 4 && in < lineEnd; i++) {
+        state.code[i] = parseHex(in, lineEnd);
+        if (in < lineEnd && *in == ',') in++;
+      }
+      state.hasCode = true;
+    }
+    while (in < lineEnd && *in != ' ') in++;
+  }
+  position = (lineEnd < end ? lineEnd + 1 : end) - data;
+  return &state;
+}
+
+int formatDoctor(const TraceEntry &entry, char *out, size_t size) {
+  const uint8_t *regs = entry.regs;
+  return snprintf(out, size,
+      "A:%02X F:%02X B:%02X C:%02X D:%02X E:%02X H:%02X L:%02X SP:%04X PC:%04X PCMEM:%02X,%02X,%02X,%02X",
+      regs[TRACE_A], regs[TRACE_F], regs[TRACE_B], regs[TRACE_C], regs[TRACE_D], regs[TRACE_E],
+      regs[TRACE_H], regs[TRACE_L], entry.sp, entry.pc,
+      entry.code[0], entry.code[1], entry.code[2], entry.code[3]);
+}
+int formatReadable(const TraceEntry &entry, char *out, size_t size) {
+  const uint8_t *regs = entry.regs;
+  int length = snprintf(out, size,
+      "%10lu  PC: %04X (%02X) %-14s AF: %02X%02X  BC: %02X%02X  DE: %02X%02X  HL: %02X%02X  SP: %04X  +%u",
+      entry.cycles, entry.pc, entry.code[0], OP_INSTRUCTION[entry.code[0]], regs[TRACE_A], regs[TRACE_F],
+      regs[TRACE_B], regs[TRACE_C], regs[TRACE_D], regs[TRACE_E], regs[TRACE_H], regs[TRACE_L],
+      entry.sp, entry.tick);
+  for (int i = 0; i < entry.writeCount && length < static_cast<int>(size); i++) {
+    length += snprintf(out + length, size - length, "  [%04X]=%02X", entry.writeAddr[i], entry.writeValue[i]);
+  }
+  return length;
+}
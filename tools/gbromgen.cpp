@@ -0,0 +1,428 @@
+/*
+ * gbromgen.cpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Emits small synthetic ROMs for benchmarks and profiling.
+//   gbromgen [-n iterations] {scenario} {output.gb}
+//   gbromgen -l            lists the scenarios
+// Every ROM runs its workload for the given number of iterations,
+// stores a checksum at 0xFF80, prints "Passed" over serial and spins
+// on `jr -2`, which is what gbemu's test automation stops on.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#define ROM_BANK_SIZE 0x4000
+#define CODE_START 0x0150
+#define PRINT_ROUTINE 0x0200
+#define PASSED_STRING 0x0240
+#define DATA_TABLE 0x0300
+#define SMC_TEMPLATE 0x0400
+#define DMA_TEMPLATE 0x0420
+#define DMA_ROUTINE 0xFF82
+#define RESULT_ADDR 0x80
+
+static const uint8_t NINTENDO_LOGO[] = {
+  0xCE, 0xED, 0x66, 0x66, 0xCC, 0x0D, 0x00, 0x0B, 0x03, 0x73, 0x00, 0x83, 0x00, 0x0C, 0x00, 0x0D,
+  0x00, 0x08, 0x11, 0x1F, 0x88, 0x89, 0x00, 0x0E, 0xDC, 0xCC, 0x6E, 0xE6, 0xDD, 0xDD, 0xD9, 0x99,
+  0xBB, 0xBB, 0x67, 0x63, 0x6E, 0x0E, 0xEC, 0xCC, 0xDD, 0xDC, 0x99, 0x9F, 0xBB, 0xB9, 0x33, 0x3E,
+};
+
+// Straight-line assembler, loops only jump backwards so labels are
+// plain addresses taken with here(). place() writes anywhere in the
+// file without moving pc, for vectors, tables and switchable banks.
+class Rom {
+ private:
+  std::vector<uint8_t> data;
+  uint16_t pc;
+
+ public:
+  explicit Rom(int banks) : data(size_t(banks) * ROM_BANK_SIZE, 0), pc(0) {}
+  void org(uint16_t addr) { pc = addr; }
+  uint16_t here() { return pc; }
+  void emit(std::initializer_list<uint8_t> bytes) {
+    for (uint8_t byte : bytes) data[pc++] = byte;
+  }
+  void place(size_t offset, std::initializer_list<uint8_t> bytes) {
+    for (uint8_t byte : bytes) data[offset++] = byte;
+  }
+  void ld16(uint8_t opcode, uint16_t value) { emit({opcode, uint8_t(value), uint8_t(value >> 8)}); }
+  // jr cc/jr to an earlier address
+  void jrBack(uint8_t opcode, uint16_t target) { emit({opcode, uint8_t(target - (pc + 2))}); }
+  // dec bc, jr nz while bc != 0, clobbers a
+  void loopBc(uint16_t target) {
+    emit({0x0B, 0x78, 0xB1});
+    jrBack(0x20, target);
+  }
+  void header(const char *title, uint8_t cartType, uint8_t sizeCode, bool cgb) {
+    // entry: nop, jp CODE_START
+    org(0x100);
+    emit({0x00, 0xC3, uint8_t(CODE_START), uint8_t(CODE_START >> 8)});
+    memcpy(&data[0x104], NINTENDO_LOGO, sizeof(NINTENDO_LOGO));
+    strncpy(reinterpret_cast<char*>(&data[0x134]), title, 15);
+    data[0x143] = cgb ? 0x80 : 0x00;
+    data[0x147] = cartType;
+    data[0x148] = sizeCode;
+  }
+  void checksum() {
+    uint8_t header = 0;
+    for (int i = 0x134; i <= 0x14C; i++) header = header - data[i] - 1;
+    data[0x14D] = header;
+    uint16_t global = 0;
+    for (size_t i = 0; i < data.size(); i++) {
+      if (i != 0x14E && i != 0x14F) global += data[i];
+    }
+    data[0x14E] = global >> 8;
+    data[0x14F] = global & 0xFF;
+  }
+  std::vector<uint8_t> &bytes() { return data; }
+};
+
+// shared by every scenario: serial print routine, the end marker and
+// RETI on every interrupt vector
+static void emitCommon(Rom &rom) {
+  for (uint16_t vector = 0x40; vector <= 0x60; vector += 8) {
+    rom.place(vector, {0xD9});
+  }
+  // print: ld a,(hl+); or a; ret z; ldh (01),a; ld a,81; ldh (02),a
+  // wait: ldh a,(02); add a,a; jr c,wait; jr print
+  rom.org(PRINT_ROUTINE);
+  uint16_t print = rom.here();
+  rom.emit({0x2A, 0xB7, 0xC8, 0xE0, 0x01, 0x3E, 0x81, 0xE0, 0x02});
+  uint16_t wait = rom.here();
+  rom.emit({0xF0, 0x02, 0x87});
+  rom.jrBack(0x38, wait);
+  rom.jrBack(0x18, print);
+  rom.place(PASSED_STRING, {'P', 'a', 's', 's', 'e', 'd', '\n', 0});
+  // data for the copy workloads
+  for (int i = 0; i < 0x100; i++) {
+    rom.bytes()[DATA_TABLE + i] = uint8_t(i * 7 + 3);
+  }
+}
+
+// di; ld sp,fffe; ld bc,iterations
+static void emitStart(Rom &rom, uint16_t iterations) {
+  rom.org(CODE_START);
+  rom.emit({0xF3});
+  rom.ld16(0x31, 0xFFFE);
+  rom.ld16(0x01, iterations);
+}
+
+// ldh (80),a; ld hl,PASSED_STRING; call print; jr -2
+static void emitEnd(Rom &rom) {
+  rom.emit({0xE0, RESULT_ADDR});
+  rom.ld16(0x21, PASSED_STRING);
+  rom.ld16(0xCD, PRINT_ROUTINE);
+  rom.emit({0x18, 0xFE});
+}
+
+static void alu(Rom &rom) {
+  // ld a,0; ld d,13; ld e,37; ld h,0
+  rom.emit({0x3E, 0x00, 0x16, 0x13, 0x1E, 0x37, 0x26, 0x00});
+  uint16_t loop = rom.here();
+  for (int i = 0; i < 4; i++) {
+    // add a,d; adc a,e; xor b; sub c; and f7; or h; inc d; dec e; rlca;
+    // add a,11; cp 42; sbc a,d; ld h,a
+    rom.emit({0x82, 0x8B, 0xA8, 0x91, 0xE6, 0xF7, 0xB4, 0x14, 0x1D, 0x07, 0xC6, 0x11, 0xFE, 0x42, 0x9A, 0x67});
+  }
+  // bc is the loop counter, a is restored from h after the test
+  rom.emit({0x0B, 0x78, 0xB1, 0x7C});
+  rom.jrBack(0x20, loop);
+}
+
+static void cb(Rom &rom) {
+  // ld hl,c000; ld (hl),5a; ld d,01; ld e,80
+  rom.ld16(0x21, 0xC000);
+  rom.emit({0x36, 0x5A, 0x16, 0x01, 0x1E, 0x80});
+  uint16_t loop = rom.here();
+  // rlc d; rrc e; swap d; bit 3,e; set 5,d; res 2,e; srl d; sla e
+  rom.emit({0xCB, 0x02, 0xCB, 0x0B, 0xCB, 0x32, 0xCB, 0x5B, 0xCB, 0xEA, 0xCB, 0x93, 0xCB, 0x3A, 0xCB, 0x23});
+  // rl (hl); rr (hl); swap (hl); bit 7,(hl); set 0,(hl); res 7,(hl)
+  rom.emit({0xCB, 0x16, 0xCB, 0x1E, 0xCB, 0x36, 0xCB, 0x7E, 0xCB, 0xC6, 0xCB, 0xBE});
+  rom.loopBc(loop);
+  // ld a,(hl); xor d; xor e
+  rom.emit({0x7E, 0xAA, 0xAB});
+}
+
+static void memcpy256(Rom &rom) {
+  uint16_t outer = rom.here();
+  // push bc; memset c000-c0ff to c: ld hl,c000; ld a,c; ld b,0; ld (hl+),a; dec b; jr nz
+  rom.emit({0xC5});
+  rom.ld16(0x21, 0xC000);
+  rom.emit({0x79, 0x06, 0x00});
+  uint16_t fill = rom.here();
+  rom.emit({0x22, 0x05});
+  rom.jrBack(0x20, fill);
+  // rom to wram: ld hl,DATA_TABLE; ld de,c100; ld b,0; ld a,(hl+); ld (de),a; inc de; dec b; jr nz
+  rom.ld16(0x21, DATA_TABLE);
+  rom.ld16(0x11, 0xC100);
+  rom.emit({0x06, 0x00});
+  uint16_t copy = rom.here();
+  rom.emit({0x2A, 0x12, 0x13, 0x05});
+  rom.jrBack(0x20, copy);
+  // wram to wram: ld hl,c000; ld de,c200; ld b,0; ld a,(hl+); ld (de),a; inc de; dec b; jr nz
+  rom.ld16(0x21, 0xC000);
+  rom.ld16(0x11, 0xC200);
+  rom.emit({0x06, 0x00});
+  uint16_t move = rom.here();
+  rom.emit({0x2A, 0x12, 0x13, 0x05});
+  rom.jrBack(0x20, move);
+  // pop bc
+  rom.emit({0xC1});
+  rom.loopBc(outer);
+  // ld a,(c1ff); ld hl,c2ff; xor (hl)
+  rom.ld16(0xFA, 0xC1FF);
+  rom.ld16(0x21, 0xC2FF);
+  rom.emit({0xAE});
+}
+
+#define BANKSWITCH_BANKS 8
+
+static void bankswitch(Rom &rom) {
+  // every switchable bank adds its number to the result:
+  // ldh a,(80); add a,n; ldh (80),a; ret, and keeps n at 0x4010
+  for (int bank = 1; bank < BANKSWITCH_BANKS; bank++) {
+    size_t base = size_t(bank) * ROM_BANK_SIZE;
+    rom.place(base, {0xF0, RESULT_ADDR, 0xC6, uint8_t(bank), 0xE0, RESULT_ADDR, 0xC9});
+    rom.place(base + 0x10, {uint8_t(bank)});
+  }
+  // ld d,1; xor a; ldh (80),a
+  rom.emit({0x16, 0x01, 0xAF, 0xE0, RESULT_ADDR});
+  uint16_t loop = rom.here();
+  // ld a,d; ld (2000),a; call 4000; ld a,(4010); ld e,a
+  rom.emit({0x7A});
+  rom.ld16(0xEA, 0x2000);
+  rom.ld16(0xCD, 0x4000);
+  rom.ld16(0xFA, 0x4010);
+  rom.emit({0x5F});
+  // inc d; ld a,d; cp 8; jr c,+2; ld d,1
+  rom.emit({0x14, 0x7A, 0xFE, BANKSWITCH_BANKS, 0x38, 0x02, 0x16, 0x01});
+  rom.loopBc(loop);
+  // ldh a,(80); add a,e
+  rom.emit({0xF0, RESULT_ADDR, 0x83});
+}
+
+static void halt(Rom &rom) {
+  // timer handler counts interrupts at 0xFF81:
+  // push af; ldh a,(81); inc a; ldh (81),a; pop af; reti
+  rom.place(0x50, {0xF5, 0xF0, RESULT_ADDR + 1, 0x3C, 0xE0, RESULT_ADDR + 1, 0xF1, 0xD9});
+  // xor a; ldh (81),a; ldh (06),a; ldh (0f),a; ld a,05; ldh (07),a;
+  // ld a,04; ldh (ff),a; ei
+  rom.emit({0xAF, 0xE0, RESULT_ADDR + 1, 0xE0, 0x06, 0xE0, 0x0F, 0x3E, 0x05, 0xE0, 0x07,
+      0x3E, 0x04, 0xE0, 0xFF, 0xFB});
+  uint16_t loop = rom.here();
+  // halt; nop
+  rom.emit({0x76, 0x00});
+  rom.loopBc(loop);
+  // di; ldh a,(81)
+  rom.emit({0xF3, 0xF0, RESULT_ADDR + 1});
+}
+
+static void smc(Rom &rom) {
+  // routine copied to c000 and patched every iteration:
+  // ld a,n; add a,e; ld e,a; ret
+  rom.place(SMC_TEMPLATE, {0x3E, 0x00, 0x83, 0x5F, 0xC9});
+  // push bc; ld hl,SMC_TEMPLATE; ld de,c000; ld b,5; ld a,(hl+); ld (de),a; inc de; dec b; jr nz; pop bc
+  rom.emit({0xC5});
+  rom.ld16(0x21, SMC_TEMPLATE);
+  rom.ld16(0x11, 0xC000);
+  rom.emit({0x06, 0x05});
+  uint16_t copy = rom.here();
+  rom.emit({0x2A, 0x12, 0x13, 0x05});
+  rom.jrBack(0x20, copy);
+  rom.emit({0xC1, 0x1E, 0x00});
+  uint16_t loop = rom.here();
+  // ld a,c; ld (c001),a; call c000
+  rom.emit({0x79});
+  rom.ld16(0xEA, 0xC001);
+  rom.ld16(0xCD, 0xC000);
+  rom.loopBc(loop);
+  // ld a,e
+  rom.emit({0x7B});
+}
+
+static void dma(Rom &rom) {
+  // the usual HRAM routine, waits out the 160 m-cycle transfer:
+  // ld a,c1; ldh (46),a; ld a,28; dec a; jr nz,-3; ret
+  rom.place(DMA_TEMPLATE, {0x3E, 0xC1, 0xE0, 0x46, 0x3E, 0x28, 0x3D, 0x20, 0xFD, 0xC9});
+  // push bc; ld hl,DMA_TEMPLATE; ld de,DMA_ROUTINE; ld b,10; ld a,(hl+); ld (de),a; inc de; dec b; jr nz; pop bc
+  rom.emit({0xC5});
+  rom.ld16(0x21, DMA_TEMPLATE);
+  rom.ld16(0x11, DMA_ROUTINE);
+  rom.emit({0x06, 0x0A});
+  uint16_t copy = rom.here();
+  rom.emit({0x2A, 0x12, 0x13, 0x05});
+  rom.jrBack(0x20, copy);
+  rom.emit({0xC1, 0x1E, 0x00});
+  uint16_t loop = rom.here();
+  // ld a,c; ld (c100),a; call DMA_ROUTINE; ld a,(fe00); add a,e; ld e,a
+  rom.emit({0x79});
+  rom.ld16(0xEA, 0xC100);
+  rom.ld16(0xCD, DMA_ROUTINE);
+  rom.ld16(0xFA, 0xFE00);
+  rom.emit({0x83, 0x5F});
+  rom.loopBc(loop);
+  // ld a,e
+  rom.emit({0x7B});
+}
+
+static void cgb(Rom &rom) {
+  // switch to double speed: ld a,01; ldh (4d),a; stop
+  rom.emit({0x3E, 0x01, 0xE0, 0x4D, 0x10, 0x00});
+  uint16_t loop = rom.here();
+  // tag WRAM bank c&7 and VRAM bank c&1 with c:
+  // ld a,c; and 07; ldh (70),a; ld a,c; ld (d000),a
+  // ld a,c; and 01; ldh (4f),a; ld a,c; ld (8000),a
+  rom.emit({0x79, 0xE6, 0x07, 0xE0, 0x70, 0x79});
+  rom.ld16(0xEA, 0xD000);
+  rom.emit({0x79, 0xE6, 0x01, 0xE0, 0x4F, 0x79});
+  rom.ld16(0xEA, 0x8000);
+  rom.loopBc(loop);
+  // sum the tags of WRAM banks 7-1:
+  // ld e,00; ld b,07; sum: ld a,b; ldh (70),a; ld a,(d000); add a,e; ld e,a; dec b; jr nz,sum
+  rom.emit({0x1E, 0x00, 0x06, 0x07});
+  uint16_t sum = rom.here();
+  rom.emit({0x78, 0xE0, 0x70});
+  rom.ld16(0xFA, 0xD000);
+  rom.emit({0x83, 0x5F, 0x05});
+  rom.jrBack(0x20, sum);
+  // and of both VRAM banks:
+  // xor a; ldh (4f),a; ld a,(8000); add a,e; ld e,a; ld a,01; ldh (4f),a; ld a,(8000); add a,e
+  rom.emit({0xAF, 0xE0, 0x4F});
+  rom.ld16(0xFA, 0x8000);
+  rom.emit({0x83, 0x5F, 0x3E, 0x01, 0xE0, 0x4F});
+  rom.ld16(0xFA, 0x8000);
+  rom.emit({0x83});
+}
+
+// drives a link cable transfer per iteration on the internal clock and
+// sums the bytes the peer replies with. A reply of ff means nobody was
+// listening yet, the same byte is sent again.
+static void link(Rom &rom) {
+  // ld de,0000
+  rom.ld16(0x11, 0x0000);
+  uint16_t loop = rom.here();
+  // ld a,d; ldh (01),a; ld a,81; ldh (02),a
+  rom.emit({0x7A, 0xE0, 0x01, 0x3E, 0x81, 0xE0, 0x02});
+  uint16_t wait = rom.here();
+  // ldh a,(02); add a,a; jr c,wait
+  rom.emit({0xF0, 0x02, 0x87});
+  rom.jrBack(0x38, wait);
+  // ldh a,(01); cp ff; jr z,loop
+  rom.emit({0xF0, 0x01, 0xFE, 0xFF});
+  rom.jrBack(0x28, loop);
+  // add a,e; ld e,a; inc d
+  rom.emit({0x83, 0x5F, 0x14});
+  rom.loopBc(loop);
+  // ld a,e
+  rom.emit({0x7B});
+}
+
+// the other end of link: listens on the external clock with a reply
+// that is never ff and sums the bytes it was sent
+static void linkpeer(Rom &rom) {
+  // ld de,0000
+  rom.ld16(0x11, 0x0000);
+  uint16_t loop = rom.here();
+  // ld a,d; and 7f; xor 55; ldh (01),a; ld a,80; ldh (02),a
+  rom.emit({0x7A, 0xE6, 0x7F, 0xEE, 0x55, 0xE0, 0x01, 0x3E, 0x80, 0xE0, 0x02});
+  uint16_t wait = rom.here();
+  // ldh a,(02); add a,a; jr c,wait
+  rom.emit({0xF0, 0x02, 0x87});
+  rom.jrBack(0x38, wait);
+  // ldh a,(01); add a,e; ld e,a; inc d
+  rom.emit({0xF0, 0x01, 0x83, 0x5F, 0x14});
+  rom.loopBc(loop);
+  // ld a,e
+  rom.emit({0x7B});
+}
+
+struct Scenario {
+  const char *name;
+  const char *description;
+  void (*emit)(Rom &rom);
+  uint16_t iterations;
+  // MBC1 with BANKSWITCH_BANKS banks when set
+  bool banked;
+  // CGB flag in the header
+  bool cgb;
+};
+
+static const Scenario SCENARIOS[] = {
+  {"alu", "register ALU ops in a tight loop", alu, 0xFFFF, false, false},
+  {"cb", "CB rotates, shifts and bit ops on registers and (hl)", cb, 0xFFFF, false, false},
+  {"memcpy", "memset and memcpy of 256 bytes through ld (hl+)", memcpy256, 0x0800, false, false},
+  {"bankswitch", "MBC1 bank switch, banked call and read per iteration", bankswitch, 0xFFFF, true, false},
+  {"halt", "halt until the timer interrupt, every iteration", halt, 0x1000, false, false},
+  {"smc", "patches and calls a routine in WRAM", smc, 0xFFFF, false, false},
+  {"dma", "OAM DMA from WRAM through an HRAM routine", dma, 0x4000, false, false},
+  {"cgb", "CGB WRAM and VRAM bank switching in double speed", cgb, 0x4000, false, true},
+  {"link", "link cable transfers on the internal clock, run with linkpeer", link, 50, false, false},
+  {"linkpeer", "link cable transfers on the external clock, run with link", linkpeer, 50, false, false},
+};
+
+int main(int argc, char **argv) {
+  long iterations = -1;
+  std::vector<std::string> arguments;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-l") == 0) {
+      for (const Scenario &scenario : SCENARIOS) {
+        printf("%-12s %s (%u iterations)\n", scenario.name, scenario.description, scenario.iterations);
+      }
+      return 0;
+    } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      iterations = strtol(argv[++i], nullptr, 0);
+    } else {
+      arguments.push_back(argv[i]);
+    }
+  }
+  if (arguments.size() != 2 || iterations == 0 || iterations > 0xFFFF) {
+    printf("usage: gbromgen [-n iterations] {scenario} {path/to/output.gb}\n");
+    printf("       gbromgen -l\n");
+    return 1;
+  }
+  const Scenario *scenario = nullptr;
+  for (const Scenario &candidate : SCENARIOS) {
+    if (arguments[0] == candidate.name) scenario = &candidate;
+  }
+  if (!scenario) {
+    printf("%s: Unknown scenario, see gbromgen -l\n", arguments[0].c_str());
+    return 1;
+  }
+
+  Rom rom(scenario->banked ? BANKSWITCH_BANKS : 2);
+  // MBC1, 32KB << size code
+  rom.header(scenario->name, scenario->banked ? 0x01 : 0x00, scenario->banked ? 0x02 : 0x00, scenario->cgb);
+  emitCommon(rom);
+  emitStart(rom, iterations < 0 ? scenario->iterations : iterations);
+  scenario->emit(rom);
+  emitEnd(rom);
+  rom.checksum();
+
+  std::ofstream stream(arguments[1], std::ios::binary | std::ios::out);
+  if (!stream.is_open()) {
+    printf("%s: Could not write ROM\n", arguments[1].c_str());
+    return 1;
+  }
+  stream.write(reinterpret_cast<const char*>(rom.bytes().data()), rom.bytes().size());
+  return 0;
+}
@@ -0,0 +1,56 @@
+/*
+ * gbtrace.cpp
+ * Copyright (C) 2022 fireclouu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Decodes traces recorded with `gbemu -d record`.
+//   gbtrace {trace}        readable listing with memory writes
+//   gbtrace -d {trace}     Gameboy Doctor log
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "../src/include/tracefile.hpp"
+
+int main(int argc, char **argv) {
+  bool doctor = false;
+  std::string filePath;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-d") == 0) {
+      doctor = true;
+    } else {
+      filePath = argv[i];
+    }
+  }
+  if (filePath.empty()) {
+    printf("usage: gbtrace [-d] {path/to/trace}\n");
+    return 1;
+  }
+  TraceReader reader;
+  if (!reader.open(filePath)) return 1;
+
+  static char output[1 << 20];
+  setvbuf(stdout, output, _IOFBF, sizeof(output));
+  char line[4096];
+  const TraceEntry *entry;
+  while ((entry = reader.next())) {
+    int length = doctor ? formatDoctor(*entry, line, sizeof(line)) : formatReadable(*entry, line, sizeof(line));
+    if (length >= static_cast<int>(sizeof(line))) length = sizeof(line) - 1;
+    line[length] = '\n';
+    fwrite(line, 1, length + 1, stdout);
+  }
+  return 0;
+}